@@ -0,0 +1,47 @@
+#ifndef __AHI_H__
+#define __AHI_H__
+
+#include <stdint.h>
+
+#define AHI_ENTRIES 4096
+// Finds per hit rate sample, and finds to sit out once switched off.
+#define AHI_WINDOW 4096
+#define AHI_RETRY 65536
+#define AHI_MIN_HIT_PCT 20
+#define AHI_MAX_HEAT 7
+
+// One key's leaf and slot, direct-mapped by the key's hash. seq is odd
+// while the entry is rewritten; a reader that sees the same even seq
+// before and after read a consistent entry. heat counts hits, and a key
+// mapping to the same entry only takes it over once the heat ran out.
+typedef struct ahi_entry_t {
+  uint32_t seq;
+  uint32_t heat;
+  int64_t key;
+  uint64_t leaf_num;  // 0 for an empty entry
+  uint32_t slot;
+} ahi_entry_t;
+
+// Adaptive hash index over the leaves of a B+ tree table. Entries are only
+// hints, the leaf is checked to hold the key before one is trusted. Finds
+// are sampled in windows and the index switches itself off while fewer
+// than AHI_MIN_HIT_PCT percent of them hit, to try again AHI_RETRY finds
+// later. off is set by db_set_adaptive_hash and wins over both.
+typedef struct ahi_t {
+  ahi_entry_t* entries;
+  bool enabled;
+  bool off;
+  uint64_t probes;
+  uint64_t hits;
+  uint64_t skipped;
+} ahi_t;
+
+ahi_t* ahi_create();
+void ahi_destroy(ahi_t* ahi);
+bool ahi_active(ahi_t* ahi);
+void ahi_record(ahi_t* ahi, bool hit);
+bool ahi_lookup(ahi_t* ahi, int64_t key, uint64_t* leaf_num, uint32_t* slot);
+void ahi_learn(ahi_t* ahi, int64_t key, uint64_t leaf_num, uint32_t slot);
+void ahi_forget(ahi_t* ahi, int64_t key);
+
+#endif
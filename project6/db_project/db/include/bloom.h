@@ -0,0 +1,37 @@
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include <stdint.h>
+#include <string>
+
+#define BLOOM_WORDS 8
+#define BLOOM_BITS_PER_KEY 10
+
+// Blocked Bloom filter over int64_t keys: a key picks one 64-byte block and
+// sets one bit in each of its words, so a probe reads a single cache line.
+// Bits are only ever set, deleted keys stay as false positives.
+typedef struct __attribute__((aligned(64))) bloom_block_t {
+  uint64_t word[BLOOM_WORDS];
+} bloom_block_t;
+
+// Probes trust the filter only once ready is set, inserts add their key as
+// soon as it exists. path is the side file the filter is kept in between
+// runs.
+typedef struct bloom_t {
+  uint64_t num_blocks;
+  bloom_block_t* blocks;
+  bool ready;
+  std::string path;
+} bloom_t;
+
+uint64_t bloom_hash(int64_t key);
+bloom_t* bloom_create(uint64_t expected_keys, const char* path);
+void bloom_destroy(bloom_t* bloom);
+void bloom_add(bloom_t* bloom, int64_t key);
+bool bloom_may_contain(bloom_t* bloom, int64_t key);
+// The side file is removed once read, so a run that does not end in
+// bloom_save leaves nothing stale behind.
+int bloom_load(bloom_t* bloom);
+int bloom_save(bloom_t* bloom);
+
+#endif
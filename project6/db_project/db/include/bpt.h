@@ -1,38 +1,422 @@
 #ifndef __BPT_H__
 #define __BPT_H__
 
+#include "ahi.h"
+#include "bloom.h"
+#include "node.h"
+#include "rowcache.h"
 #include "trx.h"
 
+#define SMO_INSERT 0
+#define SMO_DELETE 1
+#define SMO_MERGE 2
+
+#define TREE_BLINK 1
+#define TREE_COUNTED 2
+// Set by open_var_table; such tables only take the var_* calls.
+#define TREE_VARKEY 4
+#define TREE_TOMBSTONE 8
+// Set by open_table for TABLE_HASH; records live in extendible hash buckets.
+#define TREE_HASH 16
+
+// Table organizations open_table can create.
+#define TABLE_BTREE 0
+#define TABLE_HASH 1
+
+typedef int (*scan_callback_t)(int64_t key, char* value, uint16_t val_size,
+                               void* arg);
+
+// The current leaf stays latched between db_cursor_next calls, so the table
+// must not be modified by the cursor owner until db_cursor_close.
+typedef struct scan_cursor_t {
+  int64_t table_id;
+  int64_t hi;
+  int64_t limit;
+  int64_t count;
+  pagenum_t leaf_num;
+  page_t* leaf;
+  int32_t leaf_idx;
+  uint32_t slot;
+  int trx_id;
+  bool done;
+  char* value_buf;  // overflow values handed to db_scan callbacks
+} scan_cursor_t;
+
+typedef struct value_part_t {
+  const char* data;
+  uint16_t size;
+} value_part_t;
+
+typedef struct latched_page_t {
+  pagenum_t page_num;
+  int32_t page_idx;
+} latched_page_t;
+
+#define VIEW_MAX_PARTS ((UINT16_MAX + OVERFLOW_CHUNK - 1) / OVERFLOW_CHUNK)
+
+// A value read in place by db_find_view. The leaf stays latched, and with
+// it the overflow pages of a large value, whose parts then follow the
+// chain; data and size cover the first part only for those. Like a cursor,
+// the owner must not reach the same pages through other calls until the
+// view is released, which its destructor does. Parts and pages are kept
+// inline so a view costs no allocation.
+typedef struct value_view_t {
+  int64_t table_id;
+  uint16_t total;
+  uint32_t num_parts;
+  uint32_t num_pages;
+  value_part_t parts[VIEW_MAX_PARTS];
+  latched_page_t pages[VIEW_MAX_PARTS + 1];
+
+  value_view_t() : table_id(0), total(0), num_parts(0), num_pages(0) {}
+  value_view_t(value_view_t&& other) noexcept : value_view_t() {
+    *this = std::move(other);
+  }
+  value_view_t& operator=(value_view_t&& other) noexcept {
+    if (this != &other) {
+      release();
+      table_id = other.table_id;
+      total = other.total;
+      num_parts = other.num_parts;
+      num_pages = other.num_pages;
+      memcpy(parts, other.parts, sizeof(value_part_t) * num_parts);
+      memcpy(pages, other.pages, sizeof(latched_page_t) * num_pages);
+      other.total = other.num_parts = other.num_pages = 0;
+    }
+    return *this;
+  }
+  value_view_t(const value_view_t&) = delete;
+  value_view_t& operator=(const value_view_t&) = delete;
+  ~value_view_t() { release(); }
+
+  bool valid() const { return num_pages > 0; }
+  const char* data() const { return num_parts ? parts[0].data : nullptr; }
+  uint16_t size() const { return num_parts ? parts[0].size : 0; }
+  uint16_t total_size() const { return total; }
+  void release();
+} value_view_t;
+
+#define BULK_MAX_VALUE UINT16_MAX
+
+typedef int (*bulk_next_t)(void* arg, int64_t* key, char* value,
+                           uint16_t* val_size);
+
+// next() returns 0 for each record, in strictly ascending key order, a
+// positive value at the end of the stream and a negative one on error.
+// value has room for BULK_MAX_VALUE bytes, the largest val_size there is.
+// An error, or a record out of order or of the wrong size, fails the load
+// and leaves the table empty.
+typedef struct bulk_iterator_t {
+  bulk_next_t next;
+  void* arg;
+} bulk_iterator_t;
+
+typedef struct bulk_level_t {
+  page_t* batch;
+  pagenum_t first_num;
+  uint32_t cur;
+  uint32_t children;
+  int64_t low_key;
+  uint64_t records;
+  page_t* held;
+  pagenum_t held_num;
+} bulk_level_t;
+
+typedef struct bulk_loader_t {
+  int64_t table_id;
+  uint64_t leaf_fill;
+  uint32_t internal_fill;
+  bool counted;
+  uint32_t node_flags;
+  uint32_t leaf_flags;
+  uint16_t value_size;
+  pagenum_t start_page;
+  std::vector<bulk_level_t*> levels;
+} bulk_loader_t;
+
+// Keys [begin, end) of a batch lookup that lead to page_num, as seen by a
+// parent in frame parent_idx at parent_version.
+typedef struct find_group_t {
+  pagenum_t page_num;
+  uint32_t begin;
+  uint32_t end;
+  int32_t parent_idx;
+  uint64_t parent_version;
+} find_group_t;
+
+// A node latched by a pessimistic descent. sibling is the node it would
+// be merged with, latched by deletes only; my_index is its position in the
+// parent as in child_index, or -2 for the root. The path is the only record
+// of a node's ancestors, pages keep no parent pointer.
+typedef struct path_entry_t {
+  pagenum_t page_num;
+  page_t* page;
+  int32_t page_idx;
+  int my_index;
+  pagenum_t sibling_num;
+  page_t* sibling;
+  int32_t sibling_idx;
+} path_entry_t;
+
+// Nodes held for a structure modification, root side first. tree_latched
+// is set while the root itself may change. Counted tables keep the whole
+// path from the root so the subtree counts can follow the change.
+typedef struct tree_path_t {
+  int64_t table_id;
+  pthread_mutex_t* tree_latch;
+  bool tree_latched;
+  bool counted;
+  uint32_t node_flags;
+  uint16_t merge_policy;
+  std::vector<path_entry_t> stack;
+} tree_path_t;
+
+// Per-table state, flags, value_size, format, key_type, key_len and
+// merge_policy mirror the header page. leaf_depth is where the last descent met a leaf
+// and last_leaf the rightmost leaf while inserts arrive in ascending order,
+// both hints only. bloom is the table's filter, if the header asks for one,
+// hash the directory of a hash table, ahi the adaptive hash index of a
+// B+ tree table and path the file open_table was given.
+typedef struct tree_t {
+  pthread_mutex_t latch;
+  uint32_t flags;
+  uint16_t value_size;
+  uint16_t format;
+  uint16_t key_type;
+  uint16_t key_len;
+  uint16_t merge_policy;
+  uint32_t leaf_depth;
+  pagenum_t last_leaf;
+  bloom_t* bloom;
+  struct hash_t* hash;
+  ahi_t* ahi;
+  std::string path;
+} tree_t;
+
+typedef std::unordered_map<int64_t, tree_t*> tree_table_t;
+
+// Trees of table ids below TREE_SLOTS are also published in a flat array,
+// so looking one up takes no lock. trees_mutex only guards creating an
+// entry and the map, which holds every tree.
+#define TREE_SLOTS 1024
+
+// An underfull leaf left for the merge thread, found again through key.
+typedef struct merge_task_t {
+  int64_t table_id;
+  pagenum_t leaf_num;
+  int64_t key;
+} merge_task_t;
+
 // API
-int64_t open_table(char *pathname);
+// A nonzero value_size gives a new or empty table fixed-width leaves holding
+// values of exactly that size. An existing table keeps the format in its
+// header, and asking for a different one fails. TABLE_HASH makes an empty
+// table an extendible hash table: insert, find, update and delete work as
+// usual and cost one page access, scans and the B+ tree modes are refused.
+// A table that is already hashed stays so whatever organization is asked.
+int64_t open_table(char *pathname, uint16_t value_size = 0, int organization = TABLE_BTREE);
 int shutdown_db();
 int db_insert(int64_t table_id, int64_t key, char * value, uint16_t val_size);
 int db_delete(int64_t table_id, int64_t key);
+// With trx_id 0 the record is read without a lock, see db_set_row_cache.
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t *val_size, int trx_id);
+// db_find without the copy: the view points into the buffer frames. It is
+// not valid() if the key is missing or the transaction was aborted.
+value_view_t db_find_view(int64_t table_id, int64_t key, int trx_id);
+// Values above OVERFLOW_THRESHOLD bytes are kept in overflow pages and
+// cannot be updated, delete and insert them again instead.
 int db_update(int64_t table_id, int64_t key, char* values, uint16_t new_val_size, uint16_t* old_val_size, int trx_id);
+// db_insert and db_update for a value given as pieces, concatenated in
+// order. Updates copy them straight into the log buffer and the leaf.
+int db_insert_v(int64_t table_id, int64_t key, const struct iovec* iov, int iovcnt);
+int db_update_v(int64_t table_id, int64_t key, const struct iovec* iov, int iovcnt, uint16_t* old_val_size, int trx_id);
+// results[i] is 0 when keys[i] was found and copied into ret_vals[i].
+int db_find_batch(int64_t table_id, int64_t* keys, int n, char** ret_vals, uint16_t* val_sizes, int* results, int trx_id);
+int db_scan(int64_t table_id, int64_t lo, int64_t hi, scan_callback_t callback, void* arg, int trx_id, int64_t limit);
+scan_cursor_t* db_cursor_open(int64_t table_id, int64_t lo, int64_t hi, int trx_id, int64_t limit);
+int db_cursor_next(scan_cursor_t* cursor, int64_t* key, char* ret_val, uint16_t* val_size);
+void db_cursor_close(scan_cursor_t* cursor);
+// Bulk load writes pages straight to the file and is not logged: the caller
+// needs the table to itself for the whole load.
+int db_bulk_load(int64_t table_id, bulk_iterator_t* iter, int fill_percent);
+// Returns the number of keys that were not inserted because they already exist.
+int db_insert_batch(int64_t table_id, int64_t* keys, char** values, uint16_t* sizes, int n);
+int db_set_blink(int64_t table_id, bool enable);
+// Counted tables answer the two below in logarithmic time. The mode can
+// only change while the table is empty.
+int db_set_counted(int64_t table_id, bool enable);
+// New files get PAGE_FORMAT_SPLIT_KEYS; the format of an empty table can be
+// changed, for instance to compare against PAGE_FORMAT_PAIRS.
+int db_set_format(int64_t table_id, uint16_t format);
+// KEY_INT32 tables reject keys outside the int32_t range and store 32-bit
+// keys in split-key nodes and in leaves of either layout.
+int db_set_key_type(int64_t table_id, uint16_t key_type);
+// Makes an empty table a KEY_BYTES table of strings of exactly key_len
+// bytes, 1 to KEY_BYTES_MAX. Keys are passed as key_from_bytes packs them
+// and others are rejected. Split-key nodes and fixed-width leaves store the
+// key_len bytes and search them with memcmp; slotted leaves keep the packed
+// int64_t, which sorts the same way. Longer strings need a variable-length
+// key table (varkey.h).
+int db_set_key_bytes(int64_t table_id, uint16_t key_len);
+// MERGE_EAGER merges or redistributes a leaf as soon as it is underfull,
+// MERGE_AT_EMPTY only once it is empty, and MERGE_BACKGROUND queues
+// underfull leaves for a merge thread so deletes never wait on a merge.
+int db_set_merge_policy(int64_t table_id, uint16_t policy);
+// Deletes of a tombstone table only mark the record, the merge thread
+// removes it later along with the other tombstones of its leaf. Not for
+// counted tables, whose counts would include the tombstones.
+int db_set_tombstones(int64_t table_id, bool enable);
+// Gives the table a Bloom filter sized for expected_keys, built from its
+// leaves, that lets db_find and db_find_batch reject missing keys without
+// a descent. The filter is kept in <path>.bloom across a clean shutdown and
+// rebuilt by open_table otherwise. 0 turns it off; a filter cannot be
+// resized while the table is open.
+int db_set_bloom(int64_t table_id, uint64_t expected_keys);
+// A row cache of capacity bytes, shared by all tables, in front of db_find
+// calls made with trx_id 0. Those read without a record lock, so they may
+// see a value an open transaction wrote; a hit returns the same thing the
+// leaf would have. db_update, db_delete and the undo of an aborting
+// transaction drop the key once the page is changed, so a value rolled back
+// is not served afterwards, and reads with a transaction never use the
+// cache. Only values up to ROWCACHE_MAX_VALUE bytes are kept. 0 empties the
+// cache and turns it off.
+int db_set_row_cache(uint64_t capacity);
+void db_row_cache_stats(rowcache_stats_t* stats);
+// B+ tree tables remember the leaf and slot of keys db_find and db_update
+// keep coming back to, so those skip the descent. The index follows the
+// hit rate on its own; this only keeps it off or lets it run again.
+int db_set_adaptive_hash(int64_t table_id, bool enable);
+// Returns once the merge thread has gone through every queued leaf and
+// tombstone.
+void db_wait_merges();
+int db_count_range(int64_t table_id, int64_t lo, int64_t hi, int64_t* count);
+// rank 0 is the smallest key.
+int db_select_rank(int64_t table_id, int64_t rank, int64_t* key);
+
+// Find
+int child_index(page_t* page, int64_t key);
+int find_batch_leaf(int64_t table_id, find_group_t* group, page_t* page, int32_t page_idx, int64_t* keys, std::vector<uint32_t>& order, char** ret_vals, uint16_t* val_sizes, int* results, int trx_id, std::vector<find_group_t>& next);
+template <typename L>
+int find_batch_leaf(int64_t table_id, find_group_t* group, page_t* page, int32_t page_idx, int64_t* keys, std::vector<uint32_t>& order, char** ret_vals, uint16_t* val_sizes, int* results, int trx_id, std::vector<find_group_t>& next);
+void find_batch_root(int64_t table_id, uint32_t begin, uint32_t end, std::vector<find_group_t>& next);
+int find_batch_descend(int64_t table_id, find_group_t* group, int64_t* keys, std::vector<uint32_t>& order, char** ret_vals, uint16_t* val_sizes, int* results, int trx_id, std::vector<find_group_t>& next);
+int find_batch_split(page_t* page, int32_t page_idx, uint64_t version, find_group_t* group, int64_t* keys, std::vector<uint32_t>& order, std::vector<find_group_t>& next);
+
+// Scan
+pagenum_t read_root(int64_t table_id, int32_t* header_idx, uint64_t* version);
+pagenum_t next_child(page_t* page, int64_t key, int64_t* high_key, bool* bounded);
+pagenum_t find_leaf_blink(int64_t table_id, int64_t key, page_t** leaf, int32_t* leaf_idx, int64_t* high_key, bool* bounded);
+pagenum_t find_leaf_latched(int64_t table_id, int64_t key, page_t** leaf, int32_t* leaf_idx, int64_t* high_key, bool* bounded);
+int cursor_fetch(scan_cursor_t* cursor);
+
+// Counts
+uint32_t* child_counts(page_t* page);
+uint32_t node_flags(tree_t* tree);
+uint32_t leaf_flags(tree_t* tree);
+bool key_fits(tree_t* tree, int64_t key);
+uint32_t node_order(page_t* page);
+uint64_t subtree_count(page_t* page);
+void count_path(tree_path_t* path, int delta);
+page_t* latch_root(int64_t table_id, pagenum_t* root_num, int32_t* root_idx);
+int rank_of(int64_t table_id, int64_t key, bool inclusive, int64_t* rank);
+
+// Latch
+tree_t* give_tree(int64_t table_id);
+void clear_trees();
+pagenum_t find_record_page(int64_t table_id, int64_t key, page_t** page, int32_t* page_idx, uint32_t* slot);
+pagenum_t ahi_find_leaf(int64_t table_id, ahi_t* ahi, int64_t key, page_t** leaf, int32_t* leaf_idx, uint32_t* slot);
+void open_bloom(int64_t table_id);
+void build_bloom(int64_t table_id, bloom_t* bloom);
+void save_blooms();
+void bloom_note(tree_t* tree, int64_t key);
+bool bloom_excludes(tree_t* tree, int64_t key);
+pagenum_t get_root_num(int64_t table_id);
+bool is_safe(page_t* page, int op, int64_t key, uint16_t val_size, bool is_root, uint16_t merge_policy = MERGE_EAGER);
+void release_path(tree_path_t* path, bool success);
+int descend_pessimistic(tree_path_t* path, int64_t key, int op, uint16_t val_size);
 
 // Insert
 int cut(int length);
-void valueCopy(char* src, page_t* dest, int16_t size, int16_t offset);
 pagenum_t find_leaf(int64_t table_id, pagenum_t root_num, int64_t key);
-int insert_into_internal(int64_t table_id, uint32_t index, pagenum_t parent_num, page_t *parent, int32_t parent_idx, pagenum_t l_num, page_t* l, int32_t l_idx, pagenum_t r_num, page_t* r, int32_t r_idx, int64_t key);
-int insert_into_internal_after_splitting(int64_t table_id, uint32_t index, pagenum_t parent_num, page_t *parent, int32_t parent_idx, pagenum_t r_num, int64_t key);
-int insert_into_parent(int64_t table_id, pagenum_t l_num, page_t* l, int32_t l_idx, pagenum_t r_num, page_t* r, int32_t r_idx, int64_t key);
-int insert_into_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num, page_t* leaf, int leaf_idx, int64_t key, char * value, uint16_t val_size);
-int insert_into_leaf_after_splitting(int64_t table_id, uint32_t index, pagenum_t leaf_num, page_t* leaf, int leaf_idx, int64_t key, char* value, uint16_t val_size);
-int start_new_tree(int64_t table_id, int64_t key, char * value, uint16_t val_size);
+int insert_into_internal(tree_path_t* path, int level, uint32_t index, pagenum_t r_num, page_t* r, int32_t r_idx, int64_t key);
+int insert_into_internal_after_splitting(tree_path_t* path, int level, uint32_t index, pagenum_t r_num, uint32_t r_count, int64_t key);
+int insert_into_parent(tree_path_t* path, int level, pagenum_t r_num, page_t* r, int32_t r_idx, int64_t key);
+void leaf_insert_slot(page_t* leaf, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int insert_into_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num, page_t* leaf, int leaf_idx, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int insert_into_leaf_after_splitting(tree_path_t* path, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int start_new_tree(int64_t table_id, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int insert_record(int64_t table_id, tree_t* tree, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+void set_last_leaf(tree_t* tree, pagenum_t leaf_num);
+void note_append(tree_t* tree, pagenum_t leaf_num, page_t* leaf, uint32_t index);
+int append_fast_path(int64_t table_id, tree_t* tree, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int insert_batch_pass(int64_t table_id, int64_t* keys, char** values, uint16_t* sizes, std::vector<uint32_t>& order, std::vector<uint32_t>* deferred, bool split);
+
+// Fixed-width leaves
+void fixed_move(page_t* dest, uint32_t dest_at, page_t* src, uint32_t src_at, uint32_t n);
+void fixed_set_count(page_t* leaf, uint32_t num_keys);
+void fixed_insert(page_t* leaf, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt);
+void fixed_remove(page_t* leaf, uint32_t index);
+int fixed_split(tree_path_t* path, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt);
+void fixed_redistribute(page_t* sibling, page_t* leaf, int my_index);
+
+// Slotted leaves
+template <typename S>
+void slotted_insert(page_t* leaf, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+template <typename S>
+void slotted_split(page_t* leaf, page_t* new_leaf, pagenum_t new_leaf_num, uint32_t index, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+template <typename S>
+void slotted_compact(page_t* leaf);
+template <typename S>
+void slotted_remove(page_t* leaf, uint32_t index);
+template <typename S>
+void slotted_coalesce(page_t* sibling, page_t* leaf);
+template <typename S>
+void slotted_redistribute(page_t* sibling, page_t* leaf, int my_index);
+
+// Overflow
+pagenum_t overflow_write(int64_t table_id, const struct iovec* iov, int iovcnt, uint16_t val_size);
+void overflow_read(int64_t table_id, pagenum_t page_num, char* dest, uint16_t val_size);
+void overflow_free(int64_t table_id, pagenum_t page_num);
+void copy_value(int64_t table_id, page_t* leaf, uint32_t i, char* dest);
+
+// Scatter/gather
+int iov_total(const struct iovec* iov, int iovcnt, uint16_t* total);
+void iov_gather(const struct iovec* iov, int iovcnt, char* dest);
+void iov_copy_range(const struct iovec* iov, int iovcnt, uint32_t begin, uint32_t len, char* dest);
 
 // Delete
-int get_my_index(int64_t table_id, pagenum_t pagenum, page_t* page);
-void compact_value(int64_t table_id, page_t* leaf, int32_t leaf_idx);
+void compact_value(page_t* leaf);
 void delete_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num, page_t* leaf, int32_t leaf_idx, int64_t key);
 void delete_internal(int64_t table_id, uint32_t index, pagenum_t page_num, page_t* page, int32_t page_idx, int64_t key);
-int adjust_root(int64_t table_id, pagenum_t root_num, page_t* root, int32_t root_idx, int64_t key);
-int coalesce_leaf(int64_t table_id, int my_index, pagenum_t parent_num, page_t* parent, int32_t parent_idx, pagenum_t sibling_num, page_t* sibling, int32_t sibling_idx, pagenum_t leaf_num, page_t* leaf, int32_t leaf_idx);
-int redistribute_leaf(int64_t table_id, pagenum_t parent_num, page_t* parent, int32_t parent_idx, pagenum_t sibling_num, page_t* sibling, int32_t sibling_idx, pagenum_t leaf_num, page_t* leaf, int32_t leaf_idx, int my_index);
-int coalesce_internal(int64_t table_id, int my_index, pagenum_t parent_num, page_t* parent, int32_t parent_idx, pagenum_t sibling_num, page_t* sibling, int32_t sibling_idx, pagenum_t page_num, page_t* page, int32_t page_idx);
-int redistribute_internal(int64_t table_id, pagenum_t parent_num, page_t* parent, int32_t parent_idx, pagenum_t sibling_num, page_t* sibling, int32_t sibling_idx, pagenum_t page_num, page_t* page, int32_t page_idx, int my_index);
-int delete_entry(int64_t table_id, pagenum_t page_num, page_t* page, int32_t page_idx, int64_t key);
+int adjust_root(tree_path_t* path, int level, int64_t key);
+void coalesce_leaf(int64_t table_id, page_t* sibling, pagenum_t leaf_num, page_t* leaf, int32_t leaf_idx);
+void redistribute_leaf(int64_t table_id, page_t* parent, page_t* sibling, int32_t sibling_idx, page_t* leaf, int my_index);
+void coalesce_internal(int64_t table_id, int my_index, page_t* parent, page_t* sibling, pagenum_t page_num, page_t* page, int32_t page_idx);
+void redistribute_internal(page_t* parent, page_t* sibling, page_t* page, int my_index);
+int delete_entry(tree_path_t* path, int level, int64_t key);
+int delete_record(int64_t table_id, int64_t key);
+int merge_leaf(tree_path_t* path, int level, int64_t key, bool deferred);
+
+// Merge thread
+void start_merge_worker();
+void merge_enqueue(int64_t table_id, pagenum_t leaf_num, int64_t key);
+void* merge_worker(void* arg);
+int merge_at(int64_t table_id, int64_t key);
+void purge_enqueue(int64_t table_id, int64_t key);
+int purge_at(int64_t table_id, int64_t key);
+void stop_merge_worker();
+
 
+// Bulk load
+void bulk_open_node(bulk_loader_t* loader, uint32_t level);
+void bulk_close_node(bulk_loader_t* loader, uint32_t level, bool last);
+void bulk_set_high_key(bulk_loader_t* loader, uint32_t level, int64_t key);
+void bulk_push(bulk_loader_t* loader, uint32_t level, int64_t key, pagenum_t child, uint64_t count);
+void bulk_add_record(bulk_loader_t* loader, int64_t key, char* value, uint16_t val_size);
+pagenum_t bulk_overflow(bulk_loader_t* loader, char* value, uint16_t val_size);
+pagenum_t bulk_finish(bulk_loader_t* loader);
+void bulk_free_levels(bulk_loader_t* loader);
+void bulk_abort(bulk_loader_t* loader);
+void bulk_fix_right_spine(int64_t table_id, pagenum_t root_num);
 
 #endif
\ No newline at end of file
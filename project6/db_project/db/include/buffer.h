@@ -19,6 +19,8 @@ typedef struct frame_t {
   int8_t is_dirty;
   int8_t is_buf;
   bool state;
+  uint8_t referenced;
+  uint64_t version;
 } frame_t;
 
 typedef struct buffer_pool_t {
@@ -30,7 +32,10 @@ typedef struct buffer_pool_t {
 } buffer_pool_t;
 
 void buffer_flush();
+void buffer_flush_table(int64_t table_id);
 page_t* buffer_read_page_without_latch(int page_idx);
+void frame_write_begin(int idx);
+void frame_write_end(int idx);
 int buf_hashFunction(int64_t table_id, pagenum_t pagenum);
 int find_empty_frame(int64_t table_id, pagenum_t pagenum);
 int hit_idx(int64_t table_id, pagenum_t pagenum);
@@ -39,12 +44,18 @@ void append_LRU(int idx);
 void delete_LRU(int idx);
 void delete_append_LRU(int idx);
 int give_idx();
+int take_frame(int64_t table_id, pagenum_t pagenum);
 int init_buffer(int num_buf);
 int64_t file_open_via_buffer(char* pathname);
 pagenum_t buffer_alloc_page(int64_t table_id);
 void buffer_free_page(int64_t table_id, pagenum_t pagenum, int32_t idx);
+page_t* read_frame(int64_t table_id, pagenum_t pagenum, int* idx, bool mode, bool nowait);
 page_t* buffer_read_page(int64_t table_id, pagenum_t pagenum, int* idx, bool mode);
+page_t* buffer_try_read_page(int64_t table_id, pagenum_t pagenum, int* idx);
 void buffer_write_page(int64_t table_id, pagenum_t pagenum, int32_t idx, bool success);
+page_t* buffer_optimistic_read(int64_t table_id, pagenum_t pagenum, int* idx, uint64_t* version);
+uint64_t buffer_version(int32_t idx);
+bool buffer_validate(int32_t idx, uint64_t version);
 int shutdown_buffer();
 
 
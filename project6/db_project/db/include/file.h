@@ -29,11 +29,45 @@ typedef struct __attribute__((__packed__)) slot_t {
   int trx_id;
 } slot_t;
 
+// Slot of a slotted leaf that stores 32-bit keys, see NODE_KEY32.
+typedef struct __attribute__((__packed__)) slot32_t {
+  int32_t key;
+  uint16_t size;
+  uint16_t offset;
+  int trx_id;
+} slot32_t;
+
 typedef struct __attribute__((__packed__)) branch_t {
   int64_t key;
   pagenum_t pagenum;
 } branch_t;
 
+#define COUNTED_ORDER 199
+
+// Layout of internal nodes, recorded in the header page. Files from before
+// the field read 0 and keep key and child number side by side.
+#define PAGE_FORMAT_PAIRS 0
+#define PAGE_FORMAT_SPLIT_KEYS 1
+
+// Kind of keys a table accepts, recorded in the header page. KEY_BYTES
+// tables take byte strings of the header's key_len bytes.
+#define KEY_INT64 0
+#define KEY_INT32 1
+#define KEY_BYTES 2
+
+// When deletes merge underfull leaves, recorded in the header page.
+#define MERGE_EAGER 0
+#define MERGE_AT_EMPTY 1
+#define MERGE_BACKGROUND 2
+
+// Internal node of a counted table: fewer branches, followed by the number
+// of records under each child, count[0] for leftmost and count[i + 1] for
+// branch[i].
+typedef struct __attribute__((__packed__)) countbody_t {
+  branch_t branch[COUNTED_ORDER - 1];
+  uint32_t count[COUNTED_ORDER];
+} countbody_t;
+
 typedef struct __attribute__((__packed__)) leafbody_t {
   union {
     slot_t slot[64];
@@ -43,7 +77,7 @@ typedef struct __attribute__((__packed__)) leafbody_t {
 
 typedef struct __attribute__((__packed__)) page_t {
   union {
-    pagenum_t parent_num;
+    pagenum_t parent_num;  // no longer maintained by the tree
     pagenum_t nextfree_num;
   };
   union {
@@ -52,7 +86,33 @@ typedef struct __attribute__((__packed__)) page_t {
   };
   pagenum_t root_num;
   uint64_t LSN;
-  char Reserved[80];
+  // B-link fields: every key of the node is below high_key unless the node
+  // is the last of its level (bounded == 0). right_num links internal nodes
+  // to their right neighbour, leaves use Rsibling. Hash buckets hold the
+  // keys whose hash ends in the local_depth bits hash_bits instead.
+  union {
+    int64_t high_key;
+    int64_t hash_bits;
+  };
+  pagenum_t right_num;
+  union {
+    uint32_t bounded;
+    uint32_t local_depth;
+  };
+  uint32_t flags;  // table mode on the header page, node kind otherwise
+  // Width of every value in a fixed-width leaf, 0 for slotted leaves. The
+  // header page keeps the width new leaves of the table get.
+  uint16_t value_size;
+  uint16_t format;    // header page only, PAGE_FORMAT_*
+  uint16_t key_type;  // header page only, KEY_*
+  // Slotted leaves: free bytes left between values by deletes, counted in
+  // freespace but not part of the gap below the lowest value.
+  uint16_t frag;
+  uint16_t merge_policy;  // header page only, MERGE_*
+  uint64_t bloom_keys;    // header page only, Bloom filter size, 0 for none
+  uint16_t hash_depth;    // header page only, hash directory depth
+  uint16_t key_len;       // header page only, length of KEY_BYTES keys
+  char Reserved[34];
   uint64_t freespace;
   union {
     uint64_t Rsibling;
@@ -61,6 +121,7 @@ typedef struct __attribute__((__packed__)) page_t {
   union {
     leafbody_t leafbody;
     branch_t branch[248];
+    countbody_t counted;
   };
 } page_t;
 
@@ -70,6 +131,9 @@ pagenum_t file_alloc_page(int64_t table_id);
 void file_free_page(int64_t table_id, pagenum_t pagenum);
 void file_read_page(int64_t table_id, pagenum_t pagenum, page_t* dest);
 void file_write_page(int64_t table_id, pagenum_t pagenum, const page_t* src);
+pagenum_t file_extend_pages(int64_t table_id, uint64_t n);
+void file_write_pages(int64_t table_id, pagenum_t pagenum, const page_t* src, uint64_t n);
+void file_free_pages(int64_t table_id, pagenum_t pagenum, uint64_t n);
 void file_close_table_files();
 int isValid_table_id(int64_t table_id);
 
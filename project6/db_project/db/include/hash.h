@@ -0,0 +1,40 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "bpt.h"
+
+#define HASH_FANOUT (sizeof(leafbody_t) / sizeof(pagenum_t))
+#define HASH_MAX_DEPTH 17
+
+// Buckets of an extendible hash table are laid out like leaves, slotted or
+// fixed-width, so the record, lock and log code runs on them unchanged.
+// They never merge. The header's root_num is the directory root, whose body
+// lists the directory pages in order; those hold the 2^hash_depth bucket
+// numbers, HASH_FANOUT to a page, indexed by the low bits of the hash. A
+// copy of the directory is kept in memory, so a lookup only reads the
+// bucket.
+typedef struct hash_t {
+  pthread_rwlock_t dir_latch;
+  uint32_t depth;
+  std::vector<pagenum_t> dir;
+  std::vector<pagenum_t> dir_pages;
+} hash_t;
+
+uint64_t hash_key(int64_t key);
+pagenum_t* hash_entries(page_t* page);
+void hash_init_bucket(page_t* bucket, tree_t* tree, uint32_t local_depth, int64_t hash_bits);
+
+// Directory
+int hash_create(int64_t table_id, tree_t* tree);
+hash_t* hash_load(int64_t table_id);
+void hash_store_entry(int64_t table_id, hash_t* hash, uint64_t index, pagenum_t bucket_num);
+int hash_grow(int64_t table_id, hash_t* hash);
+
+// Records
+pagenum_t hash_find_bucket(int64_t table_id, int64_t key, page_t** bucket, int32_t* bucket_idx);
+int hash_insert(int64_t table_id, tree_t* tree, int64_t key, const struct iovec* iov, int iovcnt, uint16_t val_size);
+int hash_split(int64_t table_id, tree_t* tree, int64_t key, uint16_t val_size);
+int hash_delete(int64_t table_id, int64_t key);
+int hash_find_batch(int64_t table_id, int64_t* keys, int n, char** ret_vals, uint16_t* val_sizes, int* results, int trx_id);
+
+#endif
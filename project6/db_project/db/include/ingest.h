@@ -0,0 +1,81 @@
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include "bpt.h"
+
+#define INGEST_BINARY 0
+#define INGEST_CSV 1
+
+// Binary input is a stream of [int64_t key][uint16_t size][size bytes].
+// CSV input has one "key,value" record per line; the value is stored
+// without the line terminator. Duplicate keys keep their first occurrence.
+typedef struct ingest_opt_t {
+  int format;
+  int num_threads;
+  uint64_t mem_limit;
+  int fill_percent;
+  const char* tmp_dir;
+} ingest_opt_t;
+
+typedef struct ingest_stats_t {
+  uint64_t records;
+  uint64_t bytes;
+  uint64_t duplicates;
+  uint64_t runs;
+  double read_sec;
+  double sort_sec;
+  double merge_sec;
+  double build_sec;
+} ingest_stats_t;
+
+typedef struct ingest_rec_t {
+  int64_t key;
+  uint64_t offset;
+  uint16_t size;
+} ingest_rec_t;
+
+typedef struct ingest_run_t {
+  std::vector<ingest_rec_t> recs;
+  char* data;
+  uint64_t used;
+  uint64_t capacity;
+  char path[256];
+  bool spill;
+  bool failed;
+} ingest_run_t;
+
+typedef struct merge_source_t {
+  ingest_run_t* run;
+  FILE* fp;
+  uint64_t pos;
+  int64_t key;
+  uint16_t size;
+  char* value;
+} merge_source_t;
+
+typedef std::pair<int64_t, int> merge_item_t;
+typedef std::priority_queue<merge_item_t, std::vector<merge_item_t>,
+                            std::greater<merge_item_t>>
+    merge_heap_t;
+
+typedef struct merge_state_t {
+  std::vector<merge_source_t*> sources;
+  merge_heap_t heap;
+  int64_t last_key;
+  bool emitted;
+  ingest_stats_t* stats;
+} merge_state_t;
+
+// API
+int db_ingest(int64_t table_id, const char* path, ingest_opt_t* opt, ingest_stats_t* stats);
+
+// Run generation
+double ingest_now();
+int ingest_read_record(FILE* fp, int format, int64_t* key, char* value, uint16_t* val_size);
+void* ingest_sort_run(void* arg);
+
+// Merge
+int merge_advance(merge_source_t* source);
+int merge_next(void* arg, int64_t* key, char* value, uint16_t* val_size);
+
+#endif
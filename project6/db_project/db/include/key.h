@@ -0,0 +1,123 @@
+#ifndef __KEY_H__
+#define __KEY_H__
+
+#include <stdint.h>
+#include <string.h>
+
+// Internal node or leaf that stores its keys in 32 bits.
+#define NODE_KEY32 4
+
+// Keys always travel as int64_t; K is how a key array stores them. Searches
+// are instantiated per stored type so the comparison is a plain load and
+// compare of the right width.
+template <typename K>
+struct key_trait {
+  static int64_t load(const char* p) { return *(const K*)p; }
+  static void store(char* p, int64_t key) { *(K*)p = (K)key; }
+};
+
+// First of the n keys, stride bytes apart, that is not below key.
+template <typename K>
+uint32_t key_lower_bound(const char* keys, uint32_t stride, uint32_t n,
+                         int64_t key) {
+  uint32_t lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (key_trait<K>::load(keys + stride * mid) < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// First of the n keys that is above key.
+template <typename K>
+uint32_t key_upper_bound(const char* keys, uint32_t stride, uint32_t n,
+                         int64_t key) {
+  uint32_t lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (key_trait<K>::load(keys + stride * mid) <= key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+#define KEY_BYTES_MAX 8
+
+// Byte strings of up to KEY_BYTES_MAX bytes packed so that comparing the
+// keys as int64_t orders them like memcmp over the zero padded strings.
+// Shorter strings sort before their extensions only when they do not end in
+// zero bytes. Longer strings are refused rather than cut, returning 1.
+inline int key_from_bytes(const char* bytes, int len, int64_t* key) {
+  uint64_t packed = 0;
+
+  if (len < 0 || len > KEY_BYTES_MAX) return 1;
+  for (int i = 0; i < KEY_BYTES_MAX; i++)
+    packed = (packed << 8) | (i < len ? (uint8_t)bytes[i] : 0);
+  *key = (int64_t)(packed ^ (1ULL << 63));
+  return 0;
+}
+
+inline void key_to_bytes(int64_t key, char* bytes) {
+  uint64_t packed = (uint64_t)key ^ (1ULL << 63);
+
+  for (int i = KEY_BYTES_MAX - 1; i >= 0; i--, packed >>= 8)
+    bytes[i] = (char)(packed & 0xff);
+}
+
+// Internal node or leaf whose keys are byte strings of len bytes, kept in
+// bits 8 to 11 of its flags.
+#define NODE_KEY_BYTES(len) ((uint32_t)(len) << 8)
+
+inline uint32_t key_bytes_len(uint32_t flags) { return (flags >> 8) & 0xf; }
+
+// Byte-string keys are stored as the len bytes themselves, so searches
+// compare them with memcmp, and travel as the int64_t key_from_bytes packs
+// them into, which sorts the same way.
+struct key_bytes;
+
+template <>
+struct key_trait<key_bytes> {
+  static int64_t load(const char* p, uint32_t len) {
+    int64_t key;
+
+    key_from_bytes(p, len, &key);
+    return key;
+  }
+  static void store(char* p, int64_t key, uint32_t len) {
+    char bytes[KEY_BYTES_MAX];
+
+    key_to_bytes(key, bytes);
+    memcpy(p, bytes, len);
+  }
+};
+
+// First of the n keys of len bytes that is not below key, or above it with
+// upper. A key that is not len bytes long, like the key + 1 a scan resumes
+// from, sorts after the stored key it shares the first len bytes with.
+inline uint32_t key_bytes_bound(const char* keys, uint32_t stride, uint32_t n,
+                                uint32_t len, int64_t key, bool upper) {
+  char probe[KEY_BYTES_MAX];
+  uint32_t lo = 0, hi = n, mid;
+  int past = upper;
+
+  key_to_bytes(key, probe);
+  for (uint32_t i = len; i < KEY_BYTES_MAX; i++)
+    if (probe[i]) past = 1;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (memcmp(keys + stride * mid, probe, len) < past)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef __LEAF_H__
+#define __LEAF_H__
+
+#include <stddef.h>
+
+#include "file.h"
+#include "key.h"
+
+// Values of slotted leaves above OVERFLOW_THRESHOLD bytes live in a chain
+// of overflow pages linked through Rsibling, each holding up to
+// OVERFLOW_CHUNK bytes. Their slot keeps the size of the whole value and the
+// leaf only an overflow_ref_t, so value_bytes is what a value takes in the
+// leaf.
+#define OVERFLOW_THRESHOLD 512
+#define OVERFLOW_CHUNK sizeof(leafbody_t)
+
+// Free bytes of an empty leaf, and the largest value a leaf holds in place
+// next to its slot, which takes at most 16 bytes.
+#define INITIAL_FREE 3968
+#define MAX_LEAF_VALUE (INITIAL_FREE - 16)
+
+typedef struct __attribute__((__packed__)) overflow_ref_t {
+  pagenum_t first;
+} overflow_ref_t;
+
+inline bool is_overflow(uint16_t val_size) {
+  return val_size > OVERFLOW_THRESHOLD;
+}
+
+inline uint16_t value_bytes(uint16_t val_size) {
+  return is_overflow(val_size) ? sizeof(overflow_ref_t) : val_size;
+}
+
+// trx_id of a record deleted in tombstone mode and not purged yet. Readers
+// skip it, and inserts of the same key take its place.
+#define TOMBSTONE_TRX -1
+
+// Leaf record layouts, told apart by the page's value_size. slotted_leaf is
+// the slot directory with values packed from the end of the page.
+// fixed_leaf is for tables whose values all take value_size bytes: dense
+// arrays of keys, trx ids and values, so there are no offsets to keep and
+// nothing to compact.
+//
+// With NODE_KEY32 the slot directory holds 12-byte slot32_t slots instead
+// of slot_t. Code that walks the directory is instantiated for each slot
+// type S and picks one per leaf with SLOT_CALL.
+template <typename S>
+inline S* leaf_slots(page_t* leaf) {
+  return (S*)leaf->leafbody.value;
+}
+
+#define SLOT_CALL(leaf, fn, ...)                           \
+  (((leaf)->flags & NODE_KEY32) ? fn<slot32_t>(__VA_ARGS__) \
+                                : fn<slot_t>(__VA_ARGS__))
+
+struct slotted_leaf {
+  static uint32_t slot_size(page_t* leaf) {
+    return (leaf->flags & NODE_KEY32) ? sizeof(slot32_t) : sizeof(slot_t);
+  }
+  static uint32_t cost(page_t* leaf, uint16_t val_size) {
+    return slot_size(leaf) + value_bytes(val_size);
+  }
+  static int64_t key(page_t* leaf, uint32_t i) {
+    if (leaf->flags & NODE_KEY32) return leaf_slots<slot32_t>(leaf)[i].key;
+    return leaf_slots<slot_t>(leaf)[i].key;
+  }
+  static uint16_t size(page_t* leaf, uint32_t i) {
+    if (leaf->flags & NODE_KEY32) return leaf_slots<slot32_t>(leaf)[i].size;
+    return leaf_slots<slot_t>(leaf)[i].size;
+  }
+  static void set_size(page_t* leaf, uint32_t i, uint16_t size) {
+    if (leaf->flags & NODE_KEY32)
+      leaf_slots<slot32_t>(leaf)[i].size = size;
+    else
+      leaf_slots<slot_t>(leaf)[i].size = size;
+  }
+  static uint16_t offset(page_t* leaf, uint32_t i) {
+    if (leaf->flags & NODE_KEY32) return leaf_slots<slot32_t>(leaf)[i].offset;
+    return leaf_slots<slot_t>(leaf)[i].offset;
+  }
+  static char* value(page_t* leaf, uint32_t i) {
+    return leaf->leafbody.value + offset(leaf, i) - 128;
+  }
+  static int trx_id(page_t* leaf, uint32_t i) {
+    if (leaf->flags & NODE_KEY32) return leaf_slots<slot32_t>(leaf)[i].trx_id;
+    return leaf_slots<slot_t>(leaf)[i].trx_id;
+  }
+  static void set_trx_id(page_t* leaf, uint32_t i, int trx_id) {
+    if (leaf->flags & NODE_KEY32)
+      leaf_slots<slot32_t>(leaf)[i].trx_id = trx_id;
+    else
+      leaf_slots<slot_t>(leaf)[i].trx_id = trx_id;
+  }
+};
+
+// Keys take key_width bytes, 4 with NODE_KEY32 and the string length with
+// NODE_KEY_BYTES.
+struct fixed_leaf {
+  static uint32_t key_width(page_t* leaf) {
+    if (key_bytes_len(leaf->flags)) return key_bytes_len(leaf->flags);
+    return (leaf->flags & NODE_KEY32) ? sizeof(int32_t) : sizeof(int64_t);
+  }
+  static uint32_t cost(page_t* leaf, uint16_t) {
+    return key_width(leaf) + sizeof(int32_t) + leaf->value_size;
+  }
+  static uint32_t capacity(page_t* leaf) {
+    return sizeof(leafbody_t) / cost(leaf, 0);
+  }
+  static char* keys(page_t* leaf) {
+    return (char*)leaf + offsetof(page_t, leafbody.value);
+  }
+  static int32_t* trx_ids(page_t* leaf) {
+    return (int32_t*)(keys(leaf) + key_width(leaf) * capacity(leaf));
+  }
+  static char* values(page_t* leaf) {
+    return keys(leaf) + (key_width(leaf) + sizeof(int32_t)) * capacity(leaf);
+  }
+  static int64_t key(page_t* leaf, uint32_t i) {
+    if (key_bytes_len(leaf->flags))
+      return key_trait<key_bytes>::load(keys(leaf) + key_width(leaf) * i,
+                                        key_width(leaf));
+    if (key_width(leaf) == sizeof(int32_t))
+      return key_trait<int32_t>::load(keys(leaf) + sizeof(int32_t) * i);
+    return key_trait<int64_t>::load(keys(leaf) + sizeof(int64_t) * i);
+  }
+  static void set_key(page_t* leaf, uint32_t i, int64_t key) {
+    if (key_bytes_len(leaf->flags))
+      key_trait<key_bytes>::store(keys(leaf) + key_width(leaf) * i, key,
+                                  key_width(leaf));
+    else if (key_width(leaf) == sizeof(int32_t))
+      key_trait<int32_t>::store(keys(leaf) + sizeof(int32_t) * i, key);
+    else
+      key_trait<int64_t>::store(keys(leaf) + sizeof(int64_t) * i, key);
+  }
+  static uint16_t size(page_t* leaf, uint32_t) { return leaf->value_size; }
+  static char* value(page_t* leaf, uint32_t i) {
+    return values(leaf) + (uint32_t)leaf->value_size * i;
+  }
+  static int trx_id(page_t* leaf, uint32_t i) { return trx_ids(leaf)[i]; }
+  static void set_trx_id(page_t* leaf, uint32_t i, int trx_id) {
+    trx_ids(leaf)[i] = trx_id;
+  }
+};
+
+// Callers that touch a single record pick the layout per call; loops over
+// many records are instantiated for each layout instead.
+#define LEAF_CALL(leaf, fn, ...) \
+  ((leaf)->value_size ? fixed_leaf::fn(leaf, __VA_ARGS__) \
+                      : slotted_leaf::fn(leaf, __VA_ARGS__))
+
+inline int64_t leaf_key(page_t* leaf, uint32_t i) { return LEAF_CALL(leaf, key, i); }
+inline uint16_t leaf_size(page_t* leaf, uint32_t i) { return LEAF_CALL(leaf, size, i); }
+inline char* leaf_value(page_t* leaf, uint32_t i) { return LEAF_CALL(leaf, value, i); }
+inline int leaf_trx_id(page_t* leaf, uint32_t i) { return LEAF_CALL(leaf, trx_id, i); }
+inline void leaf_set_trx_id(page_t* leaf, uint32_t i, int trx_id) {
+  LEAF_CALL(leaf, set_trx_id, i, trx_id);
+}
+inline uint32_t leaf_cost(page_t* leaf, uint16_t val_size) {
+  return LEAF_CALL(leaf, cost, val_size);
+}
+inline bool leaf_is_tombstone(page_t* leaf, uint32_t i) {
+  return leaf_trx_id(leaf, i) == TOMBSTONE_TRX;
+}
+
+// First position whose key is not below key.
+inline uint32_t leaf_lower_bound(page_t* leaf, int64_t key) {
+  if (!leaf->value_size && (leaf->flags & NODE_KEY32))
+    return key_lower_bound<int32_t>((char*)leaf_slots<slot32_t>(leaf),
+                                    sizeof(slot32_t), leaf->info.num_keys, key);
+  if (!leaf->value_size)
+    return key_lower_bound<int64_t>((char*)leaf_slots<slot_t>(leaf),
+                                    sizeof(slot_t), leaf->info.num_keys, key);
+  if (key_bytes_len(leaf->flags))
+    return key_bytes_bound(fixed_leaf::keys(leaf), fixed_leaf::key_width(leaf),
+                           leaf->info.num_keys, fixed_leaf::key_width(leaf),
+                           key, false);
+  if (fixed_leaf::key_width(leaf) == sizeof(int32_t))
+    return key_lower_bound<int32_t>(fixed_leaf::keys(leaf), sizeof(int32_t),
+                                    leaf->info.num_keys, key);
+  return key_lower_bound<int64_t>(fixed_leaf::keys(leaf), sizeof(int64_t),
+                                  leaf->info.num_keys, key);
+}
+
+// Position of key in the leaf, num_keys when it is not there.
+inline uint32_t leaf_search(page_t* leaf, int64_t key) {
+  uint32_t i = leaf_lower_bound(leaf, key);
+
+  if (i < leaf->info.num_keys && leaf_key(leaf, i) != key)
+    return leaf->info.num_keys;
+  return i;
+}
+
+// Like leaf_search, but a tombstone counts as missing.
+inline uint32_t leaf_find(page_t* leaf, int64_t key) {
+  uint32_t i = leaf_search(leaf, key);
+
+  if (i < leaf->info.num_keys && leaf_is_tombstone(leaf, i))
+    return leaf->info.num_keys;
+  return i;
+}
+
+#endif
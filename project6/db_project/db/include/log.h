@@ -3,6 +3,7 @@
 
 #include "file.h"
 #include "buffer.h"
+#include <sys/uio.h>
 
 #define RECOVERY 0
 #define REDO_CRASH 1
@@ -59,6 +60,7 @@ typedef std::priority_queue<LSN_t> priority_table_t;
 void file_read_mainlog(main_log_t* main_log, LSN_t LSN);
 void push_log_to_buffer(main_log_t* main_log, update_log_t* update_log,
                         char* old_img, char* new_img, LSN_t next_undo_LSN);
+void push_update_log_v(main_log_t* main_log, update_log_t* update_log, const char* old_img, const struct iovec* iov, int iovcnt);
 main_log_t* make_main_log(int trx_id, int type, int log_size, LSN_t prev_LSN);
 update_log_t* make_update_log(int64_t table_id, pagenum_t page_id,
                               uint16_t valsize, uint16_t offset);
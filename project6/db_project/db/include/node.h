@@ -0,0 +1,114 @@
+#ifndef __NODE_H__
+#define __NODE_H__
+
+#include <stddef.h>
+#include <string.h>
+
+#include "file.h"
+#include "key.h"
+
+#define NODE_COUNTED 1
+#define NODE_SPLIT_KEYS 2
+
+// Largest fanout of any layout, a split-keys node with 1-byte keys.
+#define NODE_MAX_ORDER \
+  (sizeof(((page_t*)0)->branch) / (1 + sizeof(pagenum_t)) + 1)
+
+// Internal node layouts, told apart by the node's flags. Pair nodes keep
+// branch_t entries, key and child number side by side. NODE_SPLIT_KEYS
+// nodes keep every key in one array ahead of the child numbers, so a search
+// reads only keys, and with NODE_KEY32 those keys take 4 bytes, with
+// NODE_KEY_BYTES the length of the table's byte strings. Counted nodes of
+// any layout end with the same count array.
+inline uint32_t layout_key_width(uint32_t flags) {
+  if (!(flags & NODE_SPLIT_KEYS)) return sizeof(int64_t);
+  if (key_bytes_len(flags)) return key_bytes_len(flags);
+  return (flags & NODE_KEY32) ? sizeof(int32_t) : sizeof(int64_t);
+}
+
+inline uint32_t layout_capacity(uint32_t flags) {
+  if (flags & NODE_COUNTED) return COUNTED_ORDER - 1;
+  if (flags & NODE_SPLIT_KEYS)
+    return sizeof(((page_t*)0)->branch) /
+           (layout_key_width(flags) + sizeof(pagenum_t));
+  return sizeof(((page_t*)0)->branch) / sizeof(branch_t);
+}
+
+inline uint32_t node_key_width(page_t* page) {
+  return layout_key_width(page->flags);
+}
+
+inline uint32_t node_capacity(page_t* page) {
+  return layout_capacity(page->flags);
+}
+
+inline char* node_body(page_t* page) {
+  return (char*)page + offsetof(page_t, branch);
+}
+
+inline uint32_t node_key_stride(page_t* page) {
+  return (page->flags & NODE_SPLIT_KEYS) ? node_key_width(page)
+                                         : sizeof(branch_t);
+}
+
+inline int64_t node_key(page_t* page, uint32_t i) {
+  char* p = node_body(page) + node_key_stride(page) * i;
+
+  if (key_bytes_len(page->flags))
+    return key_trait<key_bytes>::load(p, key_bytes_len(page->flags));
+  if (node_key_width(page) == sizeof(int32_t))
+    return key_trait<int32_t>::load(p);
+  return key_trait<int64_t>::load(p);
+}
+
+inline void node_set_key(page_t* page, uint32_t i, int64_t key) {
+  char* p = node_body(page) + node_key_stride(page) * i;
+
+  if (key_bytes_len(page->flags))
+    key_trait<key_bytes>::store(p, key, key_bytes_len(page->flags));
+  else if (node_key_width(page) == sizeof(int32_t))
+    key_trait<int32_t>::store(p, key);
+  else
+    key_trait<int64_t>::store(p, key);
+}
+
+inline pagenum_t& node_child(page_t* page, uint32_t i) {
+  if (page->flags & NODE_SPLIT_KEYS)
+    return ((pagenum_t*)(node_body(page) +
+                         node_key_width(page) * node_capacity(page)))[i];
+  return *(pagenum_t*)(node_body(page) + sizeof(branch_t) * i +
+                       offsetof(branch_t, pagenum));
+}
+
+// First key above key, which is one past the branch to follow. An
+// optimistic reader passes the num_keys it checked.
+inline uint32_t node_upper_bound(page_t* page, int64_t key, uint32_t num_keys) {
+  if (key_bytes_len(page->flags))
+    return key_bytes_bound(node_body(page), node_key_width(page), num_keys,
+                           node_key_width(page), key, true);
+  if (node_key_width(page) == sizeof(int32_t))
+    return key_upper_bound<int32_t>(node_body(page), sizeof(int32_t), num_keys,
+                                    key);
+  return key_upper_bound<int64_t>(node_body(page), node_key_stride(page),
+                                  num_keys, key);
+}
+
+inline uint32_t node_upper_bound(page_t* page, int64_t key) {
+  return node_upper_bound(page, key, page->info.num_keys);
+}
+
+// Moves n entries; src and dest may be the same node but must share a
+// layout.
+inline void node_move(page_t* dest, uint32_t dest_at, page_t* src,
+                      uint32_t src_at, uint32_t n) {
+  uint32_t stride = node_key_stride(src);
+
+  if (!n) return;
+  memmove(node_body(dest) + stride * dest_at, node_body(src) + stride * src_at,
+          stride * n);
+  if (src->flags & NODE_SPLIT_KEYS)
+    memmove(&node_child(dest, dest_at), &node_child(src, src_at),
+            sizeof(pagenum_t) * n);
+}
+
+#endif
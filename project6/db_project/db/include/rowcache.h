@@ -0,0 +1,68 @@
+#ifndef __ROWCACHE_H__
+#define __ROWCACHE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#define ROWCACHE_SHARDS 16
+// Larger values are read from the leaf every time.
+#define ROWCACHE_MAX_VALUE 256
+// Charged per entry on top of its value for the list and map nodes.
+#define ROWCACHE_ENTRY_COST 96UL
+
+typedef struct rowcache_entry_t {
+  int64_t table_id;
+  int64_t key;
+  std::string value;
+} rowcache_entry_t;
+
+struct rowcache_key_hash {
+  size_t operator()(const std::pair<int64_t, int64_t>& k) const {
+    return std::hash<int64_t>()(k.first * 0x9e3779b97f4a7c15ULL ^ k.second);
+  }
+};
+
+// One LRU list per shard, most recent first. epoch moves with every
+// invalidation, a value read from a leaf is only put in if the epoch it
+// started with is still current.
+typedef struct rowcache_shard_t {
+  pthread_mutex_t mutex;
+  uint64_t epoch;
+  uint64_t bytes;
+  std::list<rowcache_entry_t> lru;
+  std::unordered_map<std::pair<int64_t, int64_t>,
+                     std::list<rowcache_entry_t>::iterator, rowcache_key_hash>
+      map;
+} rowcache_shard_t;
+
+typedef struct rowcache_stats_t {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t invalidations;
+  uint64_t entries;
+  uint64_t bytes;
+} rowcache_stats_t;
+
+typedef struct rowcache_t {
+  uint64_t shard_capacity;
+  rowcache_shard_t shards[ROWCACHE_SHARDS];
+  rowcache_stats_t stats;  // entries and bytes are summed on request
+} rowcache_t;
+
+// Null while no cache was asked for.
+extern rowcache_t* row_cache;
+
+void rowcache_resize(uint64_t capacity);
+void rowcache_destroy();
+bool rowcache_get(int64_t table_id, int64_t key, char* value, uint16_t* val_size);
+uint64_t rowcache_epoch(int64_t table_id, int64_t key);
+void rowcache_put(int64_t table_id, int64_t key, char* value, uint16_t val_size, uint64_t epoch);
+void rowcache_invalidate(int64_t table_id, int64_t key);
+void rowcache_get_stats(rowcache_stats_t* stats);
+
+#endif
@@ -2,13 +2,18 @@
 #define __TRX_H__
 
 #include <buffer.h>
+#include <leaf.h>
 
 #define SHARED 0
 #define EXCLUSIVE 1
 
 #define DEAD_LOCK -1
 
-#define MASK(X) (1UL << (63 - (X)))
+// Records are locked by their index in the leaf. A lock holds one 64-bit
+// word of the leaf's bitmap, WORD(X) says which, so leaves of any capacity
+// give every record a bit of its own.
+#define WORD(X) ((uint32_t)(X) >> 6)
+#define MASK(X) (1UL << (63 - ((X) & 63)))
 #define WAIT(X, Y) (pthread_cond_wait(&(X), &(Y)))
 #define BROADCAST(X) (pthread_cond_broadcast(&(X)))
 
@@ -27,6 +32,7 @@ typedef struct lock_t {
   lock_t* lock_next;
   lock_t* trx_next;
   entry_t* sent_point;
+  uint32_t word;
   uint64_t bitmap;
   int64_t key;
   int owner_trx_id;
@@ -63,7 +69,8 @@ typedef std::unordered_map<int, trx_t*> trx_table_t;
 
 int init_db(int buf_num, int flag, int log_num, char* log_path, char* logmsg_path);
 int shutdown_trx();
-lock_t* give_lock(int64_t key, uint64_t bitmap, int trx_id, bool lock_mode);
+lock_t* give_lock(int64_t key, uint32_t word, uint64_t bitmap, int trx_id, bool lock_mode);
+bool lock_overlaps(lock_t* lock, uint32_t word, uint64_t bitmap);
 entry_t* give_entry(int64_t table_id, pagenum_t page_id);
 int trx_begin(void);
 trx_t* give_trx(int trx_id);
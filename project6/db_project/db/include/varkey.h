@@ -0,0 +1,77 @@
+#ifndef __VARKEY_H__
+#define __VARKEY_H__
+
+#include <string>
+
+#include "bpt.h"
+
+#define VAR_MAX_KEY 512
+#define VAR_MAX_VALUE 1024
+
+// Nodes of a variable-length key table store, in the page body, the length
+// of the prefix every key of the node shares, the prefix itself, one slot
+// per key and, packed against the end of the page, the rest of each key
+// followed by its value. Internal nodes use an 8-byte child number as the
+// value and keep their first child in leftmost. Separators only carry the
+// bytes needed to tell the two sides of a split apart.
+typedef struct __attribute__((__packed__)) varslot_t {
+  uint16_t offset;
+  uint16_t key_len;
+  uint16_t val_size;
+} varslot_t;
+
+typedef struct var_entry_t {
+  std::string key;
+  std::string value;
+} var_entry_t;
+
+// Internal node on the way down and the child taken from it, -1 for
+// leftmost.
+typedef struct var_step_t {
+  pagenum_t page_num;
+  int index;
+} var_step_t;
+
+typedef int (*var_scan_callback_t)(const char* key, uint16_t key_len,
+                                   char* value, uint16_t val_size, void* arg);
+
+// API
+// Variable-length key tables have their own entry points and hold one latch
+// per table for each call. They are not covered by transactions or the log.
+int64_t open_var_table(char* pathname);
+int var_insert(int64_t table_id, const char* key, uint16_t key_len, const char* value, uint16_t val_size);
+int var_find(int64_t table_id, const char* key, uint16_t key_len, char* ret_val, uint16_t* val_size);
+int var_delete(int64_t table_id, const char* key, uint16_t key_len);
+// Visits keys from lo up to and including hi, or to the end when hi is null,
+// until callback returns nonzero.
+int var_scan(int64_t table_id, const char* lo, uint16_t lo_len, const char* hi, uint16_t hi_len, var_scan_callback_t callback, void* arg);
+
+// Node format
+char* var_body(page_t* page);
+uint16_t var_prefix_len(page_t* page);
+varslot_t* var_slots(page_t* page);
+int var_compare(const char* a, uint32_t a_len, const char* b, uint32_t b_len);
+uint32_t var_common_prefix(std::vector<var_entry_t>& entries, uint32_t begin, uint32_t end);
+void var_decode(page_t* page, std::vector<var_entry_t>& entries);
+uint32_t var_encoded_size(std::vector<var_entry_t>& entries, uint32_t begin, uint32_t end);
+int var_encode(page_t* page, std::vector<var_entry_t>& entries, uint32_t begin, uint32_t end);
+uint32_t var_lower_bound(page_t* page, const char* key, uint16_t key_len, bool upper);
+pagenum_t var_child(page_t* page, int index);
+
+// Find
+bool var_check(int64_t table_id, uint16_t key_len);
+pagenum_t var_find_leaf(int64_t table_id, const char* key, uint16_t key_len, std::vector<var_step_t>* path);
+void var_set_root(int64_t table_id, pagenum_t root_num);
+
+// Insert
+std::string var_separator(const std::string& left, const std::string& right);
+uint32_t var_split_point(std::vector<var_entry_t>& entries, bool internal);
+int var_insert_into_parent(int64_t table_id, std::vector<var_step_t>& path, int level, pagenum_t left_num, const std::string& key, pagenum_t right_num);
+int var_store_internal(int64_t table_id, std::vector<var_step_t>& path, int level, pagenum_t leftmost, std::vector<var_entry_t>& entries);
+int var_store_leaf(int64_t table_id, std::vector<var_step_t>& path, pagenum_t leaf_num, std::vector<var_entry_t>& entries);
+
+// Delete
+pagenum_t var_prev_leaf(int64_t table_id, std::vector<var_step_t>& path);
+void var_remove_child(int64_t table_id, std::vector<var_step_t>& path, int level);
+
+#endif
@@ -0,0 +1,117 @@
+#include "ahi.h"
+#include "bloom.h"
+#include <string.h>
+
+static ahi_entry_t* ahi_entry(ahi_t* ahi, int64_t key) {
+  return &ahi->entries[bloom_hash(key) & (AHI_ENTRIES - 1)];
+}
+
+ahi_t* ahi_create() {
+  ahi_t* ahi = new ahi_t;
+
+  ahi->entries = new ahi_entry_t[AHI_ENTRIES];
+  memset(ahi->entries, 0x00, sizeof(ahi_entry_t) * AHI_ENTRIES);
+  ahi->enabled = true;
+  ahi->off = false;
+  ahi->probes = ahi->hits = ahi->skipped = 0;
+
+  return ahi;
+}
+
+void ahi_destroy(ahi_t* ahi) {
+  delete[] ahi->entries;
+  delete ahi;
+}
+
+// Counts the finds made without the index and turns it back on for a new
+// window after AHI_RETRY of them.
+bool ahi_active(ahi_t* ahi) {
+  if (!ahi || __atomic_load_n(&ahi->off, __ATOMIC_RELAXED)) return false;
+  if (__atomic_load_n(&ahi->enabled, __ATOMIC_RELAXED)) return true;
+  if (__atomic_add_fetch(&ahi->skipped, 1, __ATOMIC_RELAXED) < AHI_RETRY)
+    return false;
+  __atomic_store_n(&ahi->skipped, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&ahi->probes, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&ahi->hits, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&ahi->enabled, true, __ATOMIC_RELAXED);
+  return true;
+}
+
+// Threads closing a window at the same time may lose a few counts, the
+// rate only has to be roughly right.
+void ahi_record(ahi_t* ahi, bool hit) {
+  uint64_t hits;
+
+  if (hit) __atomic_add_fetch(&ahi->hits, 1, __ATOMIC_RELAXED);
+  if (__atomic_add_fetch(&ahi->probes, 1, __ATOMIC_RELAXED) != AHI_WINDOW)
+    return;
+  hits = __atomic_exchange_n(&ahi->hits, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&ahi->probes, 0, __ATOMIC_RELAXED);
+  if (hits * 100 < (uint64_t)AHI_WINDOW * AHI_MIN_HIT_PCT)
+    __atomic_store_n(&ahi->enabled, false, __ATOMIC_RELAXED);
+}
+
+bool ahi_lookup(ahi_t* ahi, int64_t key, uint64_t* leaf_num, uint32_t* slot) {
+  ahi_entry_t* e = ahi_entry(ahi, key);
+  uint32_t seq;
+  int64_t k;
+
+  seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1) return false;
+  k = __atomic_load_n(&e->key, __ATOMIC_RELAXED);
+  *leaf_num = __atomic_load_n(&e->leaf_num, __ATOMIC_RELAXED);
+  *slot = __atomic_load_n(&e->slot, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq || k != key ||
+      !*leaf_num)
+    return false;
+  if (__atomic_load_n(&e->heat, __ATOMIC_RELAXED) < AHI_MAX_HEAT)
+    __atomic_add_fetch(&e->heat, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// A writer that finds the entry being rewritten by another gives up, the
+// entry is only a hint.
+static bool ahi_write_begin(ahi_entry_t* e, uint32_t* seq) {
+  *seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+  return !(*seq & 1) &&
+         __atomic_compare_exchange_n(&e->seq, seq, *seq + 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void ahi_write_end(ahi_entry_t* e, uint32_t seq) {
+  __atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// Another key holding the entry loses one heat instead of the entry, so
+// keys that are only seen once cannot push out the hot ones.
+void ahi_learn(ahi_t* ahi, int64_t key, uint64_t leaf_num, uint32_t slot) {
+  ahi_entry_t* e = ahi_entry(ahi, key);
+  uint32_t seq, heat;
+
+  if (__atomic_load_n(&e->leaf_num, __ATOMIC_RELAXED) &&
+      __atomic_load_n(&e->key, __ATOMIC_RELAXED) != key &&
+      (heat = __atomic_load_n(&e->heat, __ATOMIC_RELAXED))) {
+    __atomic_store_n(&e->heat, heat - 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (!ahi_write_begin(e, &seq)) return;
+  if (e->key != key) e->heat = 0;
+  e->key = key;
+  e->leaf_num = leaf_num;
+  e->slot = slot;
+  ahi_write_end(e, seq);
+}
+
+void ahi_forget(ahi_t* ahi, int64_t key) {
+  ahi_entry_t* e = ahi_entry(ahi, key);
+  uint32_t seq;
+
+  if (__atomic_load_n(&e->key, __ATOMIC_RELAXED) != key) return;
+  if (!ahi_write_begin(e, &seq)) return;
+  if (e->key == key) {
+    e->leaf_num = 0;
+    e->heat = 0;
+  }
+  ahi_write_end(e, seq);
+}
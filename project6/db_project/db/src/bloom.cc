@@ -0,0 +1,108 @@
+#include "bloom.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOOM_MAGIC 0x314d4c42  // "BLM1"
+
+// Odd constants spreading the low half of the hash over the eight words.
+static const uint32_t bloom_salt[BLOOM_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+uint64_t bloom_hash(int64_t key) {
+  uint64_t h = (uint64_t)key;
+
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+bloom_t* bloom_create(uint64_t expected_keys, const char* path) {
+  bloom_t* bloom = new bloom_t;
+
+  bloom->num_blocks =
+      (expected_keys * BLOOM_BITS_PER_KEY + sizeof(bloom_block_t) * 8 - 1) /
+      (sizeof(bloom_block_t) * 8);
+  if (!bloom->num_blocks) bloom->num_blocks = 1;
+  bloom->blocks = (bloom_block_t*)aligned_alloc(
+      sizeof(bloom_block_t), sizeof(bloom_block_t) * bloom->num_blocks);
+  memset(bloom->blocks, 0x00, sizeof(bloom_block_t) * bloom->num_blocks);
+  bloom->ready = false;
+  bloom->path = path;
+
+  return bloom;
+}
+
+void bloom_destroy(bloom_t* bloom) {
+  free(bloom->blocks);
+  delete bloom;
+}
+
+// Inserts and probes run without a latch, bits are set atomically.
+void bloom_add(bloom_t* bloom, int64_t key) {
+  uint64_t h = bloom_hash(key);
+  bloom_block_t* block =
+      &bloom->blocks[((h >> 32) * bloom->num_blocks) >> 32];
+
+  for (int i = 0; i < BLOOM_WORDS; i++)
+    __atomic_fetch_or(&block->word[i],
+                      1ULL << (((uint32_t)h * bloom_salt[i]) >> 26),
+                      __ATOMIC_RELAXED);
+}
+
+bool bloom_may_contain(bloom_t* bloom, int64_t key) {
+  uint64_t h = bloom_hash(key);
+  bloom_block_t* block =
+      &bloom->blocks[((h >> 32) * bloom->num_blocks) >> 32];
+
+  for (int i = 0; i < BLOOM_WORDS; i++)
+    if (!(__atomic_load_n(&block->word[i], __ATOMIC_RELAXED) &
+          (1ULL << (((uint32_t)h * bloom_salt[i]) >> 26))))
+      return false;
+  return true;
+}
+
+// Side file: magic, number of blocks, then the blocks.
+int bloom_load(bloom_t* bloom) {
+  uint32_t magic;
+  uint64_t num_blocks;
+  size_t bytes = sizeof(bloom_block_t) * bloom->num_blocks;
+  int fd, ret = 1;
+
+  fd = open(bloom->path.c_str(), O_RDONLY);
+  if (fd < 0) return 1;
+  if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+      pread(fd, &num_blocks, sizeof(num_blocks), sizeof(magic)) ==
+          sizeof(num_blocks) &&
+      magic == BLOOM_MAGIC && num_blocks == bloom->num_blocks &&
+      pread(fd, bloom->blocks, bytes, sizeof(magic) + sizeof(num_blocks)) ==
+          (ssize_t)bytes)
+    ret = 0;
+  close(fd);
+  unlink(bloom->path.c_str());
+  if (ret) memset(bloom->blocks, 0x00, bytes);
+
+  return ret;
+}
+
+int bloom_save(bloom_t* bloom) {
+  uint32_t magic = BLOOM_MAGIC;
+  size_t bytes = sizeof(bloom_block_t) * bloom->num_blocks;
+  int fd, ret = 1;
+
+  fd = open(bloom->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 1;
+  if (pwrite(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+      pwrite(fd, &bloom->num_blocks, sizeof(bloom->num_blocks),
+             sizeof(magic)) == sizeof(bloom->num_blocks) &&
+      pwrite(fd, bloom->blocks, bytes,
+             sizeof(magic) + sizeof(bloom->num_blocks)) == (ssize_t)bytes &&
+      !fsync(fd))
+    ret = 0;
+  close(fd);
+  if (ret) unlink(bloom->path.c_str());
+
+  return ret;
+}
@@ -1,25 +1,76 @@
 #include "bpt.h"
+#include "hash.h"
+#include <algorithm>
+#include <queue>
+#include <set>
+#include <sched.h>
+#include <stddef.h>
 
-#define INITIAL_FREE 3968
 #define THRESHOLD 2500
-#define MAX_ORDER 249
 #define PGSIZE 4096
+#define BULK_BATCH 128
+#define FIND_GROUP 16
+
+tree_table_t trees;
+tree_t* tree_slots[TREE_SLOTS];
+pthread_mutex_t trees_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Leaves queued for the merge thread, each at most once.
+std::queue<merge_task_t> merge_queue;
+std::set<std::pair<int64_t, pagenum_t>> merge_pending;
+// Tombstoned keys by table and key, so they are purged in leaf order.
+std::set<std::pair<int64_t, int64_t>> purge_queue;
+pthread_mutex_t merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t merge_cond = PTHREAD_COND_INITIALIZER;
+pthread_t merge_thread;
+bool merge_running = false, merge_busy = false, merge_stop = false;
+
+int64_t open_table(char* pathname, uint16_t value_size, int organization) {
+  int64_t table_id;
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  table_id = file_open_via_buffer(pathname);
+  if (table_id < 0) return table_id;
+  tree = give_tree(table_id);
+  tree->path = pathname;
+  if (value_size) {
+    if (16 + value_size > INITIAL_FREE) return -1;
+
+    header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+    if (header->value_size != value_size && header->root_num) {
+      buffer_write_page(table_id, 0, header_idx, 0);
+      return -1;
+    }
+    header->value_size = value_size;
+    buffer_write_page(table_id, 0, header_idx, 1);
+    tree->value_size = value_size;
+  }
+
+  if (organization == TABLE_HASH && hash_create(table_id, tree)) return -1;
+  if ((tree->flags & TREE_HASH) && !tree->hash)
+    tree->hash = hash_load(table_id);
+  else if (!(tree->flags & TREE_HASH) && !tree->ahi)
+    tree->ahi = ahi_create();
+  open_bloom(table_id);
 
-int64_t open_table(char* pathname) { return file_open_via_buffer(pathname); }
+  return table_id;
+}
 
-int shutdown_db() { return shutdown_trx(); }
+int shutdown_db() {
+  stop_merge_worker();
+  save_blooms();
+  clear_trees();
+  rowcache_destroy();
+  return shutdown_trx();
+}
 
 int cut(int length) {
   if (length % 2 == 0) return length / 2;
   return length / 2 + 1;
 }
 
-void valueCopy(char* src, page_t* dest, int16_t size, int16_t offset) {
-  offset -= 128;
-  for (int i = 0, j = offset; i < size; i++, j++)
-    dest->leafbody.value[j] = src[i];
-}
-
 pagenum_t find_leaf(int64_t table_id, pagenum_t root_num, int64_t key) {
   pagenum_t ret_num = root_num;
   int32_t root_idx, next_idx;
@@ -27,14 +78,14 @@ pagenum_t find_leaf(int64_t table_id, pagenum_t root_num, int64_t key) {
   root = buffer_read_page(table_id, root_num, &root_idx, READ);
 
   while (!root->info.isLeaf) {
-    if (key < root->branch[0].key)
+    if (key < node_key(root, 0))
       ret_num = root->leftmost;
     else {
       uint32_t i = 0;
       for (i = 0; i < root->info.num_keys - 1; i++) {
-        if (key < root->branch[i + 1].key) break;
+        if (key < node_key(root, i + 1)) break;
       }
-      ret_num = root->branch[i].pagenum;
+      ret_num = node_child(root, i);
     }
     root = buffer_read_page(table_id, ret_num, &next_idx, READ);
   }
@@ -47,116 +98,387 @@ pagenum_t find_leaf(int64_t table_id, pagenum_t root_num, int64_t key) {
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size,
             int trx_id) {
   trx_t* trx;
-  page_t* header;
   page_t* page;
   pagenum_t page_id;
-  int header_idx;
   int page_idx;
-  int prev_idx;
   int flag;
-  int key_index;
+  uint32_t key_index;
   uint16_t size;
-  uint16_t offset;
+  uint64_t epoch;
 
   if (!isValid(table_id)) return 1;
-  if (!(trx = give_trx(trx_id))) return 1;
+  if (trx_id && !(trx = give_trx(trx_id))) return 1;
+  if (bloom_excludes(give_tree(table_id), key)) return 1;
+  if (!trx_id) {
+    if (rowcache_get(table_id, key, ret_val, val_size)) return 0;
+    epoch = rowcache_epoch(table_id, key);
+  }
 
-  header = buffer_read_page(table_id, 0, &header_idx, READ);
-  page_id = header->root_num;
+  page_id = find_record_page(table_id, key, &page, &page_idx, &key_index);
   if (!page_id) {
     return 1;
   }
 
-  page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
-  while (!(page->info.isLeaf)) {
-    prev_idx = page_idx;
-    if (key < page->branch[0].key)
-      page_id = page->leftmost;
-    else {
-      uint32_t i = 0;
-      for (i = 0; i < page->info.num_keys - 1; i++)
-        if (key < page->branch[i + 1].key) break;
-      page_id = page->branch[i].pagenum;
-    }
-    page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
-    buffer_write_page(table_id, page_id, prev_idx, 0);
-  }
-  
-  for (key_index = 0; key_index < page->info.num_keys; key_index++) {
-    if (page->leafbody.slot[key_index].key == key) break;
-  }
   if (key_index == page->info.num_keys) {
     buffer_write_page(table_id, page_id, page_idx, 0);
     return 1;
   }
-  page_idx = lock_acquire(table_id, page_id, key, key_index, trx_id, SHARED, page, page_idx);
-  if (page_idx == DEAD_LOCK) {
-    trx_abort(trx_id);
-    return 1;
+  if (trx_id) {
+    page_idx = lock_acquire(table_id, page_id, key, key_index, trx_id, SHARED, page, page_idx);
+    if (page_idx == DEAD_LOCK) {
+      trx_abort(trx_id);
+      return 1;
+    }
+    page = buffer_read_page_without_latch(page_idx);
   }
-  page = buffer_read_page_without_latch(page_idx);
   
-  offset = page->leafbody.slot[key_index].offset - 128;
-  size = page->leafbody.slot[key_index].size;
-  for (int i = offset, j = 0; i < offset + size; j++, i++)
-    ret_val[j] = page->leafbody.value[i];
+  size = leaf_size(page, key_index);
+  copy_value(table_id, page, key_index, ret_val);
   *val_size = size;
 
   buffer_write_page(table_id, page_id, page_idx, 0);
+  if (!trx_id) rowcache_put(table_id, key, ret_val, size, epoch);
+
+  return 0;
+}
+
+// Overflow pages are latched after their leaf and in chain order, as
+// copy_value reads them.
+value_view_t db_find_view(int64_t table_id, int64_t key, int trx_id) {
+  value_view_t view;
+  overflow_ref_t ref;
+  page_t* page;
+  pagenum_t page_id;
+  int32_t page_idx;
+  uint32_t key_index, done, len;
+
+  if (!isValid(table_id)) return view;
+  if (trx_id && !give_trx(trx_id)) return view;
+  if (bloom_excludes(give_tree(table_id), key)) return view;
+
+  page_id = find_record_page(table_id, key, &page, &page_idx, &key_index);
+  if (!page_id) return view;
+  if (key_index == page->info.num_keys) {
+    buffer_write_page(table_id, page_id, page_idx, 0);
+    return view;
+  }
+  if (trx_id) {
+    page_idx = lock_acquire(table_id, page_id, key, key_index, trx_id, SHARED,
+                            page, page_idx);
+    if (page_idx == DEAD_LOCK) {
+      trx_abort(trx_id);
+      return view;
+    }
+    page = buffer_read_page_without_latch(page_idx);
+  }
+
+  view.table_id = table_id;
+  view.total = leaf_size(page, key_index);
+  view.pages[view.num_pages++] = {page_id, page_idx};
+  if (page->value_size || !is_overflow(view.total)) {
+    view.parts[view.num_parts++] = {leaf_value(page, key_index), view.total};
+    return view;
+  }
+  memcpy(&ref, leaf_value(page, key_index), sizeof(ref));
+  page_id = ref.first;
+  for (done = 0; done < view.total; done += len) {
+    page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
+    len = std::min((uint32_t)OVERFLOW_CHUNK, view.total - done);
+    view.pages[view.num_pages++] = {page_id, page_idx};
+    view.parts[view.num_parts++] = {page->leafbody.value, (uint16_t)len};
+    page_id = page->Rsibling;
+  }
+  return view;
+}
+
+void value_view_t::release() {
+  for (uint32_t i = 0; i < num_pages; i++)
+    buffer_write_page(table_id, pages[i].page_num, pages[i].page_idx, 0);
+  total = num_parts = num_pages = 0;
+}
+
+// Returns -1 for leftmost, otherwise the branch index to follow.
+int child_index(page_t* page, int64_t key) {
+  return (int)node_upper_bound(page, key) - 1;
+}
+
+int find_batch_leaf(int64_t table_id, find_group_t* group, page_t* page,
+                    int32_t page_idx, int64_t* keys,
+                    std::vector<uint32_t>& order, char** ret_vals,
+                    uint16_t* val_sizes, int* results, int trx_id,
+                    std::vector<find_group_t>& next) {
+  if (page->value_size)
+    return find_batch_leaf<fixed_leaf>(table_id, group, page, page_idx, keys,
+                                       order, ret_vals, val_sizes, results,
+                                       trx_id, next);
+  return find_batch_leaf<slotted_leaf>(table_id, group, page, page_idx, keys,
+                                       order, ret_vals, val_sizes, results,
+                                       trx_id, next);
+}
+
+// Called with the leaf latched and its parent validated, releases it.
+// Keys past the high key go on to the right sibling. A lock wait gives up
+// the latch, and the leaf may split or lend keys meanwhile, so the keys
+// from there on are descended again from the root.
+template <typename L>
+int find_batch_leaf(int64_t table_id, find_group_t* group, page_t* page,
+                    int32_t page_idx, int64_t* keys,
+                    std::vector<uint32_t>& order, char** ret_vals,
+                    uint16_t* val_sizes, int* results, int trx_id,
+                    std::vector<find_group_t>& next) {
+  uint32_t slot, k;
+  int32_t latched_idx;
+  uint64_t version;
+  int64_t key;
+
+  slot = 0;
+  for (uint32_t i = group->begin; i < group->end; i++) {
+    k = order[i];
+    key = keys[k];
+    if (page->bounded && key >= page->high_key) {
+      next.push_back({page->Rsibling, i, group->end, page_idx,
+                      buffer_version(page_idx) + 1});
+      break;
+    }
+    while (slot < page->info.num_keys && L::key(page, slot) < key) slot++;
+    if (slot == page->info.num_keys || L::key(page, slot) != key ||
+        L::trx_id(page, slot) == TOMBSTONE_TRX)
+      continue;
+
+    if (trx_id) {
+      latched_idx = page_idx;
+      version = buffer_version(page_idx);
+      page_idx = lock_acquire(table_id, group->page_num, key, slot, trx_id,
+                              SHARED, page, page_idx);
+      if (page_idx == DEAD_LOCK) {
+        trx_abort(trx_id);
+        return 1;
+      }
+      if (page_idx != latched_idx || buffer_version(page_idx) != version) {
+        buffer_write_page(table_id, group->page_num, page_idx, 0);
+        find_batch_root(table_id, i, group->end, next);
+        return 0;
+      }
+      if (L::trx_id(page, slot) == TOMBSTONE_TRX) continue;
+    }
+
+    if (is_overflow(L::size(page, slot)))
+      copy_value(table_id, page, slot, ret_vals[k]);
+    else
+      memcpy(ret_vals[k], L::value(page, slot), L::size(page, slot));
+    val_sizes[k] = L::size(page, slot);
+    results[k] = 0;
+  }
+  buffer_write_page(table_id, group->page_num, page_idx, 0);
+
+  return 0;
+}
+
+// Queues keys [begin, end) for a descent from the root, validated against
+// the header like any other parent.
+void find_batch_root(int64_t table_id, uint32_t begin, uint32_t end,
+                     std::vector<find_group_t>& next) {
+  int32_t header_idx;
+  uint64_t version;
+  pagenum_t root_num;
+
+  root_num = read_root(table_id, &header_idx, &version);
+  if (root_num) next.push_back({root_num, begin, end, header_idx, version});
+}
+
+// Falls back to one latched descent per leaf for a group whose parent
+// changed, or was evicted by the pages read after it, since it was split
+// off.
+int find_batch_descend(int64_t table_id, find_group_t* group, int64_t* keys,
+                       std::vector<uint32_t>& order, char** ret_vals,
+                       uint16_t* val_sizes, int* results, int trx_id,
+                       std::vector<find_group_t>& next) {
+  find_group_t sub;
+  page_t* leaf;
+  int32_t leaf_idx;
+  int64_t high_key;
+  bool bounded;
+
+  for (uint32_t i = group->begin, j; i < group->end; i = j) {
+    sub.page_num = find_leaf_latched(table_id, keys[order[i]], &leaf,
+                                     &leaf_idx, &high_key, &bounded);
+    if (!sub.page_num) return 0;
+    for (j = i + 1; j < group->end; j++)
+      if (bounded && keys[order[j]] >= high_key) break;
+    sub.begin = i;
+    sub.end = j;
+    if (find_batch_leaf(table_id, &sub, leaf, leaf_idx, keys, order, ret_vals,
+                        val_sizes, results, trx_id, next))
+      return 1;
+  }
+  return 0;
+}
+
+// Splits a group over the children of an internal node that may have been
+// read optimistically, so num_keys is checked before it bounds a search.
+// Returns 1 on a torn read.
+int find_batch_split(page_t* page, int32_t page_idx, uint64_t version,
+                     find_group_t* group, int64_t* keys,
+                     std::vector<uint32_t>& order,
+                     std::vector<find_group_t>& next) {
+  uint32_t num_keys = page->info.num_keys;
+  uint32_t i, j, end;
+  pagenum_t child;
+  int c;
+
+  if (!num_keys || num_keys > node_capacity(page)) return 1;
+  end = group->end;
+  if (page->bounded)
+    while (end > group->begin && keys[order[end - 1]] >= page->high_key)
+      end--;
+  for (i = group->begin; i < end; i = j) {
+    c = (int)node_upper_bound(page, keys[order[i]], num_keys) - 1;
+    child = c < 0 ? page->leftmost : node_child(page, c);
+    if (!child) return 1;
+    j = i + 1;
+    if (c + 1 < (int)num_keys) {
+      while (j < end && keys[order[j]] < node_key(page, c + 1)) j++;
+    } else
+      j = end;
+    next.push_back({child, i, j, page_idx, version});
+  }
+  if (end < group->end) {
+    if (!page->right_num) return 1;
+    next.push_back({page->right_num, end, group->end, page_idx, version});
+  }
+  return 0;
+}
+
+// Descends level by level with the sorted keys split into one group per
+// page, so shared path prefixes are read once. Pages of FIND_GROUP groups
+// are prefetched together before any of them is searched. Each group
+// carries the version its parent had when it was split off; internal
+// nodes are searched optimistically as in find_leaf_latched, and a group
+// whose parent changed meanwhile is looked up leaf by leaf.
+int db_find_batch(int64_t table_id, int64_t* keys, int n, char** ret_vals,
+                  uint16_t* val_sizes, int* results, int trx_id) {
+  std::vector<uint32_t> order;
+  std::vector<find_group_t> groups, next;
+  find_group_t* group;
+  page_t* page;
+  int32_t page_idx;
+  uint64_t version;
+  uint32_t end;
+  tree_t* tree;
+  size_t mark;
+
+  if (!isValid(table_id)) return 1;
+  if (trx_id && !give_trx(trx_id)) return 1;
+  for (int i = 0; i < n; i++) results[i] = 1;
+  if (n <= 0) return 0;
+
+  tree = give_tree(table_id);
+  if (tree->flags & TREE_HASH)
+    return hash_find_batch(table_id, keys, n, ret_vals, val_sizes, results,
+                           trx_id);
+  for (int i = 0; i < n; i++)
+    if (!bloom_excludes(tree, keys[i])) order.push_back(i);
+  if (order.empty()) return 0;
+  std::sort(order.begin(), order.end(),
+            [keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+  find_batch_root(table_id, 0, order.size(), groups);
+  while (!groups.empty()) {
+    for (uint32_t g0 = 0; g0 < groups.size(); g0 += FIND_GROUP) {
+      end = std::min((uint32_t)groups.size(), g0 + FIND_GROUP);
+      for (uint32_t g = g0; g < end; g++) {
+        page = buffer_optimistic_read(table_id, groups[g].page_num, &page_idx,
+                                      &version);
+        if (!page) {
+          buffer_read_page(table_id, groups[g].page_num, &page_idx, READ);
+          continue;
+        }
+        __builtin_prefetch(page);
+        __builtin_prefetch((char*)page + 128);
+        __builtin_prefetch((char*)page + PGSIZE / 2);
+      }
+
+      for (uint32_t g = g0; g < end; g++) {
+        group = &groups[g];
+        page = buffer_optimistic_read(table_id, group->page_num, &page_idx,
+                                      &version);
+        if (page && !page->info.isLeaf) {
+          mark = next.size();
+          if (!buffer_validate(group->parent_idx, group->parent_version)) {
+            if (find_batch_descend(table_id, group, keys, order, ret_vals,
+                                   val_sizes, results, trx_id, next))
+              return 1;
+            continue;
+          }
+          if (!find_batch_split(page, page_idx, version, group, keys, order,
+                                next) &&
+              buffer_validate(page_idx, version))
+            continue;
+          next.resize(mark);
+        }
+
+        page = buffer_read_page(table_id, group->page_num, &page_idx, WRITE);
+        if (!buffer_validate(group->parent_idx, group->parent_version)) {
+          buffer_write_page(table_id, group->page_num, page_idx, 0);
+          if (find_batch_descend(table_id, group, keys, order, ret_vals,
+                                 val_sizes, results, trx_id, next))
+            return 1;
+          continue;
+        }
+        if (page->info.isLeaf) {
+          if (find_batch_leaf(table_id, group, page, page_idx, keys, order,
+                              ret_vals, val_sizes, results, trx_id, next))
+            return 1;
+          continue;
+        }
+        find_batch_split(page, page_idx, buffer_version(page_idx) + 1, group,
+                         keys, order, next);
+        buffer_write_page(table_id, group->page_num, page_idx, 0);
+      }
+    }
+    groups.swap(next);
+    next.clear();
+  }
 
   return 0;
 }
 
 int db_update(int64_t table_id, int64_t key, char* values,
               uint16_t new_val_size, uint16_t* old_val_size, int trx_id) {
-  page_t* header;
+  struct iovec iov = {values, new_val_size};
+
+  return db_update_v(table_id, key, &iov, 1, old_val_size, trx_id);
+}
+
+// The pieces go straight into the log buffer and the leaf; the only copy
+// made on the side is the old value the undo needs.
+int db_update_v(int64_t table_id, int64_t key, const struct iovec* iov,
+                int iovcnt, uint16_t* old_val_size, int trx_id) {
   page_t* page;
-  int header_idx;
   int page_idx;
-  int key_index;
-  int prev_idx;
+  uint32_t key_index;
   pagenum_t page_id;
   trx_t* trx;
-  trx_t* impl_trx;
-  entry_t* entry;
   undo_t* undo;
   uint16_t offset;
   uint16_t size;
-  char* old_value;
+  uint16_t new_val_size;
   main_log_t* main_log;
   update_log_t* update_log_t;
-  char* old_img;
-  char* new_img;
-  int flag;
 
   if (!isValid(table_id)) return 1;
   if (!(trx = give_trx(trx_id))) return 1;
+  if (iov_total(iov, iovcnt, &new_val_size)) return 1;
 
-  header = buffer_read_page(table_id, 0, &header_idx, READ);
-  page_id = header->root_num;
+  page_id = find_record_page(table_id, key, &page, &page_idx, &key_index);
   if (!page_id) {
     return 1;
   }
 
-  page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
-  while (!(page->info.isLeaf)) {
-    prev_idx = page_idx;
-    if (key < page->branch[0].key)
-      page_id = page->leftmost;
-    else {
-      uint32_t i = 0;
-      for (i = 0; i < page->info.num_keys - 1; i++)
-        if (key < page->branch[i + 1].key) break;
-      page_id = page->branch[i].pagenum;
-    }
-    page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
-    buffer_write_page(table_id, page_id, prev_idx, 0);
-  }
-
-  for (key_index = 0; key_index < page->info.num_keys; key_index++) {
-    if (page->leafbody.slot[key_index].key == key) break;
-  }
-  if (key_index == page->info.num_keys) {
+  if (key_index == page->info.num_keys ||
+      (page->value_size && new_val_size != page->value_size) ||
+      (!page->value_size && (is_overflow(leaf_size(page, key_index)) ||
+                             is_overflow(new_val_size)))) {
     buffer_write_page(table_id, page_id, page_idx, 0);
     return 1;
   }
@@ -167,906 +489,2911 @@ int db_update(int64_t table_id, int64_t key, char* values,
     return 1;
   }
   page = buffer_read_page_without_latch(page_idx);
+  if (leaf_is_tombstone(page, key_index)) {
+    buffer_write_page(table_id, page_id, page_idx, 0);
+    return 1;
+  }
 
-  offset = page->leafbody.slot[key_index].offset - 128;
-  size = page->leafbody.slot[key_index].size;
+  offset = leaf_value(page, key_index) - page->leafbody.value;
+  size = leaf_size(page, key_index);
   *old_val_size = size;
-  old_value = new char[size + 1];
-  for (int i = offset, j = 0; i < offset + size; j++, i++)
-    old_value[j] = page->leafbody.value[i];
+  undo = new undo_t();
+  undo->old_value = new char[size + 1];
+  memcpy(undo->old_value, page->leafbody.value + offset, size);
 
   main_log = make_main_log(trx_id, UPDATE, MAINLOG + UPDATELOG + 2 * new_val_size, trx->last_LSN);
   update_log_t = make_update_log(table_id, page_id, new_val_size, offset + 128);
   trx->last_LSN = page->LSN = main_log->LSN;
-  old_img = new char[new_val_size + 2]();
-  new_img = new char[new_val_size + 2]();
-  for (int i = 0; i < new_val_size; i++) {
-    old_img[i] = page->leafbody.value[i + offset];
-    new_img[i] = values[i];
-  }
-  push_log_to_buffer(main_log, update_log_t, old_img, new_img, 0);
+  push_update_log_v(main_log, update_log_t, page->leafbody.value + offset, iov,
+                    iovcnt);
 
-  for (int i = offset, j = 0; i < offset + new_val_size; j++, i++)
-    page->leafbody.value[i] = values[j];
-  page->leafbody.slot[key_index].size = new_val_size;
+  iov_gather(iov, iovcnt, page->leafbody.value + offset);
+  if (!page->value_size) slotted_leaf::set_size(page, key_index, new_val_size);
   
-  undo = new undo_t();
-  undo->old_value = new char[size + 1];
   undo->LSN = trx->last_LSN;
   undo->table_id = table_id;
   undo->page_id = page_id;
   undo->key = key;
   undo->val_size = size;
-  for (int k = 0; k < size; k++) undo->old_value[k] = old_value[k];
   trx->undo_stack.push(undo);
   buffer_write_page(table_id, page_id, page_idx, 1);
+  rowcache_invalidate(table_id, key);
+
+  return 0;
+}
+
+// Sums the pieces, failing if they do not fit a uint16_t value size.
+int iov_total(const struct iovec* iov, int iovcnt, uint16_t* total) {
+  uint64_t sum = 0;
+
+  if (iovcnt < 0) return 1;
+  for (int i = 0; i < iovcnt; i++) sum += iov[i].iov_len;
+  if (sum > UINT16_MAX) return 1;
+  *total = sum;
+  return 0;
+}
+
+void iov_gather(const struct iovec* iov, int iovcnt, char* dest) {
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(dest, iov[i].iov_base, iov[i].iov_len);
+    dest += iov[i].iov_len;
+  }
+}
+
+// Copies bytes [begin, begin + len) of the gathered value to dest.
+void iov_copy_range(const struct iovec* iov, int iovcnt, uint32_t begin,
+                    uint32_t len, char* dest) {
+  uint32_t n;
+
+  for (int i = 0; i < iovcnt && len; i++) {
+    if (begin >= iov[i].iov_len) {
+      begin -= iov[i].iov_len;
+      continue;
+    }
+    n = std::min((uint32_t)iov[i].iov_len - begin, len);
+    memcpy(dest, (char*)iov[i].iov_base + begin, n);
+    dest += n;
+    len -= n;
+    begin = 0;
+  }
+}
+
+// Picks the child of an internal node that may have been read
+// optimistically, so num_keys is checked before it bounds any loop.
+// Returns 0 on a torn read.
+pagenum_t next_child(page_t* page, int64_t key, int64_t* high_key,
+                     bool* bounded) {
+  uint32_t num_keys = page->info.num_keys;
+  uint32_t i;
+
+  if (!num_keys || num_keys > node_capacity(page)) return 0;
+  if (key < node_key(page, 0)) {
+    if (bounded) {
+      *high_key = node_key(page, 0);
+      *bounded = true;
+    }
+    return page->leftmost;
+  }
+  for (i = 0; i < num_keys - 1; i++)
+    if (key < node_key(page, i + 1)) break;
+  if (bounded && i < num_keys - 1) {
+    *high_key = node_key(page, i + 1);
+    *bounded = true;
+  }
+  return node_child(page, i);
+}
+
+// The root number along with the header version it was read under, for a
+// descent that validates the header like any other parent.
+pagenum_t read_root(int64_t table_id, int32_t* header_idx, uint64_t* version) {
+  page_t* header;
+  pagenum_t root_num;
+
+  header = buffer_optimistic_read(table_id, 0, header_idx, version);
+  while (header) {
+    root_num = header->root_num;
+    if (buffer_validate(*header_idx, *version)) return root_num;
+    header = buffer_optimistic_read(table_id, 0, header_idx, version);
+  }
+  header = buffer_read_page(table_id, 0, header_idx, WRITE);
+  root_num = header->root_num;
+  *version = buffer_version(*header_idx) + 1;
+  buffer_write_page(table_id, 0, *header_idx, 0);
+  return root_num;
+}
+
+// Lehman-Yao descent. A node split after its parent was read is detected
+// by its high key, and the search moves right. Internal nodes are read
+// optimistically unless they are not resident or being written; only
+// leaves are always latched.
+pagenum_t find_leaf_blink(int64_t table_id, int64_t key, page_t** leaf,
+                          int32_t* leaf_idx, int64_t* high_key,
+                          bool* bounded) {
+  page_t* page;
+  pagenum_t page_id, next_id;
+  int page_idx;
+  uint64_t version;
+
+  page_id = get_root_num(table_id);
+  if (!page_id) return 0;
+  while (true) {
+    page = buffer_optimistic_read(table_id, page_id, &page_idx, &version);
+    if (page && !page->info.isLeaf) {
+      if (page->bounded && key >= page->high_key)
+        next_id = page->right_num;
+      else
+        next_id = next_child(page, key, nullptr, nullptr);
+      if (buffer_validate(page_idx, version) && next_id) page_id = next_id;
+      continue;
+    }
+
+    page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
+    if (page->info.isLeaf) break;
+    if (page->bounded && key >= page->high_key)
+      next_id = page->right_num;
+    else
+      next_id = next_child(page, key, nullptr, nullptr);
+    buffer_write_page(table_id, page_id, page_idx, 0);
+    page_id = next_id;
+  }
+
+  while (page->bounded && key >= page->high_key) {
+    next_id = page->Rsibling;
+    buffer_write_page(table_id, page_id, page_idx, 0);
+    page_id = next_id;
+    page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
+  }
+
+  if (bounded) {
+    *high_key = page->high_key;
+    *bounded = page->bounded;
+  }
+  *leaf = page;
+  *leaf_idx = page_idx;
+  return page_id;
+}
+
+// The page a record of key would be in, WRITE-latched: a bucket for hash
+// tables, a leaf otherwise. *slot is the record's index in it, or num_keys
+// if there is none.
+pagenum_t find_record_page(int64_t table_id, int64_t key, page_t** page,
+                           int32_t* page_idx, uint32_t* slot) {
+  tree_t* tree = give_tree(table_id);
+  pagenum_t page_num;
+  bool active;
+
+  if (tree->flags & TREE_HASH) {
+    page_num = hash_find_bucket(table_id, key, page, page_idx);
+    *slot = leaf_find(*page, key);
+    return page_num;
+  }
 
-  delete[] old_value;
+  if ((active = ahi_active(tree->ahi))) {
+    page_num = ahi_find_leaf(table_id, tree->ahi, key, page, page_idx, slot);
+    ahi_record(tree->ahi, page_num != 0);
+    if (page_num) return page_num;
+  }
+  page_num = find_leaf_latched(table_id, key, page, page_idx, nullptr, nullptr);
+  if (!page_num) return 0;
+  *slot = leaf_find(*page, key);
+  if (active && *slot < (*page)->info.num_keys)
+    ahi_learn(tree->ahi, key, page_num, *slot);
+  return page_num;
+}
 
+// Latches the leaf the index remembers for key and keeps it only if the key
+// is still there, so a hint left stale by a split, merge, redistribution or
+// compaction costs one page read and is dropped. A freed page reads back as
+// a non-leaf and overflow pages are not leaves either.
+pagenum_t ahi_find_leaf(int64_t table_id, ahi_t* ahi, int64_t key,
+                        page_t** leaf, int32_t* leaf_idx, uint32_t* slot) {
+  pagenum_t leaf_num;
+  uint32_t hint, i;
+
+  if (!ahi_lookup(ahi, key, &leaf_num, &hint)) return 0;
+  *leaf = buffer_read_page(table_id, leaf_num, leaf_idx, WRITE);
+  if ((*leaf)->info.isLeaf) {
+    if (hint < (*leaf)->info.num_keys && leaf_key(*leaf, hint) == key)
+      i = hint;
+    else
+      i = leaf_lower_bound(*leaf, key);
+    if (i < (*leaf)->info.num_keys && leaf_key(*leaf, i) == key &&
+        !leaf_is_tombstone(*leaf, i)) {
+      if (i != hint) ahi_learn(ahi, key, leaf_num, i);
+      *slot = i;
+      return leaf_num;
+    }
+  }
+  buffer_write_page(table_id, leaf_num, *leaf_idx, 0);
+  ahi_forget(ahi, key);
   return 0;
 }
 
-int insert_into_internal(int64_t table_id, uint32_t index, pagenum_t parent_num,
-                         page_t* parent, int32_t parent_idx, pagenum_t l_num,
-                         page_t* l, int32_t l_idx, pagenum_t r_num, page_t* r,
-                         int32_t r_idx, int64_t key) {
-  for (uint32_t i = parent->info.num_keys - 1; i >= index; i--) {
-    parent->branch[i + 1].key = parent->branch[i].key;
-    parent->branch[i + 1].pagenum = parent->branch[i].pagenum;
+// Optimistic lock coupling: internal nodes are read without latches and
+// each parent's version is checked again once the child is reached, so the
+// descent restarts from the header if a writer got in between. A node that
+// is not resident or is being written is latched instead, and the version
+// it is left with stands in for an optimistic read.
+//
+// When high_key is given it receives the smallest separator above key on
+// the path, i.e. every key of the leaf is below it; *bounded is false if the
+// leaf is the rightmost one.
+pagenum_t find_leaf_latched(int64_t table_id, int64_t key, page_t** leaf,
+                            int32_t* leaf_idx, int64_t* high_key,
+                            bool* bounded) {
+  tree_t* tree;
+  page_t* page;
+  pagenum_t page_id, next_id;
+  int page_idx;
+  int parent_idx;
+  uint64_t version, parent_version;
+  uint32_t depth;
+  bool restarted = false;
+
+  tree = give_tree(table_id);
+  if (tree->flags & TREE_BLINK)
+    return find_leaf_blink(table_id, key, leaf, leaf_idx, high_key, bounded);
+
+RESTART:
+  if (restarted) sched_yield();
+  restarted = true;
+  page_id = read_root(table_id, &parent_idx, &parent_version);
+  if (!page_id) return 0;
+
+  if (bounded) *bounded = false;
+  for (depth = 0;; depth++) {
+    // The leaf is latched anyway, so it is not looked up twice.
+    page = nullptr;
+    if (depth != __atomic_load_n(&tree->leaf_depth, __ATOMIC_RELAXED))
+      page = buffer_optimistic_read(table_id, page_id, &page_idx, &version);
+    if (page && !page->info.isLeaf) {
+      if (!buffer_validate(parent_idx, parent_version)) goto RESTART;
+      next_id = next_child(page, key, high_key, bounded);
+      if (!buffer_validate(page_idx, version) || !next_id) goto RESTART;
+    } else {
+      page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
+      if (!buffer_validate(parent_idx, parent_version)) {
+        buffer_write_page(table_id, page_id, page_idx, 0);
+        goto RESTART;
+      }
+      if (page->info.isLeaf) break;
+      next_id = next_child(page, key, high_key, bounded);
+      version = buffer_version(page_idx) + 1;
+      buffer_write_page(table_id, page_id, page_idx, 0);
+    }
+    parent_idx = page_idx;
+    parent_version = version;
+    page_id = next_id;
+  }
+
+  if (depth != __atomic_load_n(&tree->leaf_depth, __ATOMIC_RELAXED))
+    __atomic_store_n(&tree->leaf_depth, depth, __ATOMIC_RELAXED);
+  *leaf = page;
+  *leaf_idx = page_idx;
+  return page_id;
+}
+
+int cursor_fetch(scan_cursor_t* cursor) {
+  page_t* next;
+  pagenum_t next_num;
+  int32_t next_idx;
+  int64_t key;
+
+  while (!cursor->done) {
+    if (cursor->slot >= cursor->leaf->info.num_keys) {
+      next_num = cursor->leaf->Rsibling;
+      if (!next_num) break;
+      next = buffer_try_read_page(cursor->table_id, next_num, &next_idx);
+      if (!next && cursor->leaf->info.num_keys) {
+        // Waiting for the right sibling while holding this leaf can deadlock
+        // with a writer; let go and descend again past the last key.
+        key = leaf_key(cursor->leaf, cursor->leaf->info.num_keys - 1);
+        buffer_write_page(cursor->table_id, cursor->leaf_num, cursor->leaf_idx,
+                          0);
+        cursor->done = true;
+        if (key == INT64_MAX) return 1;
+        cursor->leaf_num =
+            find_leaf_latched(cursor->table_id, key + 1, &cursor->leaf,
+                              &cursor->leaf_idx, nullptr, nullptr);
+        if (!cursor->leaf_num) return 1;
+        cursor->done = false;
+        cursor->slot = leaf_lower_bound(cursor->leaf, key + 1);
+        continue;
+      }
+      if (!next)
+        next = buffer_read_page(cursor->table_id, next_num, &next_idx, WRITE);
+      buffer_write_page(cursor->table_id, cursor->leaf_num, cursor->leaf_idx,
+                        0);
+      cursor->leaf_num = next_num;
+      cursor->leaf = next;
+      cursor->leaf_idx = next_idx;
+      cursor->slot = 0;
+      continue;
+    }
+
+    key = leaf_key(cursor->leaf, cursor->slot);
+    if (key > cursor->hi) break;
+    if (leaf_is_tombstone(cursor->leaf, cursor->slot)) {
+      cursor->slot++;
+      continue;
+    }
+    if (cursor->limit > 0 && cursor->count >= cursor->limit) break;
+    if (!cursor->trx_id) return 0;
+
+    cursor->leaf_idx =
+        lock_acquire(cursor->table_id, cursor->leaf_num, key, cursor->slot,
+                     cursor->trx_id, SHARED, cursor->leaf, cursor->leaf_idx);
+    if (cursor->leaf_idx == DEAD_LOCK) {
+      cursor->done = true;
+      trx_abort(cursor->trx_id);
+      return DEAD_LOCK;
+    }
+    cursor->leaf = buffer_read_page_without_latch(cursor->leaf_idx);
+    if (cursor->slot < cursor->leaf->info.num_keys &&
+        leaf_key(cursor->leaf, cursor->slot) == key &&
+        !leaf_is_tombstone(cursor->leaf, cursor->slot))
+      return 0;
+
+    // The leaf was unlatched while waiting for the lock, find key again.
+    cursor->slot = leaf_lower_bound(cursor->leaf, key);
+  }
+
+  if (!cursor->done) {
+    buffer_write_page(cursor->table_id, cursor->leaf_num, cursor->leaf_idx, 0);
+    cursor->done = true;
+  }
+  return 1;
+}
 
-    if (i == 0) break;
+scan_cursor_t* db_cursor_open(int64_t table_id, int64_t lo, int64_t hi,
+                              int trx_id, int64_t limit) {
+  scan_cursor_t* cursor;
+
+  if (!isValid(table_id)) return nullptr;
+  if (trx_id && !give_trx(trx_id)) return nullptr;
+  // Buckets keep no key order between them.
+  if (give_tree(table_id)->flags & TREE_HASH) return nullptr;
+
+  cursor = new scan_cursor_t();
+  cursor->table_id = table_id;
+  cursor->hi = hi;
+  cursor->limit = limit;
+  cursor->count = 0;
+  cursor->trx_id = trx_id;
+  cursor->slot = 0;
+  cursor->done = false;
+  cursor->value_buf = nullptr;
+
+  cursor->leaf_num =
+      find_leaf_latched(table_id, lo, &cursor->leaf, &cursor->leaf_idx,
+                        nullptr, nullptr);
+  if (!cursor->leaf_num) {
+    cursor->done = true;
+    return cursor;
   }
-  parent->branch[index].key = key;
-  parent->branch[index].pagenum = r_num;
-  parent->info.num_keys++;
+  cursor->slot = leaf_lower_bound(cursor->leaf, lo);
+
+  return cursor;
+}
+
+int db_cursor_next(scan_cursor_t* cursor, int64_t* key, char* ret_val,
+                   uint16_t* val_size) {
+  page_t* leaf;
+  int ret;
 
-  l->parent_num = r->parent_num = parent_num;
+  if (!cursor) return 1;
+  if ((ret = cursor_fetch(cursor))) return ret;
 
-  buffer_write_page(table_id, l_num, l_idx, 1);
-  buffer_write_page(table_id, r_num, r_idx, 1);
-  buffer_write_page(table_id, parent_num, parent_idx, 1);
+  leaf = cursor->leaf;
+  *key = leaf_key(leaf, cursor->slot);
+  if (ret_val) copy_value(cursor->table_id, leaf, cursor->slot, ret_val);
+  if (val_size) *val_size = leaf_size(leaf, cursor->slot);
+  cursor->slot++;
+  cursor->count++;
 
   return 0;
 }
 
-int insert_into_internal_after_splitting(int64_t table_id, uint32_t index,
-                                         pagenum_t parent_num, page_t* parent,
-                                         int32_t parent_idx, pagenum_t r_num,
-                                         int64_t key) {
-  uint32_t num_keys;
-  branch_t* tmp;
-  pagenum_t new_parent_num;
+void db_cursor_close(scan_cursor_t* cursor) {
+  if (!cursor) return;
+  if (!cursor->done)
+    buffer_write_page(cursor->table_id, cursor->leaf_num, cursor->leaf_idx, 0);
+  delete[] cursor->value_buf;
+  delete cursor;
+}
+
+int db_scan(int64_t table_id, int64_t lo, int64_t hi,
+            scan_callback_t callback, void* arg, int trx_id, int64_t limit) {
+  scan_cursor_t* cursor;
+  uint32_t slot;
+  char* value;
+  int ret;
+
+  if (!(cursor = db_cursor_open(table_id, lo, hi, trx_id, limit))) return 1;
+
+  while (!(ret = cursor_fetch(cursor))) {
+    slot = cursor->slot++;
+    cursor->count++;
+    value = leaf_value(cursor->leaf, slot);
+    if (!cursor->leaf->value_size &&
+        is_overflow(leaf_size(cursor->leaf, slot))) {
+      if (!cursor->value_buf) cursor->value_buf = new char[UINT16_MAX];
+      copy_value(table_id, cursor->leaf, slot, value = cursor->value_buf);
+    }
+    if (callback(leaf_key(cursor->leaf, slot), value,
+                 leaf_size(cursor->leaf, slot), arg))
+      break;
+  }
+  db_cursor_close(cursor);
+
+  return ret == DEAD_LOCK;
+}
+
+// Latch
+tree_t* give_tree(int64_t table_id) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  if (table_id >= 0 && table_id < TREE_SLOTS &&
+      (tree = __atomic_load_n(&tree_slots[table_id], __ATOMIC_ACQUIRE)))
+    return tree;
+
+  LOCK(trees_mutex);
+  if (trees.find(table_id) == trees.end()) {
+    tree = new tree_t;
+    tree->latch = PTHREAD_MUTEX_INITIALIZER;
+    header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+    tree->flags = header->flags;
+    tree->value_size = header->value_size;
+    tree->format = header->format;
+    tree->key_type = header->key_type;
+    tree->key_len = header->key_len;
+    tree->merge_policy = header->merge_policy;
+    tree->leaf_depth = 0;
+    tree->last_leaf = 0;
+    tree->bloom = nullptr;
+    tree->hash = nullptr;
+    tree->ahi = nullptr;
+    buffer_write_page(table_id, 0, header_idx, 0);
+    trees[table_id] = tree;
+    if (table_id >= 0 && table_id < TREE_SLOTS)
+      __atomic_store_n(&tree_slots[table_id], tree, __ATOMIC_RELEASE);
+  } else
+    tree = trees[table_id];
+  UNLOCK(trees_mutex);
+
+  return tree;
+}
+
+void clear_trees() {
+  LOCK(trees_mutex);
+  for (int64_t i = 0; i < TREE_SLOTS; i++)
+    __atomic_store_n(&tree_slots[i], nullptr, __ATOMIC_RELEASE);
+  for (auto it = trees.begin(); it != trees.end(); it++) {
+    if (it->second->bloom) bloom_destroy(it->second->bloom);
+    delete it->second->hash;
+    if (it->second->ahi) ahi_destroy(it->second->ahi);
+    delete it->second;
+  }
+  trees.clear();
+  UNLOCK(trees_mutex);
+}
+
+// Bloom filter
+// Builds the filter the header asks for, unless the table already has one.
+// It is published before the leaves are read, so inserts running alongside
+// add their keys themselves, and probes trust it only once it is ready.
+void open_bloom(int64_t table_id) {
+  tree_t* tree = give_tree(table_id);
+  page_t* header;
+  int32_t header_idx;
+  bloom_t* bloom;
+  uint64_t expected_keys;
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  expected_keys = header->bloom_keys;
+  buffer_write_page(table_id, 0, header_idx, 0);
+  if (!expected_keys || tree->bloom) {
+    UNLOCK(tree->latch);
+    return;
+  }
+  bloom = bloom_create(expected_keys, (tree->path + ".bloom").c_str());
+  __atomic_store_n(&tree->bloom, bloom, __ATOMIC_RELEASE);
+  UNLOCK(tree->latch);
+
+  if (bloom_load(bloom)) build_bloom(table_id, bloom);
+  __atomic_store_n(&bloom->ready, true, __ATOMIC_RELEASE);
+}
+
+void build_bloom(int64_t table_id, bloom_t* bloom) {
+  scan_cursor_t* cursor;
+  int64_t key;
+
+  cursor = db_cursor_open(table_id, INT64_MIN, INT64_MAX, 0, 0);
+  while (!db_cursor_next(cursor, &key, nullptr, nullptr))
+    bloom_add(bloom, key);
+  db_cursor_close(cursor);
+}
+
+// Only filters in use are kept, bloom_load has removed the side file of
+// the others.
+void save_blooms() {
+  LOCK(trees_mutex);
+  for (auto it = trees.begin(); it != trees.end(); it++) {
+    bloom_t* bloom = it->second->bloom;
+    if (bloom && bloom->ready) bloom_save(bloom);
+  }
+  UNLOCK(trees_mutex);
+}
+
+void bloom_note(tree_t* tree, int64_t key) {
+  bloom_t* bloom = __atomic_load_n(&tree->bloom, __ATOMIC_ACQUIRE);
+  if (bloom) bloom_add(bloom, key);
+}
+
+bool bloom_excludes(tree_t* tree, int64_t key) {
+  bloom_t* bloom = __atomic_load_n(&tree->bloom, __ATOMIC_ACQUIRE);
+  return bloom && __atomic_load_n(&bloom->ready, __ATOMIC_ACQUIRE) &&
+         !bloom_may_contain(bloom, key);
+}
+
+// Readers of a B-link table hold one latch at a time, so the option must be
+// set before the table is shared between threads.
+int db_set_blink(int64_t table_id, bool enable) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  if (!isValid(table_id)) return 1;
+  tree = give_tree(table_id);
+  LOCK(tree->latch);
+  if (enable && (tree->flags & (TREE_COUNTED | TREE_VARKEY | TREE_HASH))) {
+    UNLOCK(tree->latch);
+    return 1;
+  }
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (enable)
+    header->flags |= TREE_BLINK;
+  else
+    header->flags &= ~TREE_BLINK;
+  tree->flags = header->flags;
+  buffer_write_page(table_id, 0, header_idx, 1);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+// Counted nodes are smaller, so a table with nodes in place cannot switch.
+// B-link readers would miss the counts moving right, the two modes exclude
+// each other.
+int db_set_counted(int64_t table_id, bool enable) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  int ret = 0;
+
+  if (!isValid(table_id)) return 1;
+  tree = give_tree(table_id);
+  if (enable && (tree->flags & (TREE_BLINK | TREE_VARKEY | TREE_TOMBSTONE |
+                                TREE_HASH)))
+    return 1;
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (!(header->flags & TREE_COUNTED) == !enable) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+  } else if (header->root_num) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    ret = 1;
+  } else {
+    if (enable)
+      header->flags |= TREE_COUNTED;
+    else
+      header->flags &= ~TREE_COUNTED;
+    tree->flags = header->flags;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+// Pages already written keep their layout, so the format of a table can
+// only change while it is empty.
+int db_set_format(int64_t table_id, uint16_t format) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  int ret = 0;
+
+  if (!isValid(table_id)) return 1;
+  if (format != PAGE_FORMAT_PAIRS && format != PAGE_FORMAT_SPLIT_KEYS)
+    return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (header->format == format) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+  } else if (header->root_num) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    ret = 1;
+  } else {
+    header->format = tree->format = format;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+// Like the format, the key type is fixed once the table has pages.
+int db_set_key_type(int64_t table_id, uint16_t key_type) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  int ret = 0;
+
+  if (!isValid(table_id)) return 1;
+  if (key_type != KEY_INT64 && key_type != KEY_INT32) return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (header->key_type == key_type) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+  } else if (header->root_num) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    ret = 1;
+  } else {
+    header->key_type = tree->key_type = key_type;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+int db_set_key_bytes(int64_t table_id, uint16_t key_len) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  int ret = 0;
+
+  if (!isValid(table_id)) return 1;
+  if (key_len < 1 || key_len > KEY_BYTES_MAX) return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (header->key_type == KEY_BYTES && header->key_len == key_len) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+  } else if (header->root_num) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    ret = 1;
+  } else {
+    header->key_type = tree->key_type = KEY_BYTES;
+    header->key_len = tree->key_len = key_len;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+int db_set_bloom(int64_t table_id, uint64_t expected_keys) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  int ret = 0;
+
+  if (!isValid(table_id)) return 1;
+  tree = give_tree(table_id);
+  if (tree->flags & (TREE_VARKEY | TREE_HASH)) return 1;
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (!expected_keys) {
+    header->bloom_keys = 0;
+    if (tree->bloom)
+      __atomic_store_n(&tree->bloom->ready, false, __ATOMIC_RELEASE);
+    buffer_write_page(table_id, 0, header_idx, 1);
+  } else if (tree->bloom || tree->path.empty()) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    ret = 1;
+  } else {
+    // A side file left by an earlier filter does not describe this table.
+    remove((tree->path + ".bloom").c_str());
+    header->bloom_keys = expected_keys;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+  if (!ret && expected_keys) open_bloom(table_id);
+
+  return ret;
+}
+
+int db_set_adaptive_hash(int64_t table_id, bool enable) {
+  tree_t* tree;
+
+  if (!isValid(table_id)) return 1;
+  tree = give_tree(table_id);
+  if (!tree->ahi || (tree->flags & TREE_HASH)) return 1;
+  __atomic_store_n(&tree->ahi->off, !enable, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+int db_set_row_cache(uint64_t capacity) {
+  rowcache_resize(capacity);
+  return 0;
+}
+
+void db_row_cache_stats(rowcache_stats_t* stats) { rowcache_get_stats(stats); }
+
+// Tombstones left behind when the mode is turned off are still skipped and
+// purged.
+int db_set_tombstones(int64_t table_id, bool enable) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  if (!isValid(table_id)) return 1;
+  tree = give_tree(table_id);
+  LOCK(tree->latch);
+  if (enable && (tree->flags & (TREE_COUNTED | TREE_VARKEY | TREE_HASH))) {
+    UNLOCK(tree->latch);
+    return 1;
+  }
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (enable)
+    header->flags |= TREE_TOMBSTONE;
+  else
+    header->flags &= ~TREE_TOMBSTONE;
+  tree->flags = header->flags;
+  buffer_write_page(table_id, 0, header_idx, 1);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+// Unlike the modes above the policy does not change how pages look, so it
+// can be switched at any time.
+int db_set_merge_policy(int64_t table_id, uint16_t policy) {
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  if (!isValid(table_id)) return 1;
+  if (policy != MERGE_EAGER && policy != MERGE_AT_EMPTY &&
+      policy != MERGE_BACKGROUND)
+    return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  header->merge_policy = tree->merge_policy = policy;
+  buffer_write_page(table_id, 0, header_idx, 1);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+// Both descents couple latches from the root down. Writers of a counted
+// table hold their whole path while they change it, so every node is seen
+// either before or after a write, never halfway. The two ends of a range
+// are separate descents and may see different writes.
+int db_count_range(int64_t table_id, int64_t lo, int64_t hi, int64_t* count) {
+  int64_t upper, lower;
+
+  if (!isValid(table_id) || !(give_tree(table_id)->flags & TREE_COUNTED))
+    return 1;
+  *count = 0;
+  if (lo > hi) return 0;
+  if (rank_of(table_id, hi, true, &upper) ||
+      rank_of(table_id, lo, false, &lower))
+    return 1;
+  if (upper > lower) *count = upper - lower;
+
+  return 0;
+}
+
+int db_select_rank(int64_t table_id, int64_t rank, int64_t* key) {
+  page_t *page, *child;
+  pagenum_t page_num, child_num;
+  int32_t page_idx, child_idx;
+  uint32_t* counts;
+  uint32_t i;
+  int ret = 1;
+
+  if (!isValid(table_id) || !(give_tree(table_id)->flags & TREE_COUNTED) ||
+      rank < 0)
+    return 1;
+  page = latch_root(table_id, &page_num, &page_idx);
+  if (!page) return 1;
+
+  while (!page->info.isLeaf) {
+    counts = child_counts(page);
+    if (!counts) break;
+    for (i = 0; i < page->info.num_keys && rank >= counts[i]; i++)
+      rank -= counts[i];
+    child_num = i ? node_child(page, i - 1) : page->leftmost;
+    child = buffer_read_page(table_id, child_num, &child_idx, WRITE);
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    page = child;
+    page_num = child_num;
+    page_idx = child_idx;
+  }
+  if (page->info.isLeaf && rank < page->info.num_keys) {
+    *key = leaf_key(page, rank);
+    ret = 0;
+  }
+  buffer_write_page(table_id, page_num, page_idx, 0);
+
+  return ret;
+}
+
+pagenum_t get_root_num(int64_t table_id) {
+  page_t* header;
+  int32_t header_idx;
+  pagenum_t root_num;
+  uint64_t version;
+
+  header = buffer_optimistic_read(table_id, 0, &header_idx, &version);
+  if (header) {
+    root_num = header->root_num;
+    if (buffer_validate(header_idx, version)) return root_num;
+  }
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  root_num = header->root_num;
+  buffer_write_page(table_id, 0, header_idx, 0);
+
+  return root_num;
+}
+
+uint32_t* child_counts(page_t* page) {
+  if (page->info.isLeaf || !(page->flags & NODE_COUNTED)) return nullptr;
+  return (uint32_t*)((char*)page + offsetof(page_t, counted.count));
+}
+
+// Flags for the internal nodes a table creates from now on. Only layouts
+// with a separate key array can store narrower keys.
+uint32_t node_flags(tree_t* tree) {
+  uint32_t flags = (tree->flags & TREE_COUNTED) ? NODE_COUNTED : 0;
+
+  if (tree->format != PAGE_FORMAT_SPLIT_KEYS) return flags;
+  if (tree->key_type == KEY_INT32) flags |= NODE_KEY32;
+  if (tree->key_type == KEY_BYTES) flags |= NODE_KEY_BYTES(tree->key_len);
+  return flags | NODE_SPLIT_KEYS;
+}
+
+// Slotted leaves have no byte-string slot and keep KEY_BYTES keys packed.
+uint32_t leaf_flags(tree_t* tree) {
+  if (tree->key_type == KEY_INT32) return NODE_KEY32;
+  if (tree->key_type == KEY_BYTES && tree->value_size)
+    return NODE_KEY_BYTES(tree->key_len);
+  return 0;
+}
+
+bool key_fits(tree_t* tree, int64_t key) {
+  if (tree->key_type == KEY_INT32) return key >= INT32_MIN && key <= INT32_MAX;
+  if (tree->key_type == KEY_BYTES && tree->key_len < KEY_BYTES_MAX)
+    return !((uint64_t)key << (8 * tree->key_len));
+  return true;
+}
+
+uint32_t node_order(page_t* page) {
+  return node_capacity(page) + 1;
+}
+
+uint64_t subtree_count(page_t* page) {
+  uint32_t* counts = child_counts(page);
+  uint64_t total = 0;
+
+  if (page->info.isLeaf) return page->info.num_keys;
+  if (counts)
+    for (uint32_t i = 0; i <= page->info.num_keys; i++) total += counts[i];
+  return total;
+}
+
+// The path must reach down from the root, as it does for counted tables.
+void count_path(tree_path_t* path, int delta) {
+  for (uint32_t i = 1; i < path->stack.size(); i++)
+    child_counts(path->stack[i - 1].page)[path->stack[i].my_index + 1] += delta;
+}
+
+// A root that was replaced while we waited for its latch is let go again.
+page_t* latch_root(int64_t table_id, pagenum_t* root_num, int32_t* root_idx) {
+  page_t* root;
+
+  for (;;) {
+    *root_num = get_root_num(table_id);
+    if (!*root_num) return nullptr;
+    root = buffer_read_page(table_id, *root_num, root_idx, WRITE);
+    if (get_root_num(table_id) == *root_num) return root;
+    buffer_write_page(table_id, *root_num, *root_idx, 0);
+  }
+}
+
+// Number of keys below key, or not above it when inclusive.
+int rank_of(int64_t table_id, int64_t key, bool inclusive, int64_t* rank) {
+  page_t *page, *child;
+  pagenum_t page_num, child_num;
+  int32_t page_idx, child_idx;
+  uint32_t* counts;
+  int c, ret = 0;
+
+  *rank = 0;
+  page = latch_root(table_id, &page_num, &page_idx);
+  if (!page) return 0;
+
+  while (!page->info.isLeaf) {
+    counts = child_counts(page);
+    if (!counts) {
+      ret = 1;
+      break;
+    }
+    c = child_index(page, key);
+    for (int i = 0; i <= c; i++) *rank += counts[i];
+    child_num = c < 0 ? page->leftmost : node_child(page, c);
+    child = buffer_read_page(table_id, child_num, &child_idx, WRITE);
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    page = child;
+    page_num = child_num;
+    page_idx = child_idx;
+  }
+  if (!ret) {
+    *rank += leaf_lower_bound(page, key);
+    if (inclusive && leaf_search(page, key) < page->info.num_keys) (*rank)++;
+  }
+  buffer_write_page(table_id, page_num, page_idx, 0);
+
+  return ret;
+}
+
+// A node is safe when the operation cannot propagate a split or merge above
+// it, so every latch held over it can be released.
+bool is_safe(page_t* page, int op, int64_t key, uint16_t val_size,
+             bool is_root, uint16_t merge_policy) {
+  uint32_t i;
+
+  if (op == SMO_INSERT) {
+    if (page->info.isLeaf) return page->freespace >= leaf_cost(page, val_size);
+    return page->info.num_keys < node_order(page) - 1;
+  }
+  if (is_root) return page->info.num_keys > 1;
+  if (!page->info.isLeaf)
+    return page->info.num_keys > (uint32_t)cut(node_order(page)) - 1;
+
+  if (op == SMO_MERGE) return page->freespace < THRESHOLD;
+
+  i = leaf_search(page, key);
+  if (i == page->info.num_keys) return true;
+  if (merge_policy == MERGE_BACKGROUND) return true;
+  if (merge_policy == MERGE_AT_EMPTY) return page->info.num_keys > 1;
+  return page->freespace + leaf_cost(page, leaf_size(page, i)) < THRESHOLD;
+}
+
+void release_path(tree_path_t* path, bool success) {
+  for (uint32_t i = 0; i < path->stack.size(); i++) {
+    path_entry_t* e = &path->stack[i];
+    if (e->sibling)
+      buffer_write_page(path->table_id, e->sibling_num, e->sibling_idx,
+                        success);
+    if (e->page)
+      buffer_write_page(path->table_id, e->page_num, e->page_idx, success);
+  }
+  path->stack.clear();
+  if (path->tree_latched) {
+    UNLOCK(*path->tree_latch);
+    path->tree_latched = false;
+  }
+}
+
+// Latch crabbing: every node on the way down is latched, and the ancestors
+// are let go as soon as a node is safe. Deletes also latch the sibling a
+// node would be merged with, always left before right so that writers and
+// scans moving along the leaf chain agree on the order.
+// Returns 1 with the tree latch still held if the tree is empty.
+int descend_pessimistic(tree_path_t* path, int64_t key, int op,
+                        uint16_t val_size) {
+  tree_t* tree = give_tree(path->table_id);
+  path_entry_t e;
+  page_t* parent;
+  int c;
+
+  path->tree_latch = &tree->latch;
+  path->counted = tree->flags & TREE_COUNTED;
+  path->node_flags = node_flags(tree);
+  path->merge_policy = tree->merge_policy;
+  LOCK(*path->tree_latch);
+  path->tree_latched = true;
+
+  e.page_num = get_root_num(path->table_id);
+  if (!e.page_num) return 1;
+  e.page = buffer_read_page(path->table_id, e.page_num, &e.page_idx, WRITE);
+  e.my_index = -2;
+  e.sibling_num = 0;
+  e.sibling = nullptr;
+  path->stack.push_back(e);
+  if (is_safe(e.page, op, key, val_size, true, path->merge_policy)) {
+    UNLOCK(*path->tree_latch);
+    path->tree_latched = false;
+  }
+
+  while (!e.page->info.isLeaf) {
+    parent = e.page;
+    c = child_index(parent, key);
+    e.page_num = c < 0 ? parent->leftmost : node_child(parent, c);
+    e.my_index = c;
+    e.sibling = nullptr;
+    if (op != SMO_INSERT) {
+      if (c == -1)
+        e.sibling_num = node_child(parent, 0);
+      else if (c == 0)
+        e.sibling_num = parent->leftmost;
+      else
+        e.sibling_num = node_child(parent, c - 1);
+      if (c >= 0)
+        e.sibling = buffer_read_page(path->table_id, e.sibling_num,
+                                     &e.sibling_idx, WRITE);
+    }
+    e.page = buffer_read_page(path->table_id, e.page_num, &e.page_idx, WRITE);
+    if (op != SMO_INSERT && c == -1)
+      e.sibling = buffer_read_page(path->table_id, e.sibling_num,
+                                   &e.sibling_idx, WRITE);
+
+    if (is_safe(e.page, op, key, val_size, false, path->merge_policy)) {
+      if (!path->counted) release_path(path, 0);
+      if (e.sibling) {
+        buffer_write_page(path->table_id, e.sibling_num, e.sibling_idx, 0);
+        e.sibling = nullptr;
+      }
+    }
+    path->stack.push_back(e);
+  }
+
+  return 0;
+}
+
+int insert_into_internal(tree_path_t* path, int level, uint32_t index,
+                         pagenum_t r_num, page_t* r, int32_t r_idx,
+                         int64_t key) {
+  path_entry_t* parent = &path->stack[level];
+  uint32_t* counts = child_counts(parent->page);
+
+  if (counts) {
+    memmove(&counts[index + 2], &counts[index + 1],
+            sizeof(uint32_t) * (parent->page->info.num_keys - index));
+    counts[index] = subtree_count(path->stack[level + 1].page);
+    counts[index + 1] = subtree_count(r);
+  }
+  node_move(parent->page, index + 1, parent->page, index,
+            parent->page->info.num_keys - index);
+  node_set_key(parent->page, index, key);
+  node_child(parent->page, index) = r_num;
+  parent->page->info.num_keys++;
+
+  buffer_write_page(path->table_id, r_num, r_idx, 1);
+
+  return 0;
+}
+
+int insert_into_internal_after_splitting(tree_path_t* path, int level,
+                                         uint32_t index, pagenum_t r_num,
+                                         uint32_t r_count, int64_t key) {
+  uint32_t num_keys, tmp_counts[COUNTED_ORDER + 1];
+  uint32_t* counts;
+  int64_t tmp_keys[NODE_MAX_ORDER];
+  pagenum_t tmp_children[NODE_MAX_ORDER], new_parent_num;
   int64_t kprime;
-  page_t *new_parent, *child;
-  int32_t new_parent_idx, child_idx;
+  page_t *parent, *new_parent;
+  int32_t new_parent_idx;
 
-  tmp = (branch_t*)malloc(sizeof(branch_t) * 252);
+  parent = path->stack[level].page;
+  counts = child_counts(parent);
   num_keys = parent->info.num_keys + 1;
 
-  int split = cut(MAX_ORDER) - 1, ret = 1;
-  for (uint32_t i = 0, j = 0; i < num_keys; i++, j++) {
+  // The rightmost node keeps most of its entries when the new one lands at
+  // its end, ascending inserts will not come back to fill it.
+  int split = cut(node_order(parent)) - 1;
+  if (!parent->bounded && index == num_keys - 1) split = num_keys * 9 / 10;
+  for (uint32_t i = 0, j = 0; i < num_keys - 1; i++, j++) {
     if (j == index) j++;
-    tmp[j].key = parent->branch[i].key;
-    tmp[j].pagenum = parent->branch[i].pagenum;
+    tmp_keys[j] = node_key(parent, i);
+    tmp_children[j] = node_child(parent, i);
+  }
+  tmp_keys[index] = key;
+  tmp_children[index] = r_num;
+  if (counts) {
+    for (uint32_t i = 0, j = 0; i < num_keys; i++, j++) {
+      if (j == index + 1) j++;
+      tmp_counts[j] = counts[i];
+    }
+    tmp_counts[index] = subtree_count(path->stack[level + 1].page);
+    tmp_counts[index + 1] = r_count;
   }
-  tmp[index].key = key;
-  tmp[index].pagenum = r_num;
 
-  new_parent_num = buffer_alloc_page(table_id);
+  new_parent_num = buffer_alloc_page(path->table_id);
   new_parent =
-      buffer_read_page(table_id, new_parent_num, &new_parent_idx, WRITE);
+      buffer_read_page(path->table_id, new_parent_num, &new_parent_idx, WRITE);
   new_parent->info.isLeaf = parent->info.isLeaf;
   new_parent->info.num_keys = parent->info.num_keys = 0;
+  new_parent->high_key = parent->high_key;
+  new_parent->bounded = parent->bounded;
+  new_parent->right_num = parent->right_num;
+  new_parent->flags = parent->flags;
+  if (counts) {
+    memcpy(counts, tmp_counts, sizeof(uint32_t) * (split + 1));
+    memcpy(child_counts(new_parent), &tmp_counts[split + 1],
+           sizeof(uint32_t) * (num_keys - split));
+  }
 
   for (int i = 0; i < split; i++) {
-    parent->branch[i].key = tmp[i].key;
-    parent->branch[i].pagenum = tmp[i].pagenum;
+    node_set_key(parent, i, tmp_keys[i]);
+    node_child(parent, i) = tmp_children[i];
     parent->info.num_keys++;
   }
-  new_parent->leftmost = tmp[split].pagenum;
-
-  child = buffer_read_page(table_id, new_parent->leftmost, &child_idx, WRITE);
-  child->parent_num = new_parent_num;
-  buffer_write_page(table_id, new_parent->leftmost, child_idx, 1);
+  new_parent->leftmost = tmp_children[split];
 
   for (uint32_t i = split + 1, j = 0; i < num_keys; i++, j++) {
-    new_parent->branch[j].key = tmp[i].key;
-    new_parent->branch[j].pagenum = tmp[i].pagenum;
-
-    child = buffer_read_page(table_id, tmp[i].pagenum, &child_idx, WRITE);
-    child->parent_num = new_parent_num;
-    buffer_write_page(table_id, tmp[i].pagenum, child_idx, 1);
+    node_set_key(new_parent, j, tmp_keys[i]);
+    node_child(new_parent, j) = tmp_children[i];
     new_parent->info.num_keys++;
   }
 
-  kprime = tmp[split].key;
+  kprime = tmp_keys[split];
+  parent->high_key = kprime;
+  parent->bounded = 1;
+  parent->right_num = new_parent_num;
 
-  free(tmp);
-
-  return insert_into_parent(table_id, parent_num, parent, parent_idx,
-                            new_parent_num, new_parent, new_parent_idx, kprime);
+  return insert_into_parent(path, level - 1, new_parent_num, new_parent,
+                            new_parent_idx, kprime);
 }
 
-int insert_into_parent(int64_t table_id, pagenum_t l_num, page_t* l,
-                       int32_t l_idx, pagenum_t r_num, page_t* r, int32_t r_idx,
-                       int64_t key) {
-  int32_t parent_idx;
+// level is the parent's position in the path; l is the entry right below
+// it. A negative level means l is the root, which the path then holds
+// together with the tree latch.
+int insert_into_parent(tree_path_t* path, int level, pagenum_t r_num,
+                       page_t* r, int32_t r_idx, int64_t key) {
+  path_entry_t* l = &path->stack[level + 1];
   page_t* parent;
-  pagenum_t parent_num;
 
-  parent_num = l->parent_num;
-  if (!parent_num) {
+  if (level < 0) {
     page_t *new_root, *header;
     pagenum_t new_root_num;
     int32_t new_root_idx, header_idx;
-    new_root_num = buffer_alloc_page(table_id);
-    new_root = buffer_read_page(table_id, new_root_num, &new_root_idx, WRITE);
+    new_root_num = buffer_alloc_page(path->table_id);
+    new_root =
+        buffer_read_page(path->table_id, new_root_num, &new_root_idx, WRITE);
 
-    header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+    header = buffer_read_page(path->table_id, 0, &header_idx, WRITE);
     header->root_num = new_root_num;
-    buffer_write_page(table_id, 0, header_idx, 1);
+    buffer_write_page(path->table_id, 0, header_idx, 1);
 
-    l->parent_num = r->parent_num = new_root_num;
-    new_root->parent_num = 0;
     new_root->info.isLeaf = 0;
     new_root->info.num_keys = 1;
-    new_root->leftmost = l_num;
-    new_root->branch[0].key = key;
-    new_root->branch[0].pagenum = r_num;
+    new_root->bounded = 0;
+    new_root->right_num = 0;
+    new_root->flags = path->node_flags;
+    new_root->leftmost = l->page_num;
+    node_set_key(new_root, 0, key);
+    node_child(new_root, 0) = r_num;
+    if (path->counted) {
+      child_counts(new_root)[0] = subtree_count(l->page);
+      child_counts(new_root)[1] = subtree_count(r);
+    }
 
-    buffer_write_page(table_id, l_num, l_idx, 1);
-    buffer_write_page(table_id, r_num, r_idx, 1);
-    buffer_write_page(table_id, new_root_num, new_root_idx, 1);
+    buffer_write_page(path->table_id, r_num, r_idx, 1);
+    buffer_write_page(path->table_id, new_root_num, new_root_idx, 1);
 
     return 0;
   }
-  parent = buffer_read_page(table_id, parent_num, &parent_idx, WRITE);
+  parent = path->stack[level].page;
 
-  uint32_t i;
+  uint32_t i, r_count;
   for (i = 0; i < parent->info.num_keys; i++) {
-    if (parent->branch[i].key >= key) break;
+    if (node_key(parent, i) >= key) break;
   }
 
-  if (parent->info.num_keys < MAX_ORDER - 1)
-    return insert_into_internal(table_id, i, parent_num, parent, parent_idx,
-                                l_num, l, l_idx, r_num, r, r_idx, key);
+  if (parent->info.num_keys < node_order(parent) - 1)
+    return insert_into_internal(path, level, i, r_num, r, r_idx, key);
 
-  buffer_write_page(table_id, l_num, l_idx, 1);
-  buffer_write_page(table_id, r_num, r_idx, 1);
-  return insert_into_internal_after_splitting(table_id, i, parent_num, parent,
-                                              parent_idx, r_num, key);
+  r_count = subtree_count(r);
+  buffer_write_page(path->table_id, r_num, r_idx, 1);
+  return insert_into_internal_after_splitting(path, level, i, r_num, r_count,
+                                              key);
 }
 
-int insert_into_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num,
-                     page_t* leaf, int leaf_idx, int64_t key, char* value,
-                     uint16_t val_size) {
-  if (leaf->info.num_keys > 0) {
-    for (uint32_t i = leaf->info.num_keys - 1; i >= index; i--) {
-      leaf->leafbody.slot[i + 1].key = leaf->leafbody.slot[i].key;
-      leaf->leafbody.slot[i + 1].offset = leaf->leafbody.slot[i].offset;
-      leaf->leafbody.slot[i + 1].size = leaf->leafbody.slot[i].size;
-      leaf->leafbody.slot[i + 1].trx_id = leaf->leafbody.slot[i].trx_id;
+template <typename S>
+void slotted_insert(page_t* leaf, uint32_t index, int64_t key,
+                    const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  S* slot;
 
-      if (i == 0) break;
-    }
-  }
+  if (leaf->freespace - leaf->frag < sizeof(S) + value_bytes(val_size))
+    compact_value(leaf);
+  slot = leaf_slots<S>(leaf);
+  memmove(&slot[index + 1], &slot[index],
+          sizeof(S) * (leaf->info.num_keys - index));
   leaf->info.num_keys++;
-  leaf->freespace -= 16 + val_size;
-  leaf->leafbody.slot[index].key = key;
-  leaf->leafbody.slot[index].offset =
-      128 + (16 * leaf->info.num_keys) + leaf->freespace;
-  leaf->leafbody.slot[index].size = val_size;
-  leaf->leafbody.slot[index].trx_id = 0;
-
-  valueCopy(value, leaf, val_size, leaf->leafbody.slot[index].offset);
+  leaf->freespace -= sizeof(S) + value_bytes(val_size);
+  slot[index].key = key;
+  slot[index].offset =
+      128 + (sizeof(S) * leaf->info.num_keys) + leaf->freespace - leaf->frag;
+  slot[index].size = val_size;
+  slot[index].trx_id = 0;
+
+  iov_gather(iov, iovcnt, leaf->leafbody.value + slot[index].offset - 128);
+}
+
+// iov holds what goes into the leaf, value_bytes(val_size) bytes in all.
+void leaf_insert_slot(page_t* leaf, uint32_t index, int64_t key,
+                      const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  if (leaf->value_size)
+    fixed_insert(leaf, index, key, iov, iovcnt);
+  else
+    SLOT_CALL(leaf, slotted_insert, leaf, index, key, iov, iovcnt, val_size);
+}
+
+int insert_into_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num,
+                     page_t* leaf, int leaf_idx, int64_t key,
+                     const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  leaf_insert_slot(leaf, index, key, iov, iovcnt, val_size);
   buffer_write_page(table_id, leaf_num, leaf_idx, 1);
   return 0;
 }
 
-int insert_into_leaf_after_splitting(int64_t table_id, uint32_t index,
-                                     pagenum_t leaf_num, page_t* leaf,
-                                     int leaf_idx, int64_t key, char* value,
-                                     uint16_t val_size) {
-  uint32_t totalspace = 0, offset = PGSIZE, split = 0,
-           num_keys = leaf->info.num_keys;
-  page_t *new_leaf, *old_leaf;
-  int ret = 1, flag = 0;
-  pagenum_t new_leaf_num;
-  int32_t new_leaf_idx;
-
+// Moves the upper part of a full slotted leaf and the new record, wherever
+// it falls, to new_leaf and rebuilds leaf from the lower part.
+template <typename S>
+void slotted_split(page_t* leaf, page_t* new_leaf, pagenum_t new_leaf_num,
+                   uint32_t index, int64_t key, const struct iovec* iov,
+                   int iovcnt, uint16_t val_size) {
+  uint32_t totalspace = 0, split = 0, num_keys = leaf->info.num_keys,
+           target = INITIAL_FREE / 2;
+  S *slot = leaf_slots<S>(leaf), *new_slot = leaf_slots<S>(new_leaf),
+    *old_slot;
+  page_t* old_leaf;
+  int flag = 0;
+
+  // Appending to the rightmost leaf splits 90/10 so sequential ingest
+  // leaves full pages behind.
+  if (!leaf->Rsibling && index == num_keys) target = INITIAL_FREE * 9 / 10;
   for (split = 0; split < leaf->info.num_keys; split++) {
     if (split == index) {
-      totalspace += 16 + val_size;
+      totalspace += sizeof(S) + value_bytes(val_size);
       flag = 1;
-      if (totalspace >= INITIAL_FREE / 2) {
+      if (totalspace >= target) {
         flag = 0;
         break;
       }
     }
-    totalspace += 16 + leaf->leafbody.slot[split].size;
-    if (totalspace >= INITIAL_FREE / 2) {
+    totalspace += sizeof(S) + value_bytes(slot[split].size);
+    if (totalspace >= target) {
       break;
     }
   }
-  new_leaf_num = buffer_alloc_page(table_id);
-  new_leaf = buffer_read_page(table_id, new_leaf_num, &new_leaf_idx, WRITE);
-
-  new_leaf->parent_num = leaf->parent_num;
-  new_leaf->info.isLeaf = leaf->info.isLeaf;
-  new_leaf->info.num_keys = 0;
-  new_leaf->freespace = INITIAL_FREE;
-  new_leaf->Rsibling = leaf->Rsibling;
-
   old_leaf = (page_t*)malloc(sizeof(page_t));
-  old_leaf->parent_num = leaf->parent_num;
   old_leaf->info.isLeaf = leaf->info.isLeaf;
   old_leaf->info.num_keys = 0;
   old_leaf->freespace = INITIAL_FREE;
   old_leaf->Rsibling = new_leaf_num;
+  old_slot = leaf_slots<S>(old_leaf);
 
   if (!flag) {
     uint32_t i = split, j = 0;
     for (i = split, j = 0; i < num_keys; i++, j++) {
       if (i == index) {
-        new_leaf->leafbody.slot[j].key = key;
-        new_leaf->leafbody.slot[j].trx_id = 0;
+        new_slot[j].key = key;
+        new_slot[j].trx_id = 0;
 
         if (j == 0)
-          new_leaf->leafbody.slot[j].offset = PGSIZE - val_size;
+          new_slot[j].offset = PGSIZE - value_bytes(val_size);
         else
-          new_leaf->leafbody.slot[j].offset =
-              new_leaf->leafbody.slot[j - 1].offset - val_size;
+          new_slot[j].offset =
+              new_slot[j - 1].offset - value_bytes(val_size);
 
-        new_leaf->leafbody.slot[j].size = val_size;
-        valueCopy(value, new_leaf, val_size, new_leaf->leafbody.slot[j].offset);
-        new_leaf->freespace -= 16 + val_size;
+        new_slot[j].size = val_size;
+        iov_gather(iov, iovcnt,
+            new_leaf->leafbody.value + new_slot[j].offset - 128);
+        new_leaf->freespace -= sizeof(S) + value_bytes(val_size);
         new_leaf->info.num_keys++;
         j++;
       }
-      new_leaf->leafbody.slot[j].key = leaf->leafbody.slot[i].key;
+      new_slot[j].key = slot[i].key;
 
       if (j == 0)
-        new_leaf->leafbody.slot[j].offset =
-            PGSIZE - leaf->leafbody.slot[i].size;
+        new_slot[j].offset =
+            PGSIZE - value_bytes(slot[i].size);
       else
-        new_leaf->leafbody.slot[j].offset =
-            new_leaf->leafbody.slot[j - 1].offset - leaf->leafbody.slot[i].size;
-      new_leaf->leafbody.slot[j].trx_id = leaf->leafbody.slot[i].trx_id;
-      new_leaf->leafbody.slot[j].size = leaf->leafbody.slot[i].size;
-      for (int k = 0; k < leaf->leafbody.slot[i].size; k++) {
-        new_leaf->leafbody.value[new_leaf->leafbody.slot[j].offset - 128 + k] =
-            leaf->leafbody.value[leaf->leafbody.slot[i].offset - 128 + k];
+        new_slot[j].offset =
+            new_slot[j - 1].offset -
+            value_bytes(slot[i].size);
+      new_slot[j].trx_id = slot[i].trx_id;
+      new_slot[j].size = slot[i].size;
+      for (int k = 0; k < value_bytes(slot[i].size); k++) {
+        new_leaf->leafbody.value[new_slot[j].offset - 128 + k] =
+            leaf->leafbody.value[slot[i].offset - 128 + k];
       }
-      new_leaf->freespace -= 16 + leaf->leafbody.slot[i].size;
+      new_leaf->freespace -= sizeof(S) + value_bytes(slot[i].size);
       new_leaf->info.num_keys++;
     }
     if (index == num_keys) {
-      new_leaf->leafbody.slot[j].key = key;
-      new_leaf->leafbody.slot[j].trx_id = 0;
+      new_slot[j].key = key;
+      new_slot[j].trx_id = 0;
       if (j == 0)
-        new_leaf->leafbody.slot[j].offset = PGSIZE - val_size;
+        new_slot[j].offset = PGSIZE - value_bytes(val_size);
       else
-        new_leaf->leafbody.slot[j].offset =
-            new_leaf->leafbody.slot[j - 1].offset - val_size;
+        new_slot[j].offset =
+            new_slot[j - 1].offset - value_bytes(val_size);
 
-      new_leaf->leafbody.slot[j].size = val_size;
-      valueCopy(value, new_leaf, val_size, new_leaf->leafbody.slot[j].offset);
-      new_leaf->freespace -= 16 + val_size;
+      new_slot[j].size = val_size;
+      iov_gather(iov, iovcnt,
+          new_leaf->leafbody.value + new_slot[j].offset - 128);
+      new_leaf->freespace -= sizeof(S) + value_bytes(val_size);
       new_leaf->info.num_keys++;
     }
     for (i = 0; i < split; i++) {
-      old_leaf->leafbody.slot[i].key = leaf->leafbody.slot[i].key;
-      old_leaf->leafbody.slot[i].size = leaf->leafbody.slot[i].size;
-      old_leaf->leafbody.slot[i].trx_id = leaf->leafbody.slot[i].trx_id;
+      old_slot[i].key = slot[i].key;
+      old_slot[i].size = slot[i].size;
+      old_slot[i].trx_id = slot[i].trx_id;
 
       if (i == 0)
-        old_leaf->leafbody.slot[i].offset =
-            PGSIZE - old_leaf->leafbody.slot[i].size;
+        old_slot[i].offset =
+            PGSIZE - value_bytes(old_slot[i].size);
       else
-        old_leaf->leafbody.slot[i].offset =
-            old_leaf->leafbody.slot[i - 1].offset -
-            old_leaf->leafbody.slot[i].size;
+        old_slot[i].offset =
+            old_slot[i - 1].offset -
+            value_bytes(old_slot[i].size);
 
-      for (int j = 0; j < leaf->leafbody.slot[i].size; j++) {
-        old_leaf->leafbody.value[old_leaf->leafbody.slot[i].offset - 128 + j] =
-            leaf->leafbody.value[leaf->leafbody.slot[i].offset - 128 + j];
+      for (int j = 0; j < value_bytes(slot[i].size); j++) {
+        old_leaf->leafbody.value[old_slot[i].offset - 128 + j] =
+            leaf->leafbody.value[slot[i].offset - 128 + j];
       }
-      old_leaf->freespace -= old_leaf->leafbody.slot[i].size + 16;
+      old_leaf->freespace -= value_bytes(old_slot[i].size) + sizeof(S);
       old_leaf->info.num_keys++;
     }
   } else {
     for (uint32_t i = split, j = 0; i < num_keys; i++, j++) {
-      new_leaf->leafbody.slot[j].key = leaf->leafbody.slot[i].key;
-      new_leaf->leafbody.slot[j].trx_id = leaf->leafbody.slot[i].trx_id;
+      new_slot[j].key = slot[i].key;
+      new_slot[j].trx_id = slot[i].trx_id;
 
       if (j == 0)
-        new_leaf->leafbody.slot[j].offset =
-            PGSIZE - leaf->leafbody.slot[i].size;
+        new_slot[j].offset =
+            PGSIZE - value_bytes(slot[i].size);
       else
-        new_leaf->leafbody.slot[j].offset =
-            new_leaf->leafbody.slot[j - 1].offset - leaf->leafbody.slot[i].size;
-
-      new_leaf->leafbody.slot[j].size = leaf->leafbody.slot[i].size;
-      for (int k = 0; k < leaf->leafbody.slot[i].size; k++) {
-        new_leaf->leafbody.value[new_leaf->leafbody.slot[j].offset - 128 + k] =
-            leaf->leafbody.value[leaf->leafbody.slot[i].offset - 128 + k];
+        new_slot[j].offset =
+            new_slot[j - 1].offset -
+            value_bytes(slot[i].size);
+
+      new_slot[j].size = slot[i].size;
+      for (int k = 0; k < value_bytes(slot[i].size); k++) {
+        new_leaf->leafbody.value[new_slot[j].offset - 128 + k] =
+            leaf->leafbody.value[slot[i].offset - 128 + k];
       }
-      new_leaf->freespace -= 16 + leaf->leafbody.slot[i].size;
+      new_leaf->freespace -= sizeof(S) + value_bytes(slot[i].size);
       new_leaf->info.num_keys++;
     }
     for (uint32_t i = 0, j = 0; i < split; i++, j++) {
       if (i == index) {
-        old_leaf->leafbody.slot[j].key = key;
-        old_leaf->leafbody.slot[j].size = val_size;
-        old_leaf->leafbody.slot[j].trx_id = 0;
+        old_slot[j].key = key;
+        old_slot[j].size = val_size;
+        old_slot[j].trx_id = 0;
 
         if (j == 0)
-          old_leaf->leafbody.slot[j].offset = PGSIZE - val_size;
+          old_slot[j].offset = PGSIZE - value_bytes(val_size);
         else
-          old_leaf->leafbody.slot[j].offset =
-              old_leaf->leafbody.slot[j - 1].offset - val_size;
+          old_slot[j].offset =
+              old_slot[j - 1].offset - value_bytes(val_size);
 
-        valueCopy(value, old_leaf, val_size, old_leaf->leafbody.slot[j].offset);
-        old_leaf->freespace -= val_size + 16;
+        iov_gather(iov, iovcnt,
+            old_leaf->leafbody.value + old_slot[j].offset - 128);
+        old_leaf->freespace -= value_bytes(val_size) + sizeof(S);
         old_leaf->info.num_keys++;
         j++;
       }
-      old_leaf->leafbody.slot[j].key = leaf->leafbody.slot[i].key;
-      old_leaf->leafbody.slot[j].size = leaf->leafbody.slot[i].size;
-      old_leaf->leafbody.slot[j].trx_id = leaf->leafbody.slot[i].trx_id;
+      old_slot[j].key = slot[i].key;
+      old_slot[j].size = slot[i].size;
+      old_slot[j].trx_id = slot[i].trx_id;
 
       if (j == 0)
-        old_leaf->leafbody.slot[j].offset =
-            PGSIZE - old_leaf->leafbody.slot[j].size;
+        old_slot[j].offset =
+            PGSIZE - value_bytes(old_slot[j].size);
       else
-        old_leaf->leafbody.slot[j].offset =
-            old_leaf->leafbody.slot[j - 1].offset -
-            old_leaf->leafbody.slot[j].size;
+        old_slot[j].offset =
+            old_slot[j - 1].offset -
+            value_bytes(old_slot[j].size);
 
-      for (int k = 0; k < old_leaf->leafbody.slot[j].size; k++) {
-        old_leaf->leafbody.value[old_leaf->leafbody.slot[j].offset - 128 + k] =
-            leaf->leafbody.value[leaf->leafbody.slot[i].offset - 128 + k];
+      for (int k = 0; k < value_bytes(old_slot[j].size); k++) {
+        old_leaf->leafbody.value[old_slot[j].offset - 128 + k] =
+            leaf->leafbody.value[slot[i].offset - 128 + k];
       }
-      old_leaf->freespace -= old_leaf->leafbody.slot[j].size + 16;
+      old_leaf->freespace -= value_bytes(old_slot[j].size) + sizeof(S);
       old_leaf->info.num_keys++;
     }
     if (index == split) {
-      old_leaf->leafbody.slot[index].key = key;
-      old_leaf->leafbody.slot[index].trx_id = 0;
+      old_slot[index].key = key;
+      old_slot[index].trx_id = 0;
 
       if (index == 0)
-        old_leaf->leafbody.slot[index].offset = PGSIZE - val_size;
+        old_slot[index].offset = PGSIZE - value_bytes(val_size);
       else
-        old_leaf->leafbody.slot[index].offset =
-            old_leaf->leafbody.slot[index - 1].offset - val_size;
+        old_slot[index].offset =
+            old_slot[index - 1].offset - value_bytes(val_size);
 
-      old_leaf->leafbody.slot[index].size = val_size;
-      valueCopy(value, old_leaf, val_size,
-                old_leaf->leafbody.slot[index].offset);
-      old_leaf->freespace -= 16 + val_size;
+      old_slot[index].size = val_size;
+      iov_gather(iov, iovcnt,
+          old_leaf->leafbody.value + old_slot[index].offset - 128);
+      old_leaf->freespace -= sizeof(S) + value_bytes(val_size);
       old_leaf->info.num_keys++;
     }
   }
 
   leaf->info.isLeaf = old_leaf->info.isLeaf;
   leaf->info.num_keys = old_leaf->info.num_keys;
-  leaf->parent_num = old_leaf->parent_num;
   leaf->Rsibling = old_leaf->Rsibling;
   for (int i = 0; i < 3968; i++)
     leaf->leafbody.value[i] = old_leaf->leafbody.value[i];
   leaf->freespace = old_leaf->freespace;
+  leaf->frag = 0;
+  leaf->high_key = new_slot[0].key;
+  leaf->bounded = 1;
+
+  free(old_leaf);
+}
+
+int insert_into_leaf_after_splitting(tree_path_t* path, uint32_t index,
+                                     int64_t key, const struct iovec* iov,
+                                     int iovcnt, uint16_t val_size) {
+  int64_t table_id = path->table_id;
+  page_t *leaf = path->stack.back().page, *new_leaf;
+  pagenum_t new_leaf_num;
+  int32_t new_leaf_idx;
+
+  if (leaf->value_size) return fixed_split(path, index, key, iov, iovcnt);
+
+  new_leaf_num = buffer_alloc_page(table_id);
+  new_leaf = buffer_read_page(table_id, new_leaf_num, &new_leaf_idx, WRITE);
+
+  new_leaf->info.isLeaf = leaf->info.isLeaf;
+  new_leaf->info.num_keys = 0;
+  new_leaf->value_size = 0;
+  new_leaf->flags = leaf->flags;
+  new_leaf->freespace = INITIAL_FREE;
+  new_leaf->frag = 0;
+  new_leaf->Rsibling = leaf->Rsibling;
+  new_leaf->high_key = leaf->high_key;
+  new_leaf->bounded = leaf->bounded;
+
+  SLOT_CALL(leaf, slotted_split, leaf, new_leaf, new_leaf_num, index, key,
+            iov, iovcnt, val_size);
+  return insert_into_parent(path, path->stack.size() - 2, new_leaf_num,
+                            new_leaf, new_leaf_idx, leaf->high_key);
+}
+
+int start_new_tree(int64_t table_id, int64_t key, const struct iovec* iov,
+                   int iovcnt, uint16_t val_size) {
+  pagenum_t new_root_num;
+  int32_t root_idx, header_idx;
+  page_t *new_root, *header;
+
+  new_root_num = buffer_alloc_page(table_id);
+  new_root = buffer_read_page(table_id, new_root_num, &root_idx, WRITE);
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  header->root_num = new_root_num;
+  new_root->value_size = header->value_size;
+  buffer_write_page(table_id, 0, header_idx, 1);
+  new_root->flags = leaf_flags(give_tree(table_id));
+
+  new_root->info.isLeaf = 1;
+  new_root->bounded = 0;
+  new_root->Rsibling = 0;
+  if (new_root->value_size) {
+    fixed_set_count(new_root, 0);
+  } else {
+    new_root->info.num_keys = 0;
+    new_root->freespace = INITIAL_FREE;
+    new_root->frag = 0;
+  }
+  leaf_insert_slot(new_root, 0, key, iov, iovcnt, val_size);
+
+  buffer_write_page(table_id, new_root_num, root_idx, 1);
+  return 0;
+}
+
+// Fixed-width leaves. Ranges of records move as slices of the three arrays,
+// src and dest may be the same page.
+void fixed_move(page_t* dest, uint32_t dest_at, page_t* src, uint32_t src_at,
+                uint32_t n) {
+  uint32_t width = fixed_leaf::key_width(src);
+
+  memmove(fixed_leaf::keys(dest) + width * dest_at,
+          fixed_leaf::keys(src) + width * src_at, width * n);
+  memmove(&fixed_leaf::trx_ids(dest)[dest_at],
+          &fixed_leaf::trx_ids(src)[src_at], sizeof(int32_t) * n);
+  memmove(fixed_leaf::value(dest, dest_at), fixed_leaf::value(src, src_at),
+          (uint32_t)src->value_size * n);
+}
+
+// freespace counts the bytes records take, as in slotted leaves, so the
+// split and merge thresholds apply to both layouts unchanged.
+void fixed_set_count(page_t* leaf, uint32_t num_keys) {
+  leaf->info.num_keys = num_keys;
+  leaf->freespace = INITIAL_FREE - num_keys * fixed_leaf::cost(leaf, 0);
+}
+
+void fixed_insert(page_t* leaf, uint32_t index, int64_t key,
+                  const struct iovec* iov, int iovcnt) {
+  fixed_move(leaf, index + 1, leaf, index, leaf->info.num_keys - index);
+  fixed_leaf::set_key(leaf, index, key);
+  fixed_leaf::set_trx_id(leaf, index, 0);
+  iov_gather(iov, iovcnt, fixed_leaf::value(leaf, index));
+  fixed_set_count(leaf, leaf->info.num_keys + 1);
+}
+
+void fixed_remove(page_t* leaf, uint32_t index) {
+  fixed_move(leaf, index, leaf, index + 1, leaf->info.num_keys - index - 1);
+  fixed_set_count(leaf, leaf->info.num_keys - 1);
+}
+
+int fixed_split(tree_path_t* path, uint32_t index, int64_t key,
+                const struct iovec* iov, int iovcnt) {
+  page_t* leaf = path->stack.back().page;
+  page_t* new_leaf;
+  pagenum_t new_leaf_num;
+  int32_t new_leaf_idx;
+  uint32_t num_keys = leaf->info.num_keys, left;
+
+  if (!leaf->Rsibling && index == num_keys)
+    left = (num_keys + 1) * 9 / 10;
+  else
+    left = (num_keys + 1) / 2;
+
+  new_leaf_num = buffer_alloc_page(path->table_id);
+  new_leaf =
+      buffer_read_page(path->table_id, new_leaf_num, &new_leaf_idx, WRITE);
+  new_leaf->info.isLeaf = 1;
+  new_leaf->value_size = leaf->value_size;
+  new_leaf->flags = leaf->flags;
+  new_leaf->Rsibling = leaf->Rsibling;
+  new_leaf->high_key = leaf->high_key;
+  new_leaf->bounded = leaf->bounded;
+
+  if (index < left) {
+    fixed_move(new_leaf, 0, leaf, left - 1, num_keys - left + 1);
+    fixed_set_count(new_leaf, num_keys - left + 1);
+    fixed_set_count(leaf, left - 1);
+    fixed_insert(leaf, index, key, iov, iovcnt);
+  } else {
+    fixed_move(new_leaf, 0, leaf, left, num_keys - left);
+    fixed_set_count(new_leaf, num_keys - left);
+    fixed_set_count(leaf, left);
+    fixed_insert(new_leaf, index - left, key, iov, iovcnt);
+  }
+
+  leaf->Rsibling = new_leaf_num;
+  leaf->high_key = fixed_leaf::key(new_leaf, 0);
+  leaf->bounded = 1;
+  return insert_into_parent(path, path->stack.size() - 2, new_leaf_num,
+                            new_leaf, new_leaf_idx, leaf->high_key);
+}
+
+// Moves records into leaf from its sibling until leaf is no longer under
+// the merge threshold, like the slotted redistribute_leaf.
+void fixed_redistribute(page_t* sibling, page_t* leaf, int my_index) {
+  uint32_t cost = fixed_leaf::cost(leaf, 0), n = 0;
+  uint64_t freespace = leaf->freespace;
+  uint32_t leaf_keys = leaf->info.num_keys, sibling_keys = sibling->info.num_keys;
+
+  while (n < sibling_keys) {
+    freespace -= cost;
+    n++;
+    if (freespace < THRESHOLD) break;
+  }
+  if (my_index == -1) {
+    fixed_move(leaf, leaf_keys, sibling, 0, n);
+    fixed_move(sibling, 0, sibling, n, sibling_keys - n);
+  } else {
+    fixed_move(leaf, n, leaf, 0, leaf_keys);
+    fixed_move(leaf, 0, sibling, sibling_keys - n, n);
+  }
+  fixed_set_count(leaf, leaf_keys + n);
+  fixed_set_count(sibling, sibling_keys - n);
+}
+
+// Overflow pages. A chain is written back to front so every page already
+// knows the next one, and only ever read or freed whole: values in
+// overflow pages are not updated in place.
+pagenum_t overflow_write(int64_t table_id, const struct iovec* iov,
+                         int iovcnt, uint16_t val_size) {
+  pagenum_t page_num, next = 0;
+  page_t* page;
+  int32_t page_idx;
+  uint32_t begin, len;
+
+  for (begin = (val_size - 1) / OVERFLOW_CHUNK * OVERFLOW_CHUNK;;
+       begin -= OVERFLOW_CHUNK) {
+    len = std::min((uint32_t)OVERFLOW_CHUNK, val_size - begin);
+    page_num = buffer_alloc_page(table_id);
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    page->info.isLeaf = 0;
+    page->info.num_keys = len;
+    page->flags = 0;
+    page->Rsibling = next;
+    iov_copy_range(iov, iovcnt, begin, len, page->leafbody.value);
+    buffer_write_page(table_id, page_num, page_idx, 1);
+    next = page_num;
+    if (!begin) break;
+  }
+  return next;
+}
+
+void overflow_read(int64_t table_id, pagenum_t page_num, char* dest,
+                   uint16_t val_size) {
+  page_t* page;
+  int32_t page_idx;
+  pagenum_t next;
+  uint32_t done, len;
+
+  for (done = 0; done < val_size; done += len) {
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    len = std::min((uint32_t)OVERFLOW_CHUNK, val_size - done);
+    memcpy(dest + done, page->leafbody.value, len);
+    next = page->Rsibling;
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    page_num = next;
+  }
+}
+
+void overflow_free(int64_t table_id, pagenum_t page_num) {
+  page_t* page;
+  int32_t page_idx;
+  pagenum_t next;
+
+  while (page_num) {
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    next = page->Rsibling;
+    buffer_free_page(table_id, page_num, page_idx);
+    page_num = next;
+  }
+}
 
-  free(old_leaf);
-  return insert_into_parent(table_id, leaf_num, leaf, leaf_idx, new_leaf_num,
-                            new_leaf, new_leaf_idx,
-                            new_leaf->leafbody.slot[0].key);
+// Copies the value of record i of a latched leaf, streaming the overflow
+// chain when the leaf only holds a reference.
+void copy_value(int64_t table_id, page_t* leaf, uint32_t i, char* dest) {
+  overflow_ref_t ref;
+  uint16_t size = leaf_size(leaf, i);
+
+  if (leaf->value_size || !is_overflow(size)) {
+    memcpy(dest, leaf_value(leaf, i), size);
+    return;
+  }
+  memcpy(&ref, leaf_value(leaf, i), sizeof(ref));
+  overflow_read(table_id, ref.first, dest, size);
 }
 
-int start_new_tree(int64_t table_id, int64_t key, char* value,
-                   uint16_t val_size) {
-  pagenum_t new_root_num;
-  int32_t root_idx, header_idx;
-  page_t *new_root, *header;
+void set_last_leaf(tree_t* tree, pagenum_t leaf_num) {
+  if (__atomic_load_n(&tree->last_leaf, __ATOMIC_RELAXED) != leaf_num)
+    __atomic_store_n(&tree->last_leaf, leaf_num, __ATOMIC_RELAXED);
+}
 
-  new_root_num = buffer_alloc_page(table_id);
-  new_root = buffer_read_page(table_id, new_root_num, &root_idx, WRITE);
+// Remembers the rightmost leaf while inserts keep landing past its last key
+// and forgets it as soon as one does not.
+void note_append(tree_t* tree, pagenum_t leaf_num, page_t* leaf,
+                 uint32_t index) {
+  if (!leaf->Rsibling && index == leaf->info.num_keys)
+    set_last_leaf(tree, leaf_num);
+  else
+    set_last_leaf(tree, 0);
+}
 
-  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
-  header->root_num = new_root_num;
-  buffer_write_page(table_id, 0, header_idx, 1);
+// The hint is only trusted after the latched page proves to still be the
+// rightmost leaf, a freed page reads back as a non-leaf.
+int append_fast_path(int64_t table_id, tree_t* tree, int64_t key,
+                     const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  page_t* leaf;
+  uint32_t num_keys;
 
-  new_root->parent_num = 0;
-  new_root->info.isLeaf = 1;
-  new_root->info.num_keys = 1;
-  new_root->freespace = INITIAL_FREE - (16 + val_size);
-  new_root->Rsibling = 0;
-  new_root->leafbody.slot[0].key = key;
-  new_root->leafbody.slot[0].offset = PGSIZE - val_size;
-  new_root->leafbody.slot[0].size = val_size;
-  new_root->leafbody.slot[0].trx_id = 0;
-  valueCopy(value, new_root, val_size, new_root->leafbody.slot[0].offset);
+  leaf_num = __atomic_load_n(&tree->last_leaf, __ATOMIC_RELAXED);
+  if (!leaf_num) return 1;
 
-  buffer_write_page(table_id, new_root_num, root_idx, 1);
-  return 0;
+  leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+  num_keys = leaf->info.num_keys;
+  if (leaf->info.isLeaf && !leaf->Rsibling && num_keys &&
+      leaf_key(leaf, num_keys - 1) < key &&
+      leaf->freespace >= leaf_cost(leaf, val_size))
+    return insert_into_leaf(table_id, num_keys, leaf_num, leaf, leaf_idx, key,
+                            iov, iovcnt, val_size);
+  buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+  return 1;
 }
 
 int db_insert(int64_t table_id, int64_t key, char* value, uint16_t val_size) {
-  int ret_num = 1;
-  pagenum_t root_num, leaf_num;
-  int32_t leaf_idx, header_idx;
-  page_t *leaf, *header;
+  struct iovec iov = {value, val_size};
 
-  if (!isValid(table_id)) return 1;
+  return db_insert_v(table_id, key, &iov, 1);
+}
 
-  header = buffer_read_page(table_id, 0, &header_idx, READ);
-  root_num = header->root_num;
-  if (!root_num) return start_new_tree(table_id, key, value, val_size);
+// A value that stays in the leaf is copied piece by piece into its slot,
+// splits included. Large values are written piece by piece into their
+// overflow chain and the leaf gets the reference.
+int db_insert_v(int64_t table_id, int64_t key, const struct iovec* iov,
+                int iovcnt) {
+  overflow_ref_t ref;
+  struct iovec ref_iov = {&ref, sizeof(ref)};
+  tree_t* tree;
+  uint16_t val_size;
+  int ret;
 
-  leaf_num = find_leaf(table_id, root_num, key);
-  leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+  if (!isValid(table_id)) return 1;
+  if (iov_total(iov, iovcnt, &val_size)) return 1;
 
+  tree = give_tree(table_id);
+  if (tree->flags & TREE_VARKEY) return 1;
+  if (tree->value_size && val_size != tree->value_size) return 1;
+  if (!key_fits(tree, key)) return 1;
+  if ((tree->value_size || !is_overflow(val_size)) && val_size > INITIAL_FREE)
+    return 1;
+  bloom_note(tree, key);
+  if (tree->value_size || !is_overflow(val_size))
+    return tree->flags & TREE_HASH
+               ? hash_insert(table_id, tree, key, iov, iovcnt, val_size)
+               : insert_record(table_id, tree, key, iov, iovcnt, val_size);
+
+  // The chain is written before the tree is touched.
+  ref.first = overflow_write(table_id, iov, iovcnt, val_size);
+  ret = tree->flags & TREE_HASH
+            ? hash_insert(table_id, tree, key, &ref_iov, 1, val_size)
+            : insert_record(table_id, tree, key, &ref_iov, 1, val_size);
+  if (ret) overflow_free(table_id, ref.first);
+
+  return ret;
+}
+
+// value is what goes into the leaf, an overflow_ref_t for large values.
+int insert_record(int64_t table_id, tree_t* tree, int64_t key,
+                  const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  tree_path_t path;
+  path_entry_t* e;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  page_t* leaf;
   uint32_t i;
-  for (i = 0; i < leaf->info.num_keys; i++) {
-    if (leaf->leafbody.slot[i].key == key) {
-      buffer_write_page(table_id, leaf_num, leaf_idx, 0);
-      return 1;
+  bool append, dirty;
+  int ret;
+
+  // Counted tables change a count on every level, so they always take the
+  // pessimistic path.
+  leaf_num = 0;
+  if (!(tree->flags & TREE_COUNTED)) {
+    if (!append_fast_path(table_id, tree, key, iov, iovcnt, val_size))
+      return 0;
+    leaf_num = find_leaf_latched(table_id, key, &leaf, &leaf_idx, nullptr,
+                                 nullptr);
+  }
+  if (leaf_num) {
+    i = leaf_lower_bound(leaf, key);
+    dirty = false;
+    if (i < leaf->info.num_keys && leaf_key(leaf, i) == key) {
+      if (!leaf_is_tombstone(leaf, i)) {
+        buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+        return 1;
+      }
+      delete_leaf(table_id, i, leaf_num, leaf, leaf_idx, key);
+      dirty = true;
     }
-    if (leaf->leafbody.slot[i].key > key) break;
+    if (leaf->freespace >= leaf_cost(leaf, val_size)) {
+      note_append(tree, leaf_num, leaf, i);
+      return insert_into_leaf(table_id, i, leaf_num, leaf, leaf_idx, key,
+                              iov, iovcnt, val_size);
+    }
+    buffer_write_page(table_id, leaf_num, leaf_idx, dirty);
   }
-  if (leaf->freespace >= 16 + val_size)
-    return insert_into_leaf(table_id, i, leaf_num, leaf, leaf_idx, key, value,
-                            val_size);
-  return insert_into_leaf_after_splitting(table_id, i, leaf_num, leaf, leaf_idx,
-                                          key, value, val_size);
-}
-
-// 삭제 시작
-int get_my_index(int64_t table_id, pagenum_t pagenum, page_t* page) {
-  page_t* parent;
-  int i;
-  int32_t parent_idx;
 
-  parent = buffer_read_page(table_id, page->parent_num, &parent_idx, READ);
-  if (parent->leftmost == pagenum) {
-    return -1;
+  // The leaf has to split, retry holding every node the split can reach.
+  path.table_id = table_id;
+  path.tree_latched = false;
+  if (descend_pessimistic(&path, key, SMO_INSERT, val_size)) {
+    ret = start_new_tree(table_id, key, iov, iovcnt, val_size);
+    release_path(&path, 0);
+    return ret;
   }
 
-  for (i = 0; i < parent->info.num_keys; i++) {
-    if (parent->branch[i].pagenum == pagenum) {
-      return i;
+  e = &path.stack.back();
+  i = leaf_lower_bound(e->page, key);
+  if (i < e->page->info.num_keys && leaf_key(e->page, i) == key) {
+    if (!leaf_is_tombstone(e->page, i)) {
+      release_path(&path, 0);
+      return 1;
     }
+    delete_leaf(table_id, i, e->page_num, e->page, e->page_idx, key);
+  }
+  if (path.counted) count_path(&path, 1);
+  if (e->page->freespace >= leaf_cost(e->page, val_size)) {
+    note_append(tree, e->page_num, e->page, i);
+    leaf_insert_slot(e->page, i, key, iov, iovcnt, val_size);
+    ret = 0;
+  } else {
+    append = !e->page->Rsibling && i == e->page->info.num_keys;
+    ret = insert_into_leaf_after_splitting(&path, i, key, iov, iovcnt,
+                                           val_size);
+    set_last_leaf(tree, append && !ret ? e->page->Rsibling : 0);
   }
-  return -2;
+  release_path(&path, 1);
+
+  return ret;
 }
 
-void compact_value(int64_t table_id, page_t* leaf, int32_t leaf_idx) {
-  page_t* tmp = (page_t*)malloc(sizeof(page_t));
+int insert_batch_pass(int64_t table_id, int64_t* keys, char** values,
+                      uint16_t* sizes, std::vector<uint32_t>& order,
+                      std::vector<uint32_t>* deferred, bool split) {
+  tree_t* tree = give_tree(table_id);
+  page_t* leaf;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  int64_t key, high_key;
+  struct iovec iov;
+  uint32_t i, j, index;
+  bool bounded, dirty, released;
+  int failed = 0;
+
+  i = 0;
+  while (i < order.size()) {
+    j = order[i];
+    leaf_num = find_leaf_latched(table_id, keys[j], &leaf, &leaf_idx,
+                                 &high_key, &bounded);
+    if (!leaf_num) {
+      if (db_insert(table_id, keys[j], values[j], sizes[j])) failed++;
+      i++;
+      continue;
+    }
 
-  for (int i = 0; i < leaf->info.num_keys; i++) {
-    tmp->leafbody.slot[i].offset =
-        (i == 0) ? PGSIZE : tmp->leafbody.slot[i - 1].offset;
-    tmp->leafbody.slot[i].offset -= leaf->leafbody.slot[i].size;
-    for (int j = 0; j < leaf->leafbody.slot[i].size; j++) {
-      tmp->leafbody.value[tmp->leafbody.slot[i].offset - 128 + j] =
-          leaf->leafbody.value[leaf->leafbody.slot[i].offset - 128 + j];
+    index = 0;
+    dirty = released = false;
+    for (; i < order.size(); i++) {
+      j = order[i];
+      key = keys[j];
+      if (bounded && key >= high_key) break;
+
+      while (index < leaf->info.num_keys && leaf_key(leaf, index) < key)
+        index++;
+      if (index < leaf->info.num_keys && leaf_key(leaf, index) == key &&
+          leaf_is_tombstone(leaf, index)) {
+        delete_leaf(table_id, index, leaf_num, leaf, leaf_idx, key);
+        dirty = true;
+      }
+      if ((index < leaf->info.num_keys && leaf_key(leaf, index) == key) ||
+          (leaf->value_size && sizes[j] != leaf->value_size) ||
+          !key_fits(tree, key)) {
+        failed++;
+        continue;
+      }
+      if (leaf->freespace < leaf_cost(leaf, sizes[j])) {
+        if (!split) {
+          deferred->push_back(j);
+          continue;
+        }
+        buffer_write_page(table_id, leaf_num, leaf_idx, dirty);
+        if (db_insert(table_id, key, values[j], sizes[j])) failed++;
+        released = true;
+        i++;
+        break;
+      }
+      iov.iov_base = values[j];
+      iov.iov_len = sizes[j];
+      leaf_insert_slot(leaf, index, key, &iov, 1, sizes[j]);
+      dirty = true;
+      index++;
     }
+    if (!released) buffer_write_page(table_id, leaf_num, leaf_idx, dirty);
+  }
+
+  return failed;
+}
+
+int db_insert_batch(int64_t table_id, int64_t* keys, char** values,
+                    uint16_t* sizes, int n) {
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> deferred;
+  tree_t* tree;
+  int failed = 0;
+
+  if (!isValid(table_id)) return n;
+  tree = give_tree(table_id);
+  if (tree->flags & TREE_VARKEY) return n;
+  if (tree->flags & TREE_HASH) {
+    for (int i = 0; i < n; i++)
+      failed += db_insert(table_id, keys[i], values[i], sizes[i]) != 0;
+    return failed;
+  }
+  for (int i = 0; i < n; i++) bloom_note(tree, keys[i]);
+
+  // Large values need their overflow chain written first, they go one by one.
+  for (int i = 0; i < n; i++) {
+    if (!tree->value_size && is_overflow(sizes[i]))
+      failed += db_insert(table_id, keys[i], values[i], sizes[i]) != 0;
+    else
+      order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+  if (tree->flags & TREE_COUNTED) {
+    for (uint32_t i : order)
+      if (db_insert(table_id, keys[i], values[i], sizes[i])) failed++;
+    return failed;
   }
-  for (int i = 0; i < leaf->info.num_keys; i++) {
-    leaf->leafbody.slot[i].offset = tmp->leafbody.slot[i].offset;
+
+  failed += insert_batch_pass(table_id, keys, values, sizes, order, &deferred,
+                             false);
+  if (!deferred.empty())
+    failed += insert_batch_pass(table_id, keys, values, sizes, deferred,
+                                nullptr, true);
+
+  return failed;
+}
+
+// 삭제 시작
+// Slides the values of a slotted leaf against the end of the page, highest
+// first so none is overwritten before it moves, and the bytes deletes left
+// between them join the gap below.
+template <typename S>
+void slotted_compact(page_t* leaf) {
+  uint16_t order[sizeof(leafbody_t) / sizeof(S)];
+  S* slot = leaf_slots<S>(leaf);
+  uint32_t num_keys = leaf->info.num_keys;
+  uint16_t end = PGSIZE, bytes;
+
+  for (uint32_t i = 0; i < num_keys; i++) order[i] = i;
+  std::sort(order, order + num_keys, [slot](uint16_t a, uint16_t b) {
+    return slot[a].offset > slot[b].offset;
+  });
+  for (uint32_t i = 0; i < num_keys; i++) {
+    bytes = value_bytes(slot[order[i]].size);
+    end -= bytes;
+    memmove((char*)leaf + end, (char*)leaf + slot[order[i]].offset, bytes);
+    slot[order[i]].offset = end;
   }
+  leaf->frag = 0;
+}
 
-  uint16_t startpoint = (16 * leaf->info.num_keys) + leaf->freespace;
-  for (uint16_t i = startpoint; i < 3968; i++)
-    leaf->leafbody.value[i] = tmp->leafbody.value[i];
+void compact_value(page_t* leaf) {
+  if (leaf->frag) SLOT_CALL(leaf, slotted_compact, leaf);
+}
 
-  free(tmp);
+// The value stays where it is until an insert needs the room, unless it
+// borders the gap and simply becomes part of it.
+template <typename S>
+void slotted_remove(page_t* leaf, uint32_t index) {
+  S* slot = leaf_slots<S>(leaf);
+  uint16_t bytes = value_bytes(slot[index].size);
+
+  if (slot[index].offset !=
+      128 + sizeof(S) * leaf->info.num_keys + leaf->freespace - leaf->frag)
+    leaf->frag += bytes;
+  leaf->freespace += bytes + sizeof(S);
+  memmove(&slot[index], &slot[index + 1],
+          sizeof(S) * (leaf->info.num_keys - index - 1));
+  leaf->info.num_keys--;
 }
 
 void delete_leaf(int64_t table_id, uint32_t index, pagenum_t leaf_num,
                  page_t* leaf, int32_t leaf_idx, int64_t key) {
-  leaf->freespace += leaf->leafbody.slot[index].size + 16;
-  for (uint32_t i = index; i < leaf->info.num_keys - 1; i++) {
-    leaf->leafbody.slot[i].key = leaf->leafbody.slot[i + 1].key;
-    leaf->leafbody.slot[i].size = leaf->leafbody.slot[i + 1].size;
-    leaf->leafbody.slot[i].offset = leaf->leafbody.slot[i + 1].offset;
-    leaf->leafbody.slot[i].trx_id = leaf->leafbody.slot[i + 1].trx_id;
+  overflow_ref_t ref;
+
+  if (leaf->value_size) {
+    fixed_remove(leaf, index);
+    return;
   }
-  leaf->info.num_keys--;
-  compact_value(table_id, leaf, leaf_idx);
+  if (is_overflow(slotted_leaf::size(leaf, index))) {
+    memcpy(&ref, slotted_leaf::value(leaf, index), sizeof(ref));
+    overflow_free(table_id, ref.first);
+  }
+  SLOT_CALL(leaf, slotted_remove, leaf, index);
 }
 
 void delete_internal(int64_t table_id, uint32_t index, pagenum_t page_num,
                      page_t* page, int32_t page_idx, int64_t key) {
-  for (uint32_t i = index; i < page->info.num_keys - 1; i++) {
-    page->branch[i].key = page->branch[i + 1].key;
-    page->branch[i].pagenum = page->branch[i + 1].pagenum;
-  }
+  uint32_t* counts = child_counts(page);
+
+  if (counts)
+    memmove(&counts[index + 1], &counts[index + 2],
+            sizeof(uint32_t) * (page->info.num_keys - index - 1));
+  node_move(page, index, page, index + 1, page->info.num_keys - index - 1);
   page->info.num_keys--;
 }
 
-int adjust_root(int64_t table_id, pagenum_t root_num, page_t* root,
-                int32_t root_idx, int64_t key) {
+int adjust_root(tree_path_t* path, int level, int64_t key) {
+  path_entry_t* e = &path->stack[level];
+  page_t* root = e->page;
   uint32_t index;
 
   if (root->info.isLeaf) {
-    for (index = 0; index < root->info.num_keys; index++) {
-      if (root->leafbody.slot[index].key == key) break;
-    }
+    index = leaf_search(root, key);
     if (index == root->info.num_keys) {
       return 1;
     }
-    delete_leaf(table_id, index, root_num, root, root_idx, key);
+    delete_leaf(path->table_id, index, e->page_num, root, e->page_idx, key);
   } else {
     for (index = 0; index < root->info.num_keys; index++) {
-      if (root->branch[index].key == key) break;
+      if (node_key(root, index) == key) break;
     }
     if (index == root->info.num_keys) {
       return 1;
     }
-    delete_internal(table_id, index, root_num, root, root_idx, key);
+    delete_internal(path->table_id, index, e->page_num, root, e->page_idx,
+                    key);
   }
 
   if (!root->info.num_keys) {
-    page_t *header, *new_root;
-    int header_idx, new_root_idx;
-
-    header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+    page_t* header;
+    int header_idx;
 
-    if (root->info.isLeaf) {
-      header->root_num = 0;
-    } else {
-      header->root_num = root->leftmost;
+    // The header latch is taken last: buffer_alloc_page holds it while
+    // waiting for the buffer pool.
+    header = buffer_read_page(path->table_id, 0, &header_idx, WRITE);
+    header->root_num = root->info.isLeaf ? 0 : root->leftmost;
+    buffer_write_page(path->table_id, 0, header_idx, 1);
 
-      new_root =
-          buffer_read_page(table_id, root->leftmost, &new_root_idx, WRITE);
-      new_root->parent_num = 0;
-      buffer_write_page(table_id, root->leftmost, new_root_idx, 1);
-    }
-    buffer_write_page(table_id, 0, header_idx, 1);
-    buffer_free_page(table_id, root_num, root_idx);
-  } else {
-    buffer_write_page(table_id, root_num, root_idx, 1);
+    buffer_free_page(path->table_id, e->page_num, e->page_idx);
+    e->page = nullptr;
   }
 
   return 0;
 }
 
-int coalesce_leaf(int64_t table_id, int my_index, pagenum_t parent_num,
-                  page_t* parent, int32_t parent_idx, pagenum_t sibling_num,
-                  page_t* sibling, int32_t sibling_idx, pagenum_t leaf_num,
-                  page_t* leaf, int32_t leaf_idx) {
-  int k_prime_index;
+template <typename S>
+void slotted_coalesce(page_t* sibling, page_t* leaf) {
+  S *slot = leaf_slots<S>(leaf), *sib_slot = leaf_slots<S>(sibling);
   uint16_t siboff, leafoff;
+
+  compact_value(sibling);
   for (uint32_t i = sibling->info.num_keys, j = 0; j < leaf->info.num_keys;
        i++, j++) {
     sibling->info.num_keys++;
-    sibling->freespace -= 16 + leaf->leafbody.slot[j].size;
+    sibling->freespace -= sizeof(S) + value_bytes(slot[j].size);
 
-    sibling->leafbody.slot[i].key = leaf->leafbody.slot[j].key;
-    sibling->leafbody.slot[i].size = leaf->leafbody.slot[j].size;
-    sibling->leafbody.slot[i].trx_id = leaf->leafbody.slot[j].trx_id;
-    sibling->leafbody.slot[i].offset =
-        128 + (16 * sibling->info.num_keys) + sibling->freespace;
+    sib_slot[i].key = slot[j].key;
+    sib_slot[i].size = slot[j].size;
+    sib_slot[i].trx_id = slot[j].trx_id;
+    sib_slot[i].offset =
+        128 + (sizeof(S) * sibling->info.num_keys) + sibling->freespace;
 
-    siboff = sibling->leafbody.slot[i].offset - 128;
-    leafoff = leaf->leafbody.slot[j].offset - 128;
-    for (uint16_t k = 0; k < sibling->leafbody.slot[i].size; k++)
+    siboff = sib_slot[i].offset - 128;
+    leafoff = slot[j].offset - 128;
+    for (uint16_t k = 0; k < value_bytes(sib_slot[i].size); k++)
       sibling->leafbody.value[siboff + k] = leaf->leafbody.value[leafoff + k];
   }
+}
+
+void coalesce_leaf(int64_t table_id, page_t* sibling, pagenum_t leaf_num,
+                   page_t* leaf, int32_t leaf_idx) {
+  if (leaf->value_size) {
+    fixed_move(sibling, sibling->info.num_keys, leaf, 0, leaf->info.num_keys);
+    fixed_set_count(sibling, sibling->info.num_keys + leaf->info.num_keys);
+  } else {
+    SLOT_CALL(leaf, slotted_coalesce, sibling, leaf);
+  }
   sibling->Rsibling = leaf->Rsibling;
+  sibling->high_key = leaf->high_key;
+  sibling->bounded = leaf->bounded;
   buffer_free_page(table_id, leaf_num, leaf_idx);
-
-  buffer_write_page(table_id, sibling_num, sibling_idx, 1);
-
-  k_prime_index = (my_index == -1) ? 0 : my_index;
-  return delete_entry(table_id, parent_num, parent, parent_idx,
-                      parent->branch[k_prime_index].key);
 }
 
-int redistribute_leaf(int64_t table_id, pagenum_t parent_num, page_t* parent,
-                      int32_t parent_idx, pagenum_t sibling_num,
-                      page_t* sibling, int32_t sibling_idx, pagenum_t leaf_num,
-                      page_t* leaf, int32_t leaf_idx, int my_index) {
+// Like fixed_redistribute: leaf takes the first records of its right
+// sibling when my_index is -1, the last ones of its left sibling otherwise.
+template <typename S>
+void slotted_redistribute(page_t* sibling, page_t* leaf, int my_index) {
+  S *slot = leaf_slots<S>(leaf), *sib_slot = leaf_slots<S>(sibling);
+
   if (my_index == -1) {
     uint32_t num_keys;
     uint16_t leafoff, siboff;
     uint64_t tmp_freespace = leaf->freespace, movenums = 0;
 
+    compact_value(leaf);
     for (uint32_t i = 0; i < sibling->info.num_keys; i++) {
-      tmp_freespace -= sibling->leafbody.slot[i].size;
+      tmp_freespace -= sizeof(S) + value_bytes(sib_slot[i].size);
       movenums++;
       if (tmp_freespace < THRESHOLD) break;
     }
     num_keys = leaf->info.num_keys;
     for (uint32_t i = num_keys, j = 0; j < movenums; i++, j++) {
-      leaf->freespace -= 16 + sibling->leafbody.slot[j].size;
-      sibling->freespace += 16 + sibling->leafbody.slot[j].size;
+      leaf->freespace -= sizeof(S) + value_bytes(sib_slot[j].size);
+      sibling->freespace += sizeof(S) + value_bytes(sib_slot[j].size);
+      sibling->frag += value_bytes(sib_slot[j].size);
       leaf->info.num_keys++;
       sibling->info.num_keys--;
 
-      leaf->leafbody.slot[i].key = sibling->leafbody.slot[j].key;
-      leaf->leafbody.slot[i].size = sibling->leafbody.slot[j].size;
-      leaf->leafbody.slot[i].trx_id = sibling->leafbody.slot[j].trx_id;
-      leaf->leafbody.slot[i].offset =
-          128 + (16 * leaf->info.num_keys) + leaf->freespace;
+      slot[i].key = sib_slot[j].key;
+      slot[i].size = sib_slot[j].size;
+      slot[i].trx_id = sib_slot[j].trx_id;
+      slot[i].offset =
+          128 + (sizeof(S) * leaf->info.num_keys) + leaf->freespace;
 
-      siboff = sibling->leafbody.slot[j].offset - 128;
-      leafoff = leaf->leafbody.slot[i].offset - 128;
-      for (int k = 0; k < sibling->leafbody.slot[j].size; k++)
+      siboff = sib_slot[j].offset - 128;
+      leafoff = slot[i].offset - 128;
+      for (int k = 0; k < value_bytes(sib_slot[j].size); k++)
         leaf->leafbody.value[leafoff + k] = sibling->leafbody.value[siboff + k];
     }
-    for (int i = movenums; i < movenums + sibling->info.num_keys; i++) {
-      sibling->leafbody.slot[i - movenums].key = sibling->leafbody.slot[i].key;
-      sibling->leafbody.slot[i - movenums].size =
-          sibling->leafbody.slot[i].size;
-      sibling->leafbody.slot[i - movenums].offset =
-          sibling->leafbody.slot[i].offset;
-      sibling->leafbody.slot[i - movenums].trx_id =
-          sibling->leafbody.slot[i].trx_id;
+    for (uint64_t i = movenums; i < movenums + sibling->info.num_keys; i++) {
+      sib_slot[i - movenums].key = sib_slot[i].key;
+      sib_slot[i - movenums].size = sib_slot[i].size;
+      sib_slot[i - movenums].offset = sib_slot[i].offset;
+      sib_slot[i - movenums].trx_id = sib_slot[i].trx_id;
     }
-    compact_value(table_id, sibling, sibling_idx);
-    parent->branch[0].key = sibling->leafbody.slot[0].key;
   } else {
     uint32_t i = sibling->info.num_keys - 1, movenums = 0;
     uint64_t tmp_freespace = leaf->freespace;
     uint16_t leafoff, siboff;
 
+    compact_value(leaf);
     for (i = sibling->info.num_keys - 1;; i--) {
-      tmp_freespace -= sibling->leafbody.slot[i].size;
+      tmp_freespace -= sizeof(S) + value_bytes(sib_slot[i].size);
       movenums++;
       if (tmp_freespace < THRESHOLD) break;
 
       if (i == 0) break;
     }
 
-    for (uint32_t l = leaf->info.num_keys - 1;; l--) {
-      leaf->leafbody.slot[l + movenums].key = leaf->leafbody.slot[l].key;
-      leaf->leafbody.slot[l + movenums].size = leaf->leafbody.slot[l].size;
-      leaf->leafbody.slot[l + movenums].offset = leaf->leafbody.slot[l].offset;
-      leaf->leafbody.slot[l + movenums].trx_id = leaf->leafbody.slot[l].trx_id;
-
-      if (l == 0) break;
+    for (uint32_t l = leaf->info.num_keys; l-- > 0;) {
+      slot[l + movenums].key = slot[l].key;
+      slot[l + movenums].size = slot[l].size;
+      slot[l + movenums].offset = slot[l].offset;
+      slot[l + movenums].trx_id = slot[l].trx_id;
     }
 
     for (uint32_t l = 0, s = i; l < movenums; l++, s++) {
-      leaf->freespace -= 16 + sibling->leafbody.slot[s].size;
-      sibling->freespace += 16 + sibling->leafbody.slot[s].size;
+      leaf->freespace -= sizeof(S) + value_bytes(sib_slot[s].size);
+      sibling->freespace += sizeof(S) + value_bytes(sib_slot[s].size);
+      sibling->frag += value_bytes(sib_slot[s].size);
       leaf->info.num_keys++;
       sibling->info.num_keys--;
 
-      leaf->leafbody.slot[l].key = sibling->leafbody.slot[s].key;
-      leaf->leafbody.slot[l].size = sibling->leafbody.slot[s].size;
-      leaf->leafbody.slot[l].trx_id = sibling->leafbody.slot[s].trx_id;
-      leaf->leafbody.slot[l].offset =
-          128 + (16 * leaf->info.num_keys) + leaf->freespace;
+      slot[l].key = sib_slot[s].key;
+      slot[l].size = sib_slot[s].size;
+      slot[l].trx_id = sib_slot[s].trx_id;
+      slot[l].offset =
+          128 + (sizeof(S) * leaf->info.num_keys) + leaf->freespace;
 
-      leafoff = leaf->leafbody.slot[l].offset - 128;
-      siboff = sibling->leafbody.slot[s].offset - 128;
-      for (int j = 0; j < leaf->leafbody.slot[l].size; j++) {
+      leafoff = slot[l].offset - 128;
+      siboff = sib_slot[s].offset - 128;
+      for (int j = 0; j < value_bytes(slot[l].size); j++) {
         leaf->leafbody.value[leafoff + j] = sibling->leafbody.value[siboff + j];
       }
     }
-    compact_value(table_id, sibling, sibling_idx);
-    parent->branch[my_index].key = leaf->leafbody.slot[0].key;
   }
+}
 
-  buffer_write_page(table_id, parent_num, parent_idx, 1);
-  buffer_write_page(table_id, leaf_num, leaf_idx, 1);
-  buffer_write_page(table_id, sibling_num, sibling_idx, 1);
+void redistribute_leaf(int64_t table_id, page_t* parent, page_t* sibling,
+                       int32_t sibling_idx, page_t* leaf, int my_index) {
+  if (leaf->value_size)
+    fixed_redistribute(sibling, leaf, my_index);
+  else
+    SLOT_CALL(leaf, slotted_redistribute, sibling, leaf, my_index);
+  if (my_index == -1)
+    node_set_key(parent, 0, leaf->high_key = leaf_key(sibling, 0));
+  else
+    node_set_key(parent, my_index, sibling->high_key = leaf_key(leaf, 0));
 
-  return 0;
+  uint32_t* counts = child_counts(parent);
+  if (counts) {
+    if (my_index == -1) {
+      counts[0] = leaf->info.num_keys;
+      counts[1] = sibling->info.num_keys;
+    } else {
+      counts[my_index] = sibling->info.num_keys;
+      counts[my_index + 1] = leaf->info.num_keys;
+    }
+  }
 }
 
-int coalesce_internal(int64_t table_id, int my_index, pagenum_t parent_num,
-                      page_t* parent, int32_t parent_idx, pagenum_t sibling_num,
-                      page_t* sibling, int32_t sibling_idx, pagenum_t page_num,
-                      page_t* page, int32_t page_idx) {
+void coalesce_internal(int64_t table_id, int my_index, page_t* parent,
+                       page_t* sibling, pagenum_t page_num, page_t* page,
+                       int32_t page_idx) {
+  uint32_t* counts = child_counts(sibling);
   int64_t k_prime;
-  page_t* child;
-  int32_t child_idx;
 
   if (my_index == -1)
-    k_prime = parent->branch[0].key;
+    k_prime = node_key(parent, 0);
   else
-    k_prime = parent->branch[my_index].key;
-
-  sibling->branch[sibling->info.num_keys].key = k_prime;
-  sibling->branch[sibling->info.num_keys].pagenum = page->leftmost;
-  sibling->info.num_keys++;
+    k_prime = node_key(parent, my_index);
 
-  child = buffer_read_page(table_id, page->leftmost, &child_idx, WRITE);
-  child->parent_num = sibling_num;
-  buffer_write_page(table_id, page->leftmost, child_idx, 1);
+  if (counts)
+    memcpy(&counts[sibling->info.num_keys + 1], child_counts(page),
+           sizeof(uint32_t) * (page->info.num_keys + 1));
 
-  int i = sibling->info.num_keys;
-  int num_keys = page->info.num_keys;
-  for (int j = 0; j < num_keys; j++, i++) {
-    sibling->branch[i].key = page->branch[j].key;
-    sibling->branch[i].pagenum = page->branch[j].pagenum;
-    sibling->info.num_keys++;
+  node_set_key(sibling, sibling->info.num_keys, k_prime);
+  node_child(sibling, sibling->info.num_keys) = page->leftmost;
+  sibling->info.num_keys++;
 
-    child = buffer_read_page(table_id, sibling->branch[i].pagenum, &child_idx,
-                             WRITE);
-    child->parent_num = sibling_num;
-    buffer_write_page(table_id, sibling->branch[i].pagenum, child_idx, 1);
-  }
+  node_move(sibling, sibling->info.num_keys, page, 0, page->info.num_keys);
+  sibling->info.num_keys += page->info.num_keys;
+  sibling->high_key = page->high_key;
+  sibling->bounded = page->bounded;
+  sibling->right_num = page->right_num;
 
   buffer_free_page(table_id, page_num, page_idx);
-  buffer_write_page(table_id, sibling_num, sibling_idx, 1);
-
-  return delete_entry(table_id, parent_num, parent, parent_idx, k_prime);
 }
 
-int redistribute_internal(int64_t table_id, pagenum_t parent_num,
-                          page_t* parent, int32_t parent_idx,
-                          pagenum_t sibling_num, page_t* sibling,
-                          int32_t sibling_idx, pagenum_t page_num, page_t* page,
-                          int32_t page_idx, int my_index) {
-  page_t* child;
-  int32_t child_idx;
+void redistribute_internal(page_t* parent, page_t* sibling, page_t* page,
+                           int my_index) {
+  uint32_t *counts = child_counts(page), *sib_counts = child_counts(sibling),
+           moved;
 
   if (my_index == -1) {
-    page->branch[page->info.num_keys].key = parent->branch[0].key;
-    page->branch[page->info.num_keys].pagenum = sibling->leftmost;
-
-    child = buffer_read_page(table_id, sibling->leftmost, &child_idx, WRITE);
-    child->parent_num = page_num;
-    buffer_write_page(table_id, sibling->leftmost, child_idx, 1);
-
-    parent->branch[0].key = sibling->branch[0].key;
-    sibling->leftmost = sibling->branch[0].pagenum;
-    for (int i = 0; i < sibling->info.num_keys - 1; i++) {
-      sibling->branch[i].key = sibling->branch[i + 1].key;
-      sibling->branch[i].pagenum = sibling->branch[i + 1].pagenum;
+    if (counts) {
+      moved = counts[page->info.num_keys + 1] = sib_counts[0];
+      memmove(sib_counts, &sib_counts[1],
+              sizeof(uint32_t) * sibling->info.num_keys);
+      child_counts(parent)[0] += moved;
+      child_counts(parent)[1] -= moved;
     }
+    node_set_key(page, page->info.num_keys, node_key(parent, 0));
+    node_child(page, page->info.num_keys) = sibling->leftmost;
+
+    node_set_key(parent, 0, page->high_key = node_key(sibling, 0));
+    sibling->leftmost = node_child(sibling, 0);
+    node_move(sibling, 0, sibling, 1, sibling->info.num_keys - 1);
     page->info.num_keys++;
     sibling->info.num_keys--;
   } else {
-    for (uint32_t i = page->info.num_keys; i > 0; i--) {
-      page->branch[i].key = page->branch[i - 1].key;
-      page->branch[i].pagenum = page->branch[i - 1].pagenum;
-
-      if (i == 1) break;
+    if (counts) {
+      memmove(&counts[1], counts, sizeof(uint32_t) * (page->info.num_keys + 1));
+      moved = counts[0] = sib_counts[sibling->info.num_keys];
+      child_counts(parent)[my_index] -= moved;
+      child_counts(parent)[my_index + 1] += moved;
     }
-    page->branch[0].key = parent->branch[my_index].key;
-    page->branch[0].pagenum = page->leftmost;
-    page->leftmost = sibling->branch[sibling->info.num_keys - 1].pagenum;
-
-    child =
-        buffer_read_page(table_id, page->branch[0].pagenum, &child_idx, WRITE);
-    child->parent_num = page_num;
-    buffer_write_page(table_id, page->branch[0].pagenum, child_idx, 1);
-
-    child = buffer_read_page(table_id, page->leftmost, &child_idx, WRITE);
-    child->parent_num = page_num;
-    buffer_write_page(table_id, page->leftmost, child_idx, 1);
-
-    parent->branch[my_index].key =
-        sibling->branch[sibling->info.num_keys - 1].key;
+    node_move(page, 1, page, 0, page->info.num_keys);
+    node_set_key(page, 0, node_key(parent, my_index));
+    node_child(page, 0) = page->leftmost;
+    page->leftmost = node_child(sibling, sibling->info.num_keys - 1);
+
+    node_set_key(parent, my_index,
+                 sibling->high_key =
+                     node_key(sibling, sibling->info.num_keys - 1));
     page->info.num_keys++;
     sibling->info.num_keys--;
   }
+}
 
-  buffer_write_page(table_id, sibling_num, sibling_idx, 1);
-  buffer_write_page(table_id, page_num, page_idx, 1);
-  buffer_write_page(table_id, parent_num, parent_idx, 1);
+// Works on the entry at level of the path. Its parent and the sibling it
+// may merge with were latched by descend_pessimistic whenever the node was
+// not safe, which is exactly when they are needed here.
+// Merges an underfull leaf with the sibling latched by the descent, or
+// moves records over from it, when the merge policy allows it now. In
+// background mode the leaf is queued instead, and the merge thread comes
+// back with deferred set.
+int merge_leaf(tree_path_t* path, int level, int64_t key, bool deferred) {
+  path_entry_t* e = &path->stack[level];
+  page_t* parent;
+  page_t* page = e->page;
+  int k_prime_index = (e->my_index == -1) ? 0 : e->my_index;
+  uint32_t* counts;
+
+  if (e->my_index == -2) return 0;
+  if (path->merge_policy == MERGE_AT_EMPTY && !deferred
+          ? page->info.num_keys > 0
+          : page->freespace < THRESHOLD)
+    return 0;
+  if (path->merge_policy == MERGE_BACKGROUND && !deferred) {
+    merge_enqueue(path->table_id, e->page_num, key);
+    return 0;
+  }
 
+  parent = path->stack[level - 1].page;
+  if (e->sibling->freespace >= INITIAL_FREE - page->freespace) {
+    if ((counts = child_counts(parent)))
+      counts[k_prime_index] += counts[k_prime_index + 1];
+    if (e->my_index == -1) {
+      coalesce_leaf(path->table_id, page, e->sibling_num, e->sibling,
+                    e->sibling_idx);
+      e->sibling = nullptr;
+    } else {
+      coalesce_leaf(path->table_id, e->sibling, e->page_num, page,
+                    e->page_idx);
+      e->page = nullptr;
+    }
+    return delete_entry(path, level - 1, node_key(parent, k_prime_index));
+  }
+  redistribute_leaf(path->table_id, parent, e->sibling, e->sibling_idx, page,
+                    e->my_index);
   return 0;
 }
 
-int delete_entry(int64_t table_id, pagenum_t page_num, page_t* page,
-                 int32_t page_idx, int64_t key) {
-  page_t *parent, *sibling;
-  pagenum_t sibling_num;
-  int32_t sibling_idx, parent_idx;
-  ;
+int delete_entry(tree_path_t* path, int level, int64_t key) {
+  path_entry_t* e = &path->stack[level];
+  page_t* parent;
+  page_t* page = e->page;
+  int k_prime_index = (e->my_index == -1) ? 0 : e->my_index;
+  uint32_t* counts;
 
-  if (!page->parent_num)
-    return adjust_root(table_id, page_num, page, page_idx, key);
+  if (e->my_index == -2) return adjust_root(path, level, key);
 
   if (page->info.isLeaf) {
+    uint32_t index = leaf_find(page, key);
+    if (index == page->info.num_keys) return 1;
+    delete_leaf(path->table_id, index, e->page_num, page, e->page_idx, key);
+    return merge_leaf(path, level, key, false);
+  } else {
+    uint32_t min_keys = cut(node_order(page)) - 1,
+             capacity = node_order(page) - 1;
     uint32_t index = 0;
     for (index = 0; index < page->info.num_keys; index++) {
-      if (page->leafbody.slot[index].key == key) break;
+      if (node_key(page, index) == key) break;
     }
-    if (index == page->info.num_keys) {
-      buffer_write_page(table_id, page_num, page_idx, 0);
-      return 1;
+    if (index == page->info.num_keys) return 1;
+    delete_internal(path->table_id, index, e->page_num, page, e->page_idx,
+                    key);
+
+    if (page->info.num_keys >= min_keys) return 0;
+
+    parent = path->stack[level - 1].page;
+    if (e->sibling->info.num_keys + page->info.num_keys < capacity) {
+      key = node_key(parent, k_prime_index);
+      if ((counts = child_counts(parent)))
+        counts[k_prime_index] += counts[k_prime_index + 1];
+      if (e->my_index == -1) {
+        coalesce_internal(path->table_id, e->my_index, parent, page,
+                          e->sibling_num, e->sibling, e->sibling_idx);
+        e->sibling = nullptr;
+      } else {
+        coalesce_internal(path->table_id, e->my_index, parent, e->sibling,
+                          e->page_num, page, e->page_idx);
+        e->page = nullptr;
+      }
+      return delete_entry(path, level - 1, key);
     }
-    delete_leaf(table_id, index, page_num, page, page_idx, key);
+    redistribute_internal(parent, e->sibling, page, e->my_index);
+    return 0;
+  }
+  return 1;
+}
 
-    if (page->freespace < THRESHOLD) {
-      buffer_write_page(table_id, page_num, page_idx, 1);
-      return 0;
-    }
+int db_delete(int64_t table_id, int64_t key) {
+  if (delete_record(table_id, key)) return 1;
+  rowcache_invalidate(table_id, key);
+  return 0;
+}
 
-    int my_index = get_my_index(table_id, page_num, page);
-    if (my_index == -2) {
-      buffer_write_page(table_id, page_num, page_idx, 0);
-      return 1;
-    }
+int delete_record(int64_t table_id, int64_t key) {
+  tree_path_t path;
+  page_t* leaf;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  tree_t* tree;
+  uint32_t i;
+  bool is_root, underfull;
+  int ret;
 
-    parent = buffer_read_page(table_id, page->parent_num, &parent_idx, WRITE);
+  if (!isValid(table_id)) return 1;
 
-    if (my_index == -1)
-      sibling_num = parent->branch[0].pagenum;
-    else if (my_index == 0)
-      sibling_num = parent->leftmost;
-    else
-      sibling_num = parent->branch[my_index - 1].pagenum;
-
-    sibling = buffer_read_page(table_id, sibling_num, &sibling_idx, WRITE);
-
-    if (sibling->freespace >= INITIAL_FREE - page->freespace) {
-      if (my_index == -1)
-        return coalesce_leaf(table_id, my_index, page->parent_num, parent,
-                             parent_idx, page_num, page, page_idx, sibling_num,
-                             sibling, sibling_idx);
-      return coalesce_leaf(table_id, my_index, page->parent_num, parent,
-                           parent_idx, sibling_num, sibling, sibling_idx,
-                           page_num, page, page_idx);
+  tree = give_tree(table_id);
+  if (tree->flags & TREE_VARKEY) return 1;
+  if (tree->flags & TREE_HASH) return hash_delete(table_id, key);
+  if (!(tree->flags & TREE_COUNTED)) {
+    leaf_num = find_leaf_latched(table_id, key, &leaf, &leaf_idx, nullptr,
+                                 nullptr);
+    if (!leaf_num) return 1;
+    i = leaf_find(leaf, key);
+    if (i == leaf->info.num_keys) {
+      buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+      return 1;
     }
-    return redistribute_leaf(table_id, page->parent_num, parent, parent_idx,
-                             sibling_num, sibling, sibling_idx, page_num, page,
-                             page_idx, my_index);
-  } else {
-    int min_keys = cut(MAX_ORDER) - 1, capacity = MAX_ORDER - 1, my_index;
-    uint32_t index = 0;
-    for (index = 0; index < page->info.num_keys; index++) {
-      if (page->branch[index].key == key) break;
+    if (tree->flags & TREE_TOMBSTONE) {
+      leaf_set_trx_id(leaf, i, TOMBSTONE_TRX);
+      buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+      purge_enqueue(table_id, key);
+      return 0;
+    }
+    // B-link readers cannot follow keys moving left or pages being freed, so
+    // B-link tables never merge and leaves are allowed to run empty.
+    is_root = leaf_num == get_root_num(table_id);
+    if ((tree->flags & TREE_BLINK) ||
+        is_safe(leaf, SMO_DELETE, key, 0, is_root, tree->merge_policy)) {
+      delete_leaf(table_id, i, leaf_num, leaf, leaf_idx, key);
+      underfull = !is_root && leaf->freespace >= THRESHOLD;
+      buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+      if (underfull && tree->merge_policy == MERGE_BACKGROUND &&
+          !(tree->flags & TREE_BLINK))
+        merge_enqueue(table_id, leaf_num, key);
+      return 0;
     }
-    if (index == page->info.num_keys) {
-      buffer_write_page(table_id, page_num, page_idx, 0);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+  }
+
+  // The leaf may underflow, retry holding every node a merge can reach.
+  path.table_id = table_id;
+  path.tree_latched = false;
+  if (descend_pessimistic(&path, key, SMO_DELETE, 0)) {
+    release_path(&path, 0);
+    return 1;
+  }
+  if (path.counted) {
+    leaf = path.stack.back().page;
+    i = leaf_search(leaf, key);
+    if (i == leaf->info.num_keys) {
+      release_path(&path, 0);
       return 1;
     }
-    delete_internal(table_id, index, page_num, page, page_idx, key);
+    count_path(&path, -1);
+  }
+  ret = delete_entry(&path, path.stack.size() - 1, key);
+  release_path(&path, !ret);
 
-    if (page->info.num_keys >= min_keys) {
-      buffer_write_page(table_id, page_num, page_idx, 1);
-      return 0;
+  return ret;
+}
+
+// Merge thread
+// Started on first use. It also purges tombstones, ahead of the merges
+// since a purge may leave a leaf to merge.
+void start_merge_worker() {
+  if (merge_running) return;
+  merge_stop = false;
+  merge_running = !pthread_create(&merge_thread, NULL, merge_worker, NULL);
+}
+
+void merge_enqueue(int64_t table_id, pagenum_t leaf_num, int64_t key) {
+  LOCK(merge_mutex);
+  start_merge_worker();
+  if (merge_running && merge_pending.insert({table_id, leaf_num}).second) {
+    merge_queue.push({table_id, leaf_num, key});
+    BROADCAST(merge_cond);
+  }
+  UNLOCK(merge_mutex);
+}
+
+void purge_enqueue(int64_t table_id, int64_t key) {
+  LOCK(merge_mutex);
+  start_merge_worker();
+  if (merge_running && purge_queue.insert({table_id, key}).second)
+    BROADCAST(merge_cond);
+  UNLOCK(merge_mutex);
+}
+
+void* merge_worker(void*) {
+  std::pair<int64_t, int64_t> purge;
+  merge_task_t task;
+
+  LOCK(merge_mutex);
+  while (true) {
+    while (merge_queue.empty() && purge_queue.empty() && !merge_stop)
+      WAIT(merge_cond, merge_mutex);
+    if (merge_stop) break;
+    merge_busy = true;
+    if (!purge_queue.empty()) {
+      purge = *purge_queue.begin();
+      purge_queue.erase(purge_queue.begin());
+      UNLOCK(merge_mutex);
+
+      purge_at(purge.first, purge.second);
+    } else {
+      task = merge_queue.front();
+      merge_queue.pop();
+      merge_pending.erase({task.table_id, task.leaf_num});
+      UNLOCK(merge_mutex);
+
+      merge_at(task.table_id, task.key);
     }
-    my_index = get_my_index(table_id, page_num, page);
-    parent = buffer_read_page(table_id, page->parent_num, &parent_idx, WRITE);
 
-    if (my_index == -1)
-      sibling_num = parent->branch[0].pagenum;
-    else if (my_index == 0)
-      sibling_num = parent->leftmost;
+    LOCK(merge_mutex);
+    merge_busy = false;
+    BROADCAST(merge_cond);
+  }
+  UNLOCK(merge_mutex);
+
+  return nullptr;
+}
+
+// The leaf holding key may have filled up or moved since it was queued,
+// it is merged only if it is still underfull once latched.
+int merge_at(int64_t table_id, int64_t key) {
+  tree_path_t path;
+  int ret;
+
+  if (give_tree(table_id)->flags & TREE_BLINK) return 0;
+
+  path.table_id = table_id;
+  path.tree_latched = false;
+  if (descend_pessimistic(&path, key, SMO_MERGE, 0)) {
+    release_path(&path, 0);
+    return 0;
+  }
+  ret = merge_leaf(&path, path.stack.size() - 1, key, true);
+  release_path(&path, 1);
+
+  return ret;
+}
+
+// Removes every tombstone of the leaf holding key under one latch, then
+// merges the leaf once if the merge policy calls for it. The keys purged
+// leave the queue before the leaf is released, a key tombstoned again
+// right after is queued anew.
+int purge_at(int64_t table_id, int64_t key) {
+  tree_t* tree = give_tree(table_id);
+  std::vector<int64_t> purged;
+  page_t* leaf;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  bool underfull;
+
+  leaf_num = find_leaf_latched(table_id, key, &leaf, &leaf_idx, nullptr,
+                               nullptr);
+  if (!leaf_num) return 0;
+  for (uint32_t i = leaf->info.num_keys; i-- > 0;) {
+    if (!leaf_is_tombstone(leaf, i)) continue;
+    purged.push_back(leaf_key(leaf, i));
+    delete_leaf(table_id, i, leaf_num, leaf, leaf_idx, purged.back());
+  }
+  if (tree->merge_policy == MERGE_AT_EMPTY)
+    underfull = !leaf->info.num_keys;
+  else
+    underfull = leaf->freespace >= THRESHOLD;
+  underfull = underfull && leaf_num != get_root_num(table_id);
+
+  LOCK(merge_mutex);
+  for (int64_t k : purged) purge_queue.erase({table_id, k});
+  UNLOCK(merge_mutex);
+  buffer_write_page(table_id, leaf_num, leaf_idx, !purged.empty());
+
+  if (underfull && !purged.empty()) return merge_at(table_id, key);
+  return 0;
+}
+
+void db_wait_merges() {
+  LOCK(merge_mutex);
+  while (merge_running &&
+         (!merge_queue.empty() || !purge_queue.empty() || merge_busy))
+    WAIT(merge_cond, merge_mutex);
+  UNLOCK(merge_mutex);
+}
+
+// Queued tombstones are purged first so they do not outlive the process.
+// Queued leaves are dropped, they are only underfull.
+void stop_merge_worker() {
+  LOCK(merge_mutex);
+  if (!merge_running) {
+    UNLOCK(merge_mutex);
+    return;
+  }
+  while (!purge_queue.empty() || merge_busy) WAIT(merge_cond, merge_mutex);
+  merge_stop = true;
+  BROADCAST(merge_cond);
+  UNLOCK(merge_mutex);
+  pthread_join(merge_thread, NULL);
+
+  LOCK(merge_mutex);
+  merge_queue = std::queue<merge_task_t>();
+  merge_pending.clear();
+  merge_running = false;
+  UNLOCK(merge_mutex);
+}
+
+// Bulk load
+void bulk_open_node(bulk_loader_t* loader, uint32_t level) {
+  bulk_level_t* lv;
+  page_t* node;
+
+  if (level == loader->levels.size()) {
+    lv = new bulk_level_t();
+    lv->batch = (page_t*)malloc(sizeof(page_t) * BULK_BATCH);
+    lv->held = (page_t*)malloc(sizeof(page_t));
+    lv->held_num = 0;
+    lv->first_num = file_extend_pages(loader->table_id, BULK_BATCH);
+    lv->cur = 0;
+    loader->levels.push_back(lv);
+  }
+  lv = loader->levels[level];
+  node = &lv->batch[lv->cur];
+  memset(node, 0x00, PGSIZE);
+  node->info.isLeaf = !level;
+  if (!level) {
+    node->freespace = INITIAL_FREE;
+    node->value_size = loader->value_size;
+    node->flags = loader->leaf_flags;
+  } else
+    node->flags = loader->node_flags;
+  lv->children = 0;
+  lv->records = 0;
+}
+
+void bulk_close_node(bulk_loader_t* loader, uint32_t level, bool last) {
+  bulk_level_t* lv;
+  page_t* node;
+  pagenum_t node_num, next_first;
+
+  lv = loader->levels[level];
+  node = &lv->batch[lv->cur];
+  node_num = lv->first_num + lv->cur;
+
+  if (!last || level + 1 < loader->levels.size())
+    bulk_push(loader, level + 1, lv->low_key, node_num, lv->records);
+
+  if (last) {
+    file_write_pages(loader->table_id, lv->first_num, lv->batch, lv->cur + 1);
+    file_free_pages(loader->table_id, node_num + 1, BULK_BATCH - lv->cur - 1);
+    return;
+  }
+  if (lv->cur + 1 < BULK_BATCH) {
+    if (!level)
+      node->Rsibling = node_num + 1;
     else
-      sibling_num = parent->branch[my_index - 1].pagenum;
-
-    sibling = buffer_read_page(table_id, sibling_num, &sibling_idx, WRITE);
-
-    if (sibling->info.num_keys + page->info.num_keys < capacity) {
-      if (my_index == -1)
-        return coalesce_internal(table_id, my_index, page->parent_num, parent,
-                                 parent_idx, page_num, page, page_idx,
-                                 sibling_num, sibling, sibling_idx);
-      return coalesce_internal(table_id, my_index, page->parent_num, parent,
-                               parent_idx, sibling_num, sibling, sibling_idx,
-                               page_num, page, page_idx);
-    }
-    return redistribute_internal(table_id, page->parent_num, parent, parent_idx,
-                                 sibling_num, sibling, sibling_idx, page_num,
-                                 page, page_idx, my_index);  // redistribution
+      node->right_num = node_num + 1;
+    lv->cur++;
+    return;
   }
-  return 1;
+
+  // The last node still waits for its high key, so it is held back.
+  next_first = file_extend_pages(loader->table_id, BULK_BATCH);
+  if (!level)
+    node->Rsibling = next_first;
+  else
+    node->right_num = next_first;
+  file_write_pages(loader->table_id, lv->first_num, lv->batch, BULK_BATCH - 1);
+  memcpy(lv->held, node, PGSIZE);
+  lv->held_num = node_num;
+  lv->first_num = next_first;
+  lv->cur = 0;
 }
 
-int db_delete(int64_t table_id, int64_t key) {
-  page_t *leaf, *header;
-  pagenum_t root_num, leaf_num;
-  int32_t leaf_idx, header_idx;
-  uint32_t i;
+// The high key of a node is the low key of the next node on its level.
+void bulk_set_high_key(bulk_loader_t* loader, uint32_t level, int64_t key) {
+  bulk_level_t* lv = loader->levels[level];
+  page_t* prev;
 
-  if (!isValid(table_id)) return 1;
+  if (lv->cur)
+    prev = &lv->batch[lv->cur - 1];
+  else if (lv->held_num)
+    prev = lv->held;
+  else
+    return;
+  prev->high_key = key;
+  prev->bounded = 1;
 
-  header = buffer_read_page(table_id, 0, &header_idx, READ);
-  root_num = header->root_num;
-  if (!root_num) return 1;
+  if (!lv->cur) {
+    file_write_page(loader->table_id, lv->held_num, lv->held);
+    lv->held_num = 0;
+  }
+}
 
-  leaf_num = find_leaf(table_id, root_num, key);
-  leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+void bulk_push(bulk_loader_t* loader, uint32_t level, int64_t key,
+               pagenum_t child, uint64_t count) {
+  bulk_level_t* lv;
+  page_t* node;
+  uint32_t* counts;
+
+  if (level == loader->levels.size()) bulk_open_node(loader, level);
+  lv = loader->levels[level];
+  node = &lv->batch[lv->cur];
+
+  if (lv->children && node->info.num_keys >= loader->internal_fill) {
+    bulk_close_node(loader, level, false);
+    bulk_open_node(loader, level);
+    node = &lv->batch[lv->cur];
+  }
+  counts = child_counts(node);
+  if (!lv->children) {
+    node->leftmost = child;
+    lv->low_key = key;
+    bulk_set_high_key(loader, level, key);
+  } else {
+    node_set_key(node, node->info.num_keys, key);
+    node_child(node, node->info.num_keys) = child;
+    node->info.num_keys++;
+  }
+  if (counts) counts[node->info.num_keys] = count;
+  lv->children++;
+  lv->records += count;
+}
+
+void bulk_add_record(bulk_loader_t* loader, int64_t key, char* value,
+                     uint16_t val_size) {
+  bulk_level_t* lv;
+  page_t* node;
+  overflow_ref_t ref;
+  struct iovec iov;
+
+  if (loader->levels.empty()) bulk_open_node(loader, 0);
+  lv = loader->levels[0];
+  node = &lv->batch[lv->cur];
+
+  if (lv->children &&
+      (INITIAL_FREE - node->freespace + leaf_cost(node, val_size) >
+           loader->leaf_fill ||
+       node->freespace < leaf_cost(node, val_size))) {
+    bulk_close_node(loader, 0, false);
+    bulk_open_node(loader, 0);
+    node = &lv->batch[lv->cur];
+  }
+  if (!lv->children) {
+    lv->low_key = key;
+    bulk_set_high_key(loader, 0, key);
+  }
+  lv->children++;
+  lv->records++;
+  iov.iov_base = value;
+  iov.iov_len = value_bytes(val_size);
+  if (!node->value_size && is_overflow(val_size)) {
+    ref.first = bulk_overflow(loader, value, val_size);
+    iov.iov_base = &ref;
+  }
+  leaf_insert_slot(node, node->info.num_keys, key, &iov, 1, val_size);
+}
+
+// The loader writes past the buffer pool, so the chain goes straight to
+// the file as one run of pages.
+pagenum_t bulk_overflow(bulk_loader_t* loader, char* value,
+                        uint16_t val_size) {
+  uint32_t n = (val_size + OVERFLOW_CHUNK - 1) / OVERFLOW_CHUNK, len;
+  pagenum_t first;
+  page_t* pages;
+
+  first = file_extend_pages(loader->table_id, n);
+  pages = (page_t*)calloc(n, sizeof(page_t));
+  for (uint32_t k = 0; k < n; k++) {
+    len = std::min((uint32_t)OVERFLOW_CHUNK,
+                   (uint32_t)(val_size - k * OVERFLOW_CHUNK));
+    pages[k].info.num_keys = len;
+    pages[k].Rsibling = k + 1 < n ? first + k + 1 : 0;
+    memcpy(pages[k].leafbody.value, value + k * OVERFLOW_CHUNK, len);
+  }
+  file_write_pages(loader->table_id, first, pages, n);
+  free(pages);
+
+  return first;
+}
+
+pagenum_t bulk_finish(bulk_loader_t* loader) {
+  bulk_level_t* top;
+  pagenum_t root_num;
+
+  for (uint32_t level = 0; level < loader->levels.size(); level++)
+    bulk_close_node(loader, level, true);
+
+  top = loader->levels.back();
+  root_num = top->first_num + top->cur;
+  bulk_free_levels(loader);
+
+  return root_num;
+}
 
-  return delete_entry(table_id, leaf_num, leaf, leaf_idx, key);
-}
\ No newline at end of file
+void bulk_free_levels(bulk_loader_t* loader) {
+  for (uint32_t level = 0; level < loader->levels.size(); level++) {
+    free(loader->levels[level]->batch);
+    free(loader->levels[level]->held);
+    delete loader->levels[level];
+  }
+  loader->levels.clear();
+}
+
+// The table was empty, so every page past start_page belongs to the
+// unfinished load and goes back to the free list.
+void bulk_abort(bulk_loader_t* loader) {
+  page_t* header;
+
+  bulk_free_levels(loader);
+  header = (page_t*)malloc(sizeof(page_t));
+  file_read_page(loader->table_id, 0, header);
+  file_free_pages(loader->table_id, loader->start_page,
+                  header->num_pages - loader->start_page);
+  free(header);
+}
+
+// The last node of an internal level may end up with only its leftmost
+// child; borrow an entry from its left sibling so every node has a key.
+void bulk_fix_right_spine(int64_t table_id, pagenum_t root_num) {
+  page_t *parent, *page, *sibling;
+  pagenum_t parent_num, page_num, sibling_num;
+  int32_t parent_idx, page_idx, sibling_idx;
+  int my_index;
+  bool dirty = false;
+
+  parent_num = root_num;
+  parent = buffer_read_page(table_id, parent_num, &parent_idx, WRITE);
+  while (!parent->info.isLeaf) {
+    my_index = parent->info.num_keys - 1;
+    page_num = node_child(parent, my_index);
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+
+    if (!page->info.isLeaf && !page->info.num_keys) {
+      sibling_num =
+          my_index ? node_child(parent, my_index - 1) : parent->leftmost;
+      sibling = buffer_read_page(table_id, sibling_num, &sibling_idx, WRITE);
+      redistribute_internal(parent, sibling, page, my_index);
+      buffer_write_page(table_id, sibling_num, sibling_idx, 1);
+      buffer_write_page(table_id, parent_num, parent_idx, 1);
+      dirty = true;
+    } else {
+      buffer_write_page(table_id, parent_num, parent_idx, dirty);
+      dirty = false;
+    }
+
+    parent_num = page_num;
+    parent = page;
+    parent_idx = page_idx;
+  }
+  buffer_write_page(table_id, parent_num, parent_idx, dirty);
+}
+
+int db_bulk_load(int64_t table_id, bulk_iterator_t* iter, int fill_percent) {
+  bulk_loader_t loader;
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+  pagenum_t root_num;
+  int64_t key, last_key;
+  uint16_t val_size;
+  char* value;
+  int ret = 0;
+  int r;
+
+  if (!isValid(table_id) || (give_tree(table_id)->flags & TREE_VARKEY))
+    return 1;
+  tree = give_tree(table_id);
+  loader.counted = tree->flags & TREE_COUNTED;
+  loader.node_flags = node_flags(tree);
+  loader.leaf_flags = leaf_flags(tree);
+  loader.value_size = tree->value_size;
+  // An insert into an empty tree plants its root under the tree latch.
+  LOCK(tree->latch);
+  if (get_root_num(table_id)) {
+    UNLOCK(tree->latch);
+    return 1;
+  }
+  if (fill_percent <= 0 || fill_percent > 100) fill_percent = 100;
+
+  buffer_flush_table(table_id);
+  loader.table_id = table_id;
+  header = (page_t*)malloc(sizeof(page_t));
+  file_read_page(table_id, 0, header);
+  loader.start_page = header->num_pages;
+  free(header);
+  loader.leaf_fill = INITIAL_FREE * fill_percent / 100;
+  loader.internal_fill =
+      layout_capacity(loader.node_flags) * fill_percent / 100;
+  if (loader.internal_fill < 2) loader.internal_fill = 2;
+
+  value = new char[BULK_MAX_VALUE];
+  while (!(r = iter->next(iter->arg, &key, value, &val_size))) {
+    if ((!loader.levels.empty() && key <= last_key) ||
+        !key_fits(tree, key) ||
+        (loader.value_size && val_size != loader.value_size)) {
+      ret = 1;
+      break;
+    }
+    bloom_note(tree, key);
+    bulk_add_record(&loader, key, value, val_size);
+    last_key = key;
+  }
+  if (r < 0) ret = 1;
+  delete[] value;
+  if (ret) {
+    bulk_abort(&loader);
+    UNLOCK(tree->latch);
+    return ret;
+  }
+  if (loader.levels.empty()) {
+    UNLOCK(tree->latch);
+    return 0;
+  }
+
+  // The loader wrote the file directly; a header cached by a reader since
+  // the flush is stale, so refresh it before publishing the root.
+  root_num = bulk_finish(&loader);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  file_read_page(table_id, 0, header);
+  header->root_num = root_num;
+  buffer_write_page(table_id, 0, header_idx, 1);
+
+  bulk_fix_right_spine(table_id, root_num);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
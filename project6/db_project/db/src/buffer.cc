@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include <sched.h>
 
 frame_t* frames;
 int num_frames;
@@ -14,6 +15,17 @@ int buf_hashFunction(int64_t table_id, pagenum_t pagenum) {
 
 page_t* buffer_read_page_without_latch(int page_idx) { return frames[page_idx].page; }
 
+// A frame's version is odd while it is latched for writing or refilled, so a
+// reader that sees the same even version before and after reading the page
+// without a latch read a consistent copy of it.
+void frame_write_begin(int idx) {
+  __atomic_fetch_add(&frames[idx].version, 1, __ATOMIC_SEQ_CST);
+}
+
+void frame_write_end(int idx) {
+  __atomic_fetch_add(&frames[idx].version, 1, __ATOMIC_SEQ_CST);
+}
+
 int find_empty_frame(int64_t table_id, pagenum_t pagenum) {
   int i, tablesize;
   tablesize = num_bufs;
@@ -77,12 +89,27 @@ void delete_append_LRU(int idx) {
   append_LRU(idx);
 }
 
+// Returns the least recently used frame that is not latched, latched for
+// writing and with its old page written back. Optimistic readers do not
+// move their frame in the LRU list, only mark it referenced, so a marked
+// frame gets a second chance at the recent end instead.
 int give_idx() {
   int ret_idx = -1;
   int i = firstLRU;
+  int next;
 
   while (ret_idx < 0) {
-    if (frames[i].state == UNLOCKED) {
+    if (__atomic_load_n(&frames[i].referenced, __ATOMIC_RELAXED)) {
+      __atomic_store_n(&frames[i].referenced, 0, __ATOMIC_RELAXED);
+      next = frames[i].nextLRU;
+      delete_append_LRU(i);
+      i = next < 0 ? firstLRU : next;
+      continue;
+    }
+    if (frames[i].state == UNLOCKED &&
+        !pthread_mutex_trylock(&frames[i].page_mutex)) {
+      frames[i].state = LOCKED;
+      frame_write_begin(i);
       if (frames[i].is_dirty) {
         log_flush();
         file_write_page(frames[i].table_id, frames[i].page_num, frames[i].page);
@@ -98,6 +125,28 @@ int give_idx() {
   return ret_idx;
 }
 
+// Takes a frame to load pagenum into, latched for writing: an unused one
+// while the pool has room, otherwise an evicted one. It is claimed for
+// pagenum before buf_mutex is let go, so no other thread can take the same
+// frame while it is being filled.
+int take_frame(int64_t table_id, pagenum_t pagenum) {
+  int idx;
+
+  if (num_frames < num_bufs) {
+    idx = find_empty_frame(table_id, pagenum);
+    LOCK(frames[idx].page_mutex);
+    frames[idx].state = LOCKED;
+    frame_write_begin(idx);
+  } else
+    idx = give_idx();
+  frames[idx].is_buf = 1;
+  frames[idx].is_dirty = 0;
+  frames[idx].referenced = 0;
+  frames[idx].table_id = table_id;
+  frames[idx].page_num = pagenum;
+  return idx;
+}
+
 int init_buffer(int num_buf) {
   if (!frames) {
     buf_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -111,6 +160,8 @@ int init_buffer(int num_buf) {
       frames[i].table_id = frames[i].is_dirty = frames[i].is_buf = 0;
       frames[i].page_mutex = PTHREAD_MUTEX_INITIALIZER;
       frames[i].state = UNLOCKED;
+      frames[i].referenced = 0;
+      frames[i].version = 0;
     }
     num_frames = 0;
     num_bufs = num_buf;
@@ -134,56 +185,38 @@ pagenum_t buffer_alloc_page(int64_t table_id) {
   LOCK(buf_mutex);
   hit = hit_idx(table_id, 0);
   if (hit >= 0) {
-    frames[hit].state = LOCKED;
     LOCK(frames[hit].page_mutex);
+    frames[hit].state = LOCKED;
+    frame_write_begin(hit);
 
     if (!frames[hit].page->nextfree_num) {
       if (frames[hit].is_dirty) file_write_page(table_id, 0, frames[hit].page);
       frames[hit].is_dirty = 0;
       new_pagenum = file_alloc_page(table_id);  // file size become twice
 
-      if (num_frames < num_bufs)
-        new_idx = find_empty_frame(table_id, new_pagenum);
-      else
-        new_idx = give_idx();
-
-      frames[new_idx].state = LOCKED;
-      LOCK(frames[new_idx].page_mutex);
+      new_idx = take_frame(table_id, new_pagenum);
       UNLOCK(buf_mutex);
 
-      frames[new_idx].is_buf = 1;
-      frames[new_idx].is_dirty = 0;
-      frames[new_idx].table_id = table_id;
-
       file_read_page(table_id, 0, frames[hit].page);
     }
 
     // subcase 2 : File has a freepage.
     else {
       new_pagenum = frames[hit].page->nextfree_num;
-      if (num_frames < num_bufs)
-        new_idx = find_empty_frame(table_id, new_pagenum);
-      else
-        new_idx = give_idx();
-
-      frames[new_idx].state = LOCKED;
-      LOCK(frames[new_idx].page_mutex);
+      new_idx = take_frame(table_id, new_pagenum);
       UNLOCK(buf_mutex);
 
-      frames[new_idx].is_buf = 1;
-      frames[new_idx].is_dirty = 0;
-      frames[new_idx].table_id = table_id;
-
       file_read_page(table_id, new_pagenum, frames[new_idx].page);
       frames[hit].page->nextfree_num = frames[new_idx].page->nextfree_num;
       frames[hit].is_dirty = 1;
     }
 
-    frames[new_idx].page_num = new_pagenum;
     frames[new_idx].page->LSN = 0;
+    frame_write_end(hit);
     frames[hit].state = UNLOCKED;
     UNLOCK(frames[hit].page_mutex);
 
+    frame_write_end(new_idx);
     frames[new_idx].state = UNLOCKED;
     UNLOCK(frames[new_idx].page_mutex);
 
@@ -192,35 +225,19 @@ pagenum_t buffer_alloc_page(int64_t table_id) {
 
   // case 2: header page is not in buffer.
   new_pagenum = file_alloc_page(table_id);
-  if (num_frames < num_bufs)
-    hit = find_empty_frame(table_id, new_pagenum);
-  else
-    hit = give_idx();
-  frames[hit].state = LOCKED;
-  LOCK(frames[hit].page_mutex);
-
-  frames[hit].is_dirty = 0;
-  frames[hit].is_buf = 1;
-  frames[hit].page_num = 0;
-  frames[hit].table_id = table_id;
+  hit = take_frame(table_id, 0);
   file_read_page(table_id, 0, frames[hit].page);
 
-  if (num_frames < num_bufs)
-    new_idx = find_empty_frame(table_id, new_pagenum);
-  else
-    new_idx = give_idx();
-
-  frames[new_idx].state = LOCKED;
-  LOCK(frames[new_idx].page_mutex);
+  new_idx = take_frame(table_id, new_pagenum);
   UNLOCK(buf_mutex);
 
-  frames[new_idx].is_buf = 1;
-  frames[new_idx].is_dirty = 0;
-  frames[new_idx].table_id = table_id;
-  frames[new_idx].page_num = new_pagenum;
   frames[new_idx].page->LSN = 0;
 
+  frame_write_end(hit);
+  frames[hit].state = UNLOCKED;
   UNLOCK(frames[hit].page_mutex);
+  frame_write_end(new_idx);
+  frames[new_idx].state = UNLOCKED;
   UNLOCK(frames[new_idx].page_mutex);
 
   return new_pagenum;
@@ -238,40 +255,41 @@ void buffer_free_page(int64_t table_id, pagenum_t pagenum, int32_t idx) {
   hit = hit_idx(table_id, 0);
   // case 1: header page is in buffer.
   if (hit >= 0) {
-    frames[hit].state = LOCKED;
     LOCK(frames[hit].page_mutex);
+    frames[hit].state = LOCKED;
+    frame_write_begin(hit);
     UNLOCK(buf_mutex);
     frames[idx].page->nextfree_num = frames[hit].page->nextfree_num;
     file_write_page(table_id, pagenum, frames[idx].page);
     frames[hit].page->nextfree_num = pagenum;
     frames[hit].is_dirty = 1;
+    frame_write_end(hit);
+    frames[hit].state = UNLOCKED;
     UNLOCK(frames[hit].page_mutex);
-    UNLOCK(frames[idx].page_mutex);
+    frame_write_end(idx);
     frames[idx].state = UNLOCKED;
-    frames[hit].state = UNLOCKED;
+    UNLOCK(frames[idx].page_mutex);
     return;
   }
 
   // case 2: header page is not in buffer.
-  UNLOCK(frames[idx].page_mutex);
+  frame_write_end(idx);
   frames[idx].state = UNLOCKED;
+  UNLOCK(frames[idx].page_mutex);
 
   file_free_page(table_id, pagenum);
-  hit = find_empty_frame(table_id, 0);
-  frames[hit].state = LOCKED;
-  LOCK(frames[hit].page_mutex);
+  hit = take_frame(table_id, 0);
   UNLOCK(buf_mutex);
-  frames[hit].is_dirty = 0;
-  frames[hit].is_buf = 1;
-  frames[hit].page_num = 0;
-  frames[hit].table_id = table_id;
   file_read_page(table_id, 0, frames[hit].page);
-  UNLOCK(frames[hit].page_mutex);
+  frame_write_end(hit);
   frames[hit].state = UNLOCKED;
+  UNLOCK(frames[hit].page_mutex);
 }
 
-page_t* buffer_read_page(int64_t table_id, pagenum_t pagenum, int* idx,
-                         bool mode) {
+// With nowait, a resident page latched by another thread is not waited
+// for and NULL is returned instead.
+page_t* read_frame(int64_t table_id, pagenum_t pagenum, int* idx, bool mode,
+                   bool nowait) {
   int hit;
   page_t* ret;
   int flag = 0;
@@ -282,6 +300,8 @@ RETRY:
   if (hit >= 0) {
     if(pthread_mutex_trylock(&frames[hit].page_mutex)) {
       UNLOCK(buf_mutex);
+      if (nowait) return NULL;
+      sched_yield();
       goto RETRY;
     }
     frames[hit].state = LOCKED;
@@ -292,39 +312,74 @@ RETRY:
     if (mode == READ) {
       frames[hit].state = UNLOCKED;
       UNLOCK(frames[hit].page_mutex);
-    }
+    } else
+      frame_write_begin(hit);
     return ret;
   }
-  if (num_frames < num_bufs)
-    hit = find_empty_frame(table_id, pagenum);
-  else {
-    hit = give_idx();
-  }
-  if(pthread_mutex_trylock(&frames[hit].page_mutex)) {
-    UNLOCK(buf_mutex);
-    goto RETRY;
-  }
-  frames[hit].state = LOCKED;
+  hit = take_frame(table_id, pagenum);
   UNLOCK(buf_mutex);
   *idx = hit;
   file_read_page(table_id, pagenum, frames[hit].page);
-  frames[hit].is_buf = 1;
-  frames[hit].is_dirty = 0;
-  frames[hit].table_id = table_id;
-  frames[hit].page_num = pagenum;
   ret = frames[hit].page;
   if (mode == READ) {
+    frame_write_end(hit);
     frames[hit].state = UNLOCKED;
     UNLOCK(frames[hit].page_mutex);
   }
   return ret;
 }
 
+page_t* buffer_read_page(int64_t table_id, pagenum_t pagenum, int* idx,
+                         bool mode) {
+  return read_frame(table_id, pagenum, idx, mode, false);
+}
+
+page_t* buffer_try_read_page(int64_t table_id, pagenum_t pagenum, int* idx) {
+  return read_frame(table_id, pagenum, idx, WRITE, true);
+}
+
 void buffer_write_page(int64_t table_id, pagenum_t pagenum, int32_t idx,
                        bool success) {
   if (success) frames[idx].is_dirty = 1;
-  UNLOCK(frames[idx].page_mutex);
+  frame_write_end(idx);
   frames[idx].state = UNLOCKED;
+  UNLOCK(frames[idx].page_mutex);
+}
+
+// Looks pagenum up without latching it or taking buf_mutex, so the LRU order
+// is left alone and the frame is only marked referenced. Returns NULL if the page is not resident or is latched for
+// writing; otherwise whatever is read from the page is only valid once
+// buffer_validate(*idx, *version) succeeds.
+page_t* buffer_optimistic_read(int64_t table_id, pagenum_t pagenum, int* idx,
+                               uint64_t* version) {
+  int i, hashValue;
+  uint64_t v;
+
+  hashValue = i = buf_hashFunction(table_id, pagenum);
+  do {
+    v = __atomic_load_n(&frames[i].version, __ATOMIC_ACQUIRE);
+    if (frames[i].is_buf && frames[i].table_id == table_id &&
+        frames[i].page_num == pagenum) {
+      if ((v & 1) || !buffer_validate(i, v)) return NULL;
+      __atomic_store_n(&frames[i].referenced, 1, __ATOMIC_RELAXED);
+      *idx = i;
+      *version = v;
+      return frames[i].page;
+    }
+    i = (i + 1) % num_bufs;
+  } while (i != hashValue);
+  return NULL;
+}
+
+// Read by a latch holder, the version is odd and the page keeps the next
+// version as long as nobody latches it after the holder.
+uint64_t buffer_version(int32_t idx) {
+  return __atomic_load_n(&frames[idx].version, __ATOMIC_ACQUIRE);
+}
+
+bool buffer_validate(int32_t idx, uint64_t version) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&frames[idx].version, __ATOMIC_RELAXED) == version;
 }
 
 void buffer_flush()
@@ -343,6 +398,29 @@ void buffer_flush()
   firstLRU = lastLRU = -1;
 }
 
+// Writes back and drops every frame of table_id, so the file can be
+// modified directly without leaving stale copies in the pool.
+void buffer_flush_table(int64_t table_id) {
+  LOCK(buf_mutex);
+  for (int i = 0; i < num_bufs; i++) {
+    if (!frames[i].is_buf || frames[i].table_id != table_id) continue;
+    LOCK(frames[i].page_mutex);
+    frame_write_begin(i);
+    if (frames[i].is_dirty) {
+      log_flush();
+      file_write_page(frames[i].table_id, frames[i].page_num, frames[i].page);
+    }
+    memset(frames[i].page, 0x00, PGSIZE);
+    frames[i].is_buf = frames[i].is_dirty = 0;
+    frames[i].table_id = 0;
+    frames[i].page_num = 0;
+    delete_LRU(i);
+    frame_write_end(i);
+    UNLOCK(frames[i].page_mutex);
+  }
+  UNLOCK(buf_mutex);
+}
+
 int shutdown_buffer() {
   for (int i = 0; i < num_bufs; i++) {
     if (frames[i].is_buf && frames[i].is_dirty) {
@@ -29,9 +29,11 @@ int64_t file_open_table_file(const char* path) {
   check = pread(fd, headerPg, PGSIZE, 0);
   if (check != PGSIZE || !headerPg->num_pages) {
     pagenum_t nextfree;
+    memset(headerPg, 0x00, PGSIZE);
     headerPg->num_pages = 1;
     headerPg->nextfree_num = nextfree = 1;
     headerPg->root_num = 0;
+    headerPg->format = PAGE_FORMAT_SPLIT_KEYS;
     uint64_t loop = 2560;
 
     make_free_pages(fd, nextfree, loop, headerPg);
@@ -46,7 +48,7 @@ int64_t file_open_table_file(const char* path) {
 void make_free_pages(int fd, pagenum_t next, uint64_t lp, page_t* headerPg) {
   pagenum_t nextfree = next;
   int cnt = 0;
-  page_t* freePg = (page_t*)malloc(sizeof(page_t));
+  page_t* freePg = (page_t*)calloc(1, sizeof(page_t));
   uint64_t loop = lp;
 
   while (headerPg->num_pages < loop - 1) {
@@ -102,7 +104,7 @@ void file_free_page(int64_t table_id, pagenum_t pagenum) {
   fd = table[table_id];
 
   page_t* headerPg = (page_t*)malloc(sizeof(page_t));
-  page_t* freePg = (page_t*)malloc(sizeof(page_t));
+  page_t* freePg = (page_t*)calloc(1, sizeof(page_t));
   pread(fd, headerPg, PGSIZE, 0);
 
   freePg->nextfree_num = headerPg->nextfree_num;
@@ -128,6 +130,50 @@ void file_write_page(int64_t table_id, pagenum_t pagenum, const page_t* src) {
   fsync(fd);
 }
 
+// Reserves n contiguous pages at the end of the file and returns the first.
+pagenum_t file_extend_pages(int64_t table_id, uint64_t n) {
+  pagenum_t ret_page;
+  int fd;
+  fd = table[table_id];
+  page_t* headerPg = (page_t*)malloc(sizeof(page_t));
+
+  pread(fd, headerPg, PGSIZE, 0);
+  ret_page = headerPg->num_pages;
+  headerPg->num_pages += n;
+  pwrite(fd, headerPg, PGSIZE, 0);
+  fsync(fd);
+  free(headerPg);
+  return ret_page;
+}
+
+void file_write_pages(int64_t table_id, pagenum_t pagenum, const page_t* src,
+                      uint64_t n) {
+  int fd;
+  fd = table[table_id];
+  pwrite(fd, src, PGSIZE * n, PGOFFSET(pagenum));
+  fsync(fd);
+}
+
+void file_free_pages(int64_t table_id, pagenum_t pagenum, uint64_t n) {
+  int fd;
+  if (!n) return;
+  fd = table[table_id];
+
+  page_t* headerPg = (page_t*)malloc(sizeof(page_t));
+  page_t* freePg = (page_t*)calloc(n, sizeof(page_t));
+  pread(fd, headerPg, PGSIZE, 0);
+
+  for (uint64_t i = 0; i < n - 1; i++) freePg[i].nextfree_num = pagenum + i + 1;
+  freePg[n - 1].nextfree_num = headerPg->nextfree_num;
+  headerPg->nextfree_num = pagenum;
+  pwrite(fd, freePg, PGSIZE * n, PGOFFSET(pagenum));
+  pwrite(fd, headerPg, PGSIZE, 0);
+  fsync(fd);
+
+  free(freePg);
+  free(headerPg);
+}
+
 void file_close_table_files() {
   std::unordered_map<int64_t, int>::iterator it;
   for (it = table.begin(); it != table.end(); it++)
@@ -0,0 +1,329 @@
+#include "hash.h"
+#include <stddef.h>
+
+uint64_t hash_key(int64_t key) {
+  uint64_t h = (uint64_t)key;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+pagenum_t* hash_entries(page_t* page) {
+  return (pagenum_t*)((char*)page + offsetof(page_t, leafbody));
+}
+
+static uint64_t low_bits(uint64_t h, uint32_t depth) {
+  return h & ((1ULL << depth) - 1);
+}
+
+void hash_init_bucket(page_t* bucket, tree_t* tree, uint32_t local_depth,
+                      int64_t hash_bits) {
+  bucket->info.isLeaf = 1;
+  bucket->value_size = tree->value_size;
+  bucket->flags = leaf_flags(tree);
+  bucket->local_depth = local_depth;
+  bucket->hash_bits = hash_bits;
+  bucket->Rsibling = 0;
+  bucket->frag = 0;
+  if (bucket->value_size) {
+    fixed_set_count(bucket, 0);
+  } else {
+    bucket->info.num_keys = 0;
+    bucket->freespace = sizeof(leafbody_t);
+  }
+}
+
+// Directory
+// Gives an empty table a directory of depth 0 and its one bucket. Fails
+// for a table that already has pages or modes of its own.
+int hash_create(int64_t table_id, tree_t* tree) {
+  page_t *header, *root, *dir, *bucket;
+  int32_t header_idx, root_idx, dir_idx, bucket_idx;
+  pagenum_t root_num, dir_num, bucket_num;
+  uint32_t flags;
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  flags = header->flags;
+  root_num = header->root_num;
+  buffer_write_page(table_id, 0, header_idx, 0);
+  if (flags & TREE_HASH) {
+    UNLOCK(tree->latch);
+    return 0;
+  }
+  if (root_num || flags) {
+    UNLOCK(tree->latch);
+    return 1;
+  }
+
+  // buffer_alloc_page takes the header latch itself.
+  root_num = buffer_alloc_page(table_id);
+  dir_num = buffer_alloc_page(table_id);
+  bucket_num = buffer_alloc_page(table_id);
+
+  bucket = buffer_read_page(table_id, bucket_num, &bucket_idx, WRITE);
+  hash_init_bucket(bucket, tree, 0, 0);
+  buffer_write_page(table_id, bucket_num, bucket_idx, 1);
+
+  dir = buffer_read_page(table_id, dir_num, &dir_idx, WRITE);
+  memset(dir, 0x00, PGSIZE);
+  hash_entries(dir)[0] = bucket_num;
+  buffer_write_page(table_id, dir_num, dir_idx, 1);
+
+  root = buffer_read_page(table_id, root_num, &root_idx, WRITE);
+  memset(root, 0x00, PGSIZE);
+  root->info.num_keys = 1;
+  hash_entries(root)[0] = dir_num;
+  buffer_write_page(table_id, root_num, root_idx, 1);
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  header->root_num = root_num;
+  header->hash_depth = 0;
+  header->flags |= TREE_HASH;
+  tree->flags = header->flags;
+  buffer_write_page(table_id, 0, header_idx, 1);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+hash_t* hash_load(int64_t table_id) {
+  hash_t* hash = new hash_t;
+  page_t *header, *root, *dir;
+  int32_t header_idx, root_idx, dir_idx;
+  pagenum_t root_num;
+  uint64_t size;
+
+  hash->dir_latch = PTHREAD_RWLOCK_INITIALIZER;
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  root_num = header->root_num;
+  hash->depth = header->hash_depth;
+  buffer_write_page(table_id, 0, header_idx, 0);
+
+  size = 1ULL << hash->depth;
+  root = buffer_read_page(table_id, root_num, &root_idx, WRITE);
+  hash->dir_pages.assign(hash_entries(root),
+                         hash_entries(root) + root->info.num_keys);
+  buffer_write_page(table_id, root_num, root_idx, 0);
+  for (pagenum_t dir_num : hash->dir_pages) {
+    dir = buffer_read_page(table_id, dir_num, &dir_idx, WRITE);
+    for (uint64_t i = 0; i < HASH_FANOUT && hash->dir.size() < size; i++)
+      hash->dir.push_back(hash_entries(dir)[i]);
+    buffer_write_page(table_id, dir_num, dir_idx, 0);
+  }
+
+  return hash;
+}
+
+void hash_store_entry(int64_t table_id, hash_t* hash, uint64_t index,
+                      pagenum_t bucket_num) {
+  pagenum_t dir_num = hash->dir_pages[index / HASH_FANOUT];
+  page_t* dir;
+  int32_t dir_idx;
+
+  hash->dir[index] = bucket_num;
+  dir = buffer_read_page(table_id, dir_num, &dir_idx, WRITE);
+  hash_entries(dir)[index % HASH_FANOUT] = bucket_num;
+  buffer_write_page(table_id, dir_num, dir_idx, 1);
+}
+
+// Doubles the directory, the new half pointing at the same buckets as the
+// old one. Called with the directory latch held for writing.
+int hash_grow(int64_t table_id, hash_t* hash) {
+  uint64_t size = hash->dir.size();
+  page_t *root, *header;
+  int32_t root_idx, header_idx;
+  pagenum_t root_num;
+
+  if (hash->depth == HASH_MAX_DEPTH) return 1;
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  root_num = header->root_num;
+  buffer_write_page(table_id, 0, header_idx, 0);
+
+  root = buffer_read_page(table_id, root_num, &root_idx, WRITE);
+  while (hash->dir_pages.size() * HASH_FANOUT < 2 * size) {
+    // Not holding the root across buffer_alloc_page keeps the header latch
+    // the last one taken.
+    buffer_write_page(table_id, root_num, root_idx, 1);
+    hash->dir_pages.push_back(buffer_alloc_page(table_id));
+    root = buffer_read_page(table_id, root_num, &root_idx, WRITE);
+    hash_entries(root)[root->info.num_keys++] = hash->dir_pages.back();
+  }
+  buffer_write_page(table_id, root_num, root_idx, 1);
+
+  hash->dir.resize(2 * size);
+  for (uint64_t i = 0; i < size; i++)
+    hash_store_entry(table_id, hash, size + i, hash->dir[i]);
+  hash->depth++;
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  header->hash_depth = hash->depth;
+  buffer_write_page(table_id, 0, header_idx, 1);
+
+  return 0;
+}
+
+// Records
+// Returns the bucket that holds key, WRITE-latched. The directory is read
+// without holding any page, so a bucket that split in between is noticed
+// by its hash bits and the lookup retried.
+pagenum_t hash_find_bucket(int64_t table_id, int64_t key, page_t** bucket,
+                           int32_t* bucket_idx) {
+  hash_t* hash = give_tree(table_id)->hash;
+  uint64_t h = hash_key(key);
+  pagenum_t bucket_num;
+
+  while (true) {
+    pthread_rwlock_rdlock(&hash->dir_latch);
+    bucket_num = hash->dir[low_bits(h, hash->depth)];
+    pthread_rwlock_unlock(&hash->dir_latch);
+
+    *bucket = buffer_read_page(table_id, bucket_num, bucket_idx, WRITE);
+    if (low_bits(h, (*bucket)->local_depth) == (uint64_t)(*bucket)->hash_bits)
+      return bucket_num;
+    buffer_write_page(table_id, bucket_num, *bucket_idx, 0);
+  }
+}
+
+int hash_insert(int64_t table_id, tree_t* tree, int64_t key,
+                const struct iovec* iov, int iovcnt, uint16_t val_size) {
+  pagenum_t bucket_num;
+  page_t* bucket;
+  int32_t bucket_idx;
+  uint32_t i;
+
+  while (true) {
+    bucket_num = hash_find_bucket(table_id, key, &bucket, &bucket_idx);
+    i = leaf_lower_bound(bucket, key);
+    if (i < bucket->info.num_keys && leaf_key(bucket, i) == key) {
+      buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+      return 1;
+    }
+    if (bucket->freespace >= leaf_cost(bucket, val_size))
+      return insert_into_leaf(table_id, i, bucket_num, bucket, bucket_idx, key,
+                              iov, iovcnt, val_size);
+    buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+    if (hash_split(table_id, tree, key, val_size)) return 1;
+  }
+}
+
+// Splits the bucket of key on its next hash bit, growing the directory
+// first if the bucket already uses every bit it has. Splits are serialized
+// by the tree latch; the directory latch is only taken for writing while
+// the entries change, with both buckets held so lookups retry until the
+// directory is current.
+int hash_split(int64_t table_id, tree_t* tree, int64_t key,
+               uint16_t val_size) {
+  hash_t* hash = tree->hash;
+  page_t *bucket, *sibling, *tmp;
+  int32_t bucket_idx, sibling_idx;
+  pagenum_t bucket_num, sibling_num;
+  uint32_t depth;
+  int64_t bits;
+
+  LOCK(tree->latch);
+  bucket_num = hash_find_bucket(table_id, key, &bucket, &bucket_idx);
+  if (bucket->freespace >= leaf_cost(bucket, val_size)) {
+    buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+    UNLOCK(tree->latch);
+    return 0;
+  }
+  depth = bucket->local_depth;
+  bits = bucket->hash_bits;
+
+  pthread_rwlock_wrlock(&hash->dir_latch);
+  if (depth == hash->depth && hash_grow(table_id, hash)) {
+    pthread_rwlock_unlock(&hash->dir_latch);
+    buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+    UNLOCK(tree->latch);
+    return 1;
+  }
+  pthread_rwlock_unlock(&hash->dir_latch);
+
+  sibling_num = buffer_alloc_page(table_id);
+  sibling = buffer_read_page(table_id, sibling_num, &sibling_idx, WRITE);
+
+  tmp = (page_t*)malloc(sizeof(page_t));
+  memcpy(tmp, bucket, sizeof(page_t));
+  hash_init_bucket(bucket, tree, depth + 1, bits);
+  hash_init_bucket(sibling, tree, depth + 1, bits | (1LL << depth));
+  for (uint32_t i = 0; i < tmp->info.num_keys; i++) {
+    page_t* dest = (hash_key(leaf_key(tmp, i)) >> depth) & 1 ? sibling : bucket;
+    struct iovec iov = {leaf_value(tmp, i), value_bytes(leaf_size(tmp, i))};
+    leaf_insert_slot(dest, dest->info.num_keys, leaf_key(tmp, i), &iov, 1,
+                     leaf_size(tmp, i));
+    leaf_set_trx_id(dest, dest->info.num_keys - 1, leaf_trx_id(tmp, i));
+  }
+  free(tmp);
+
+  pthread_rwlock_wrlock(&hash->dir_latch);
+  for (uint64_t i = bits | (1ULL << depth); i < hash->dir.size();
+       i += 1ULL << (depth + 1))
+    hash_store_entry(table_id, hash, i, sibling_num);
+  pthread_rwlock_unlock(&hash->dir_latch);
+
+  buffer_write_page(table_id, sibling_num, sibling_idx, 1);
+  buffer_write_page(table_id, bucket_num, bucket_idx, 1);
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+int hash_delete(int64_t table_id, int64_t key) {
+  pagenum_t bucket_num;
+  page_t* bucket;
+  int32_t bucket_idx;
+  uint32_t i;
+
+  bucket_num = hash_find_bucket(table_id, key, &bucket, &bucket_idx);
+  i = leaf_find(bucket, key);
+  if (i == bucket->info.num_keys) {
+    buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+    return 1;
+  }
+  delete_leaf(table_id, i, bucket_num, bucket, bucket_idx, key);
+  buffer_write_page(table_id, bucket_num, bucket_idx, 1);
+
+  return 0;
+}
+
+// Keys share no path, each is looked up on its own.
+int hash_find_batch(int64_t table_id, int64_t* keys, int n, char** ret_vals,
+                    uint16_t* val_sizes, int* results, int trx_id) {
+  pagenum_t bucket_num;
+  page_t* bucket;
+  int32_t bucket_idx;
+  uint32_t i;
+
+  for (int k = 0; k < n; k++) {
+    bucket_num = hash_find_bucket(table_id, keys[k], &bucket, &bucket_idx);
+    i = leaf_find(bucket, keys[k]);
+    if (i == bucket->info.num_keys) {
+      buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+      continue;
+    }
+    if (trx_id) {
+      bucket_idx = lock_acquire(table_id, bucket_num, keys[k], i, trx_id,
+                                SHARED, bucket, bucket_idx);
+      if (bucket_idx == DEAD_LOCK) {
+        trx_abort(trx_id);
+        return 1;
+      }
+      bucket = buffer_read_page_without_latch(bucket_idx);
+      if ((i = leaf_find(bucket, keys[k])) == bucket->info.num_keys) {
+        buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+        continue;
+      }
+    }
+    copy_value(table_id, bucket, i, ret_vals[k]);
+    val_sizes[k] = leaf_size(bucket, i);
+    results[k] = 0;
+    buffer_write_page(table_id, bucket_num, bucket_idx, 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,268 @@
+#include "ingest.h"
+#include <time.h>
+#include <algorithm>
+
+#define DEFAULT_MEM (64UL << 20)
+
+double ingest_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int ingest_read_record(FILE* fp, int format, int64_t* key, char* value,
+                       uint16_t* val_size) {
+  char line[PGSIZE + 64];
+  char* comma;
+  char* end;
+  size_t len;
+
+  if (format == INGEST_BINARY) {
+    if (fread(key, sizeof(int64_t), 1, fp) != 1) return 1;
+    if (fread(val_size, sizeof(uint16_t), 1, fp) != 1) return -1;
+    if (*val_size > MAX_LEAF_VALUE) return -1;
+    if (fread(value, 1, *val_size, fp) != *val_size) return -1;
+    return 0;
+  }
+
+  do {
+    if (!fgets(line, sizeof(line), fp)) return 1;
+  } while (line[0] == '\n' || (line[0] == '\r' && line[1] == '\n'));
+
+  len = strlen(line);
+  if (line[len - 1] != '\n' && !feof(fp)) return -1;
+  if (!(comma = strchr(line, ','))) return -1;
+  *key = strtoll(line, &end, 10);
+  if (end != comma) return -1;
+  len = strcspn(comma + 1, "\r\n");
+  if (len > MAX_LEAF_VALUE) return -1;
+  memcpy(value, comma + 1, len);
+  *val_size = len;
+  return 0;
+}
+
+void* ingest_sort_run(void* arg) {
+  ingest_run_t* run = (ingest_run_t*)arg;
+  FILE* fp;
+
+  std::stable_sort(run->recs.begin(), run->recs.end(),
+                   [](const ingest_rec_t& a, const ingest_rec_t& b) {
+                     return a.key < b.key;
+                   });
+  if (!run->spill) return nullptr;
+
+  if (!(fp = fopen(run->path, "wb"))) {
+    run->failed = true;
+    return nullptr;
+  }
+  for (uint64_t i = 0; i < run->recs.size() && !run->failed; i++) {
+    if (fwrite(&run->recs[i].key, sizeof(int64_t), 1, fp) != 1 ||
+        fwrite(&run->recs[i].size, sizeof(uint16_t), 1, fp) != 1 ||
+        fwrite(run->data + run->recs[i].offset, 1, run->recs[i].size, fp) !=
+            run->recs[i].size)
+      run->failed = true;
+  }
+  if (fclose(fp)) run->failed = true;
+  return nullptr;
+}
+
+// Returns 0 for a record, 1 at the end of the run and -1 if a spilled run
+// is cut short.
+int merge_advance(merge_source_t* source) {
+  ingest_rec_t* rec;
+
+  if (source->fp) {
+    if (fread(&source->key, sizeof(int64_t), 1, source->fp) != 1)
+      return feof(source->fp) && !ferror(source->fp) ? 1 : -1;
+    if (fread(&source->size, sizeof(uint16_t), 1, source->fp) != 1 ||
+        source->size > MAX_LEAF_VALUE ||
+        fread(source->value, 1, source->size, source->fp) != source->size)
+      return -1;
+    return 0;
+  }
+  if (source->pos >= source->run->recs.size()) return 1;
+  rec = &source->run->recs[source->pos++];
+  source->key = rec->key;
+  source->size = rec->size;
+  memcpy(source->value, source->run->data + rec->offset, rec->size);
+  return 0;
+}
+
+int merge_next(void* arg, int64_t* key, char* value, uint16_t* val_size) {
+  merge_state_t* state = (merge_state_t*)arg;
+  merge_source_t* source;
+  merge_item_t top;
+  double start;
+  int r;
+  bool dup;
+
+  start = ingest_now();
+  while (!state->heap.empty()) {
+    top = state->heap.top();
+    state->heap.pop();
+    source = state->sources[top.second];
+
+    dup = state->emitted && source->key == state->last_key;
+    if (!dup) {
+      *key = source->key;
+      *val_size = source->size;
+      memcpy(value, source->value, source->size);
+    } else
+      state->stats->duplicates++;
+
+    r = merge_advance(source);
+    if (r < 0) {
+      state->stats->merge_sec += ingest_now() - start;
+      return -1;
+    }
+    if (!r) state->heap.push({source->key, top.second});
+    if (!dup) {
+      state->last_key = *key;
+      state->emitted = true;
+      state->stats->merge_sec += ingest_now() - start;
+      return 0;
+    }
+  }
+  state->stats->merge_sec += ingest_now() - start;
+  return 1;
+}
+
+int db_ingest(int64_t table_id, const char* path, ingest_opt_t* opt,
+              ingest_stats_t* stats) {
+  std::vector<ingest_run_t*> runs;
+  std::vector<ingest_run_t*> round;
+  std::vector<pthread_t> workers;
+  merge_state_t state;
+  merge_source_t* source;
+  bulk_iterator_t iter;
+  ingest_run_t* run;
+  FILE* in;
+  uint64_t chunk_size;
+  uint16_t val_size;
+  int64_t key;
+  char* value;
+  double start;
+  int num_threads;
+  int ret = 0;
+  int r;
+  bool eof = false;
+  bool spill;
+
+  if (!isValid(table_id)) return 1;
+  if (!(in = fopen(path, opt->format == INGEST_CSV ? "r" : "rb"))) return 1;
+
+  memset(stats, 0x00, sizeof(ingest_stats_t));
+  num_threads = opt->num_threads > 0 ? opt->num_threads : 1;
+  chunk_size = (opt->mem_limit ? opt->mem_limit : DEFAULT_MEM) / num_threads;
+  if (chunk_size < 2 * PGSIZE) chunk_size = 2 * PGSIZE;
+  value = new char[PGSIZE];
+
+  while (!eof) {
+    start = ingest_now();
+    round.clear();
+    for (int t = 0; t < num_threads && !eof; t++) {
+      run = new ingest_run_t();
+      run->capacity = chunk_size;
+      run->data = (char*)malloc(chunk_size);
+      run->used = 0;
+
+      while (run->used + run->recs.size() * sizeof(ingest_rec_t) +
+                 MAX_LEAF_VALUE <
+             chunk_size) {
+        r = ingest_read_record(in, opt->format, &key, value, &val_size);
+        if (r) {
+          if (r < 0) ret = 1;
+          eof = true;
+          break;
+        }
+        run->recs.push_back({key, run->used, val_size});
+        memcpy(run->data + run->used, value, val_size);
+        run->used += val_size;
+        stats->records++;
+        stats->bytes += sizeof(int64_t) + sizeof(uint16_t) + val_size;
+      }
+      if (run->recs.empty()) {
+        free(run->data);
+        delete run;
+        continue;
+      }
+      round.push_back(run);
+    }
+    stats->read_sec += ingest_now() - start;
+    if (ret) {
+      for (uint64_t i = 0; i < round.size(); i++) {
+        free(round[i]->data);
+        delete round[i];
+      }
+      break;
+    }
+
+    start = ingest_now();
+    spill = !eof || !runs.empty();
+    workers.resize(round.size());
+    for (uint64_t i = 0; i < round.size(); i++) {
+      round[i]->spill = spill;
+      snprintf(round[i]->path, sizeof(round[i]->path), "%s/ingest_%d_%lu.run",
+               opt->tmp_dir ? opt->tmp_dir : ".", getpid(), runs.size() + i);
+      pthread_create(&workers[i], NULL, ingest_sort_run, round[i]);
+    }
+    for (uint64_t i = 0; i < round.size(); i++) {
+      pthread_join(workers[i], NULL);
+      if (round[i]->failed) ret = 1;
+      if (spill) {
+        free(round[i]->data);
+        round[i]->data = nullptr;
+        std::vector<ingest_rec_t>().swap(round[i]->recs);
+      }
+      runs.push_back(round[i]);
+    }
+    stats->sort_sec += ingest_now() - start;
+    if (ret) break;
+  }
+  fclose(in);
+  delete[] value;
+
+  if (!ret) {
+    stats->runs = runs.size();
+    state.last_key = 0;
+    state.emitted = false;
+    state.stats = stats;
+    for (uint64_t i = 0; i < runs.size() && !ret; i++) {
+      source = new merge_source_t();
+      source->run = runs[i];
+      source->fp = runs[i]->spill ? fopen(runs[i]->path, "rb") : nullptr;
+      source->pos = 0;
+      source->value = new char[PGSIZE];
+      state.sources.push_back(source);
+      if (runs[i]->spill && !source->fp) {
+        ret = 1;
+        break;
+      }
+      r = merge_advance(source);
+      if (r < 0) ret = 1;
+      if (!r) state.heap.push({source->key, (int)i});
+    }
+
+    if (!ret) {
+      iter.next = merge_next;
+      iter.arg = &state;
+      start = ingest_now();
+      ret = db_bulk_load(table_id, &iter, opt->fill_percent);
+      stats->build_sec = ingest_now() - start - stats->merge_sec;
+    }
+
+    for (uint64_t i = 0; i < state.sources.size(); i++) {
+      if (state.sources[i]->fp) fclose(state.sources[i]->fp);
+      delete[] state.sources[i]->value;
+      delete state.sources[i];
+    }
+  }
+
+  for (uint64_t i = 0; i < runs.size(); i++) {
+    if (runs[i]->spill) remove(runs[i]->path);
+    free(runs[i]->data);
+    delete runs[i];
+  }
+
+  return ret;
+}
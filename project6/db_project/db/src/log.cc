@@ -54,19 +54,21 @@ int init_log(int flag, int log_num, char* log_path, char* logmsg_path) {
 
 int last_trx_id() { return header_log->last_trx_id; }
 
+static void flush_log_buffer() {
+  pwrite(logFD, log_buffer, buff_pos, header_log->flushed_LSN);
+  header_log->flushed_LSN += buff_pos;
+  pwrite(logFD, header_log, HEADERLOG, 0);
+  fsync(logFD);
+
+  buff_pos = 0;
+  memset(log_buffer, 0, LOGBUFFSIZE);
+}
+
 void push_log_to_buffer(main_log_t* main_log, update_log_t* update_log,
                         char* old_img, char* new_img, LSN_t next_undo_LSN) {
   uint16_t valsize;
 
-  if (buff_pos >= LOGTHRESHOLD) {
-    pwrite(logFD, log_buffer, buff_pos, header_log->flushed_LSN);
-    header_log->flushed_LSN += buff_pos;
-    pwrite(logFD, header_log, HEADERLOG, 0);
-    fsync(logFD);
-
-    buff_pos = 0;
-    memset(log_buffer, 0, LOGBUFFSIZE);
-  }
+  if (buff_pos >= LOGTHRESHOLD) flush_log_buffer();
 
   memcpy(log_buffer + buff_pos, main_log, MAINLOG);
   buff_pos += MAINLOG;
@@ -92,6 +94,35 @@ void push_log_to_buffer(main_log_t* main_log, update_log_t* update_log,
   UNLOCK(log_mutex);
 }
 
+// An UPDATE whose new image comes in pieces, copied straight into the
+// buffer. old_img is read in place, typically from the latched page, and
+// nothing is freed but the two headers.
+void push_update_log_v(main_log_t* main_log, update_log_t* update_log,
+                       const char* old_img, const struct iovec* iov,
+                       int iovcnt) {
+  uint16_t valsize = update_log->valsize;
+
+  if (buff_pos >= LOGTHRESHOLD ||
+      buff_pos + MAINLOG + UPDATELOG + 2 * valsize > LOGBUFFSIZE)
+    flush_log_buffer();
+
+  memcpy(log_buffer + buff_pos, main_log, MAINLOG);
+  buff_pos += MAINLOG;
+  memcpy(log_buffer + buff_pos, update_log, UPDATELOG);
+  buff_pos += UPDATELOG;
+  memcpy(log_buffer + buff_pos, old_img, valsize);
+  buff_pos += valsize;
+  for (int i = 0; i < iovcnt; i++) {
+    memcpy(log_buffer + buff_pos, iov[i].iov_base, iov[i].iov_len);
+    buff_pos += iov[i].iov_len;
+  }
+
+  delete update_log;
+  delete main_log;
+
+  UNLOCK(log_mutex);
+}
+
 main_log_t* make_main_log(int trx_id, int type, int log_size, LSN_t prev_LSN) {
   main_log_t* main_log;
 
@@ -0,0 +1,130 @@
+#include "rowcache.h"
+#include "bloom.h"
+#include <string.h>
+
+rowcache_t* row_cache = nullptr;
+
+static rowcache_shard_t* rowcache_shard(int64_t table_id, int64_t key) {
+  return &row_cache->shards[bloom_hash(key ^ (table_id << 48)) %
+                            ROWCACHE_SHARDS];
+}
+
+static void rowcache_evict(rowcache_shard_t* shard, uint64_t capacity) {
+  while (shard->bytes > capacity) {
+    rowcache_entry_t& e = shard->lru.back();
+    shard->bytes -= e.value.size() + ROWCACHE_ENTRY_COST;
+    shard->map.erase({e.table_id, e.key});
+    shard->lru.pop_back();
+    __atomic_add_fetch(&row_cache->stats.evictions, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// The cache is created once and only resized afterwards, readers never see
+// it go away before shutdown. A capacity of 0 empties it and keeps it off.
+void rowcache_resize(uint64_t capacity) {
+  if (!row_cache) {
+    if (!capacity) return;
+    row_cache = new rowcache_t();
+    for (int i = 0; i < ROWCACHE_SHARDS; i++)
+      row_cache->shards[i].mutex = PTHREAD_MUTEX_INITIALIZER;
+  }
+  __atomic_store_n(&row_cache->shard_capacity, capacity / ROWCACHE_SHARDS,
+                   __ATOMIC_RELAXED);
+  for (int i = 0; i < ROWCACHE_SHARDS; i++) {
+    pthread_mutex_lock(&row_cache->shards[i].mutex);
+    rowcache_evict(&row_cache->shards[i], capacity / ROWCACHE_SHARDS);
+    pthread_mutex_unlock(&row_cache->shards[i].mutex);
+  }
+}
+
+void rowcache_destroy() {
+  delete row_cache;
+  row_cache = nullptr;
+}
+
+bool rowcache_get(int64_t table_id, int64_t key, char* value,
+                  uint16_t* val_size) {
+  rowcache_shard_t* shard;
+  bool hit = false;
+
+  if (!row_cache || !__atomic_load_n(&row_cache->shard_capacity,
+                                     __ATOMIC_RELAXED))
+    return false;
+  shard = rowcache_shard(table_id, key);
+  pthread_mutex_lock(&shard->mutex);
+  auto it = shard->map.find({table_id, key});
+  if (it != shard->map.end()) {
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    memcpy(value, it->second->value.data(), it->second->value.size());
+    *val_size = it->second->value.size();
+    hit = true;
+  }
+  pthread_mutex_unlock(&shard->mutex);
+  __atomic_add_fetch(hit ? &row_cache->stats.hits : &row_cache->stats.misses,
+                     1, __ATOMIC_RELAXED);
+
+  return hit;
+}
+
+// Taken before the leaf is read, for rowcache_put.
+uint64_t rowcache_epoch(int64_t table_id, int64_t key) {
+  if (!row_cache) return 0;
+  return __atomic_load_n(&rowcache_shard(table_id, key)->epoch,
+                         __ATOMIC_ACQUIRE);
+}
+
+void rowcache_put(int64_t table_id, int64_t key, char* value,
+                  uint16_t val_size, uint64_t epoch) {
+  rowcache_shard_t* shard;
+  uint64_t capacity;
+
+  if (!row_cache || val_size > ROWCACHE_MAX_VALUE) return;
+  capacity = __atomic_load_n(&row_cache->shard_capacity, __ATOMIC_RELAXED);
+  if (val_size + ROWCACHE_ENTRY_COST > capacity) return;
+  shard = rowcache_shard(table_id, key);
+  pthread_mutex_lock(&shard->mutex);
+  if (shard->epoch == epoch &&
+      shard->map.find({table_id, key}) == shard->map.end()) {
+    shard->lru.push_front({table_id, key, std::string(value, val_size)});
+    shard->map[{table_id, key}] = shard->lru.begin();
+    shard->bytes += val_size + ROWCACHE_ENTRY_COST;
+    rowcache_evict(shard, capacity);
+  }
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+// Called once the record is changed in its page, so a reader that saw the
+// old value is refused by the epoch.
+void rowcache_invalidate(int64_t table_id, int64_t key) {
+  rowcache_shard_t* shard;
+
+  if (!row_cache) return;
+  shard = rowcache_shard(table_id, key);
+  pthread_mutex_lock(&shard->mutex);
+  __atomic_store_n(&shard->epoch, shard->epoch + 1, __ATOMIC_RELEASE);
+  auto it = shard->map.find({table_id, key});
+  if (it != shard->map.end()) {
+    shard->bytes -= it->second->value.size() + ROWCACHE_ENTRY_COST;
+    shard->lru.erase(it->second);
+    shard->map.erase(it);
+    __atomic_add_fetch(&row_cache->stats.invalidations, 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&shard->mutex);
+}
+
+void rowcache_get_stats(rowcache_stats_t* stats) {
+  memset(stats, 0x00, sizeof(rowcache_stats_t));
+  if (!row_cache) return;
+  stats->hits = __atomic_load_n(&row_cache->stats.hits, __ATOMIC_RELAXED);
+  stats->misses = __atomic_load_n(&row_cache->stats.misses, __ATOMIC_RELAXED);
+  stats->evictions =
+      __atomic_load_n(&row_cache->stats.evictions, __ATOMIC_RELAXED);
+  stats->invalidations =
+      __atomic_load_n(&row_cache->stats.invalidations, __ATOMIC_RELAXED);
+  for (int i = 0; i < ROWCACHE_SHARDS; i++) {
+    pthread_mutex_lock(&row_cache->shards[i].mutex);
+    stats->entries += row_cache->shards[i].map.size();
+    stats->bytes += row_cache->shards[i].bytes;
+    pthread_mutex_unlock(&row_cache->shards[i].mutex);
+  }
+}
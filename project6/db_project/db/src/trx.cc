@@ -1,4 +1,5 @@
 #include "trx.h"
+#include "rowcache.h"
 
 lock_table_t lock_table;
 trx_table_t trx_table;
@@ -6,7 +7,8 @@ pthread_mutex_t lock_mutex;
 pthread_mutex_t trx_mutex;
 int next_trx_id = 0;
 
-lock_t* give_lock(int64_t key, uint64_t bitmap, int trx_id, bool lock_mode) {
+lock_t* give_lock(int64_t key, uint32_t word, uint64_t bitmap, int trx_id,
+                  bool lock_mode) {
   lock_t* lock;
 
   lock = new lock_t;
@@ -15,6 +17,7 @@ lock_t* give_lock(int64_t key, uint64_t bitmap, int trx_id, bool lock_mode) {
   lock->sent_point = nullptr;
   lock->cond = PTHREAD_COND_INITIALIZER;
   lock->key = key;
+  lock->word = word;
   lock->bitmap = bitmap;
   lock->owner_trx_id = trx_id;
   lock->lock_mode = lock_mode;
@@ -22,6 +25,10 @@ lock_t* give_lock(int64_t key, uint64_t bitmap, int trx_id, bool lock_mode) {
   return lock;
 }
 
+bool lock_overlaps(lock_t* lock, uint32_t word, uint64_t bitmap) {
+  return lock->word == word && (lock->bitmap & bitmap);
+}
+
 entry_t* give_entry(int64_t table_id, pagenum_t page_id) {
   entry_t* entry;
 
@@ -151,14 +158,13 @@ int trx_abort(int trx_id) {
     
     page = buffer_read_page(table_id, page_id, &page_idx, WRITE);
 
-    for(i=0; i<page->info.num_keys; i++)
-      if(page->leafbody.slot[i].key == key) break;
+    i = leaf_search(page, key);
     size = undo->val_size;
-    offset = page->leafbody.slot[i].offset - 128;
+    offset = leaf_value(page, i) - page->leafbody.value;
 
     main_log = make_main_log(trx_id, COMPENSATE, MAINLOG + UPDATELOG + 2 * size + 8, trx->last_LSN);
     update_log = make_update_log(table_id, page_id, size, offset + 128);
-    page->LSN = main_log->LSN;
+    trx->last_LSN = page->LSN = main_log->LSN;
     old_img = new char[size + 2];
     new_img = new char[size + 2];
     for (int k = 0; k < size; k++) {
@@ -168,12 +174,12 @@ int trx_abort(int trx_id) {
     next_undo_LSN = (trx->undo_stack.empty()) ? 0 : trx->undo_stack.top()->LSN;
     push_log_to_buffer(main_log, update_log, old_img, new_img, next_undo_LSN);
 
-    trx->last_LSN = main_log->LSN;
-    page->leafbody.slot[i].size = size;
+    if (!page->value_size) slotted_leaf::set_size(page, i, size);
 
     for (int k = offset, l = 0; k < offset + size; l++, k++)
       page->leafbody.value[k] = undo->old_value[l];
     buffer_write_page(table_id, page_id, page_idx, 1);
+    rowcache_invalidate(table_id, key);
 
     delete[] undo->old_value;
     delete undo;
@@ -284,6 +290,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
   lock_t* impl_lock;
   trx_t* trx;
   trx_t* impl_trx;
+  uint32_t word;
   uint64_t bitmap;
   int impl_trx_id;
   bool other_Slock;
@@ -297,8 +304,9 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
   conflict_lock = nullptr;
   conflict = false;
   trx = trx_table[trx_id];
+  word = WORD(kindex);
   bitmap = MASK(kindex);
-  new_lock = give_lock(key, bitmap, trx_id, lock_mode);
+  new_lock = give_lock(key, word, bitmap, trx_id, lock_mode);
 
   lock_it = lock_table.find({table_id, page_id});
   if (lock_it == lock_table.end()) {
@@ -315,7 +323,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
     other_Slock = false;
     point = entry->head;
     while (point) {
-      if (point->bitmap & bitmap) {
+      if (lock_overlaps(point, word, bitmap)) {
         if (point->owner_trx_id == trx_id) {
           delete new_lock;
           trx->wait_trx_id = 0;
@@ -329,7 +337,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
         } else
           other_Slock = true;
       } else if ((point->owner_trx_id == trx_id) &&
-                 (point->lock_mode == SHARED))
+                 (point->lock_mode == SHARED) && (point->word == word))
         comp_Slock = point;
       point = point->lock_next;
     }
@@ -349,7 +357,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
         return page_idx;
       }
 
-      impl_trx_id = page->leafbody.slot[kindex].trx_id;
+      impl_trx_id = leaf_trx_id(page, kindex);
 
       LOCK(trx_mutex);
       if (impl_trx_id == trx_id)
@@ -378,7 +386,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
         return page_idx;
       }
 
-      impl_lock = give_lock(key, bitmap, impl_trx_id, EXCLUSIVE);
+      impl_lock = give_lock(key, word, bitmap, impl_trx_id, EXCLUSIVE);
       impl_trx = trx_table[impl_trx_id];
       impl_lock->sent_point = entry;
       append_lock(entry, impl_lock, impl_trx);
@@ -389,7 +397,8 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
     append_lock(entry, new_lock, trx);
     point = conflict_lock;
     do {
-      if ((point->bitmap & bitmap) && (point->lock_mode == EXCLUSIVE)) {
+      if (lock_overlaps(point, word, bitmap) &&
+          (point->lock_mode == EXCLUSIVE)) {
         trx->wait_trx_id = point->owner_trx_id;
         if (deadlock_detect(trx_id)) { 
           buffer_write_page(table_id, page_id, page_idx, 0);
@@ -416,7 +425,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
   my_SX = false;
   point = entry->head;
   while (point) {
-    if (point->bitmap & bitmap) {
+    if (lock_overlaps(point, word, bitmap)) {
       if (point->owner_trx_id == trx_id) {
         if (point->lock_mode == EXCLUSIVE) {
           delete new_lock;
@@ -442,7 +451,7 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
       return page_idx;
     }
 
-    impl_trx_id = page->leafbody.slot[kindex].trx_id;
+    impl_trx_id = leaf_trx_id(page, kindex);
 
     LOCK(trx_mutex);
     if (impl_trx_id == trx_id)
@@ -458,14 +467,16 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
       return page_idx;
     }
     if (no_impl) {
-      page->leafbody.slot[kindex].trx_id = trx_id;
+      // A tombstone keeps its mark, the caller sees the record is gone.
+      if (!leaf_is_tombstone(page, kindex))
+        leaf_set_trx_id(page, kindex, trx_id);
       trx->wait_trx_id = 0;
       append_lock(entry, new_lock, trx);
       UNLOCK(lock_mutex);
       return page_idx;
     }
 
-    impl_lock = give_lock(key, bitmap, impl_trx_id, EXCLUSIVE);
+    impl_lock = give_lock(key, word, bitmap, impl_trx_id, EXCLUSIVE);
     impl_trx = trx_table[impl_trx_id];
     impl_lock->sent_point = entry;
     append_lock(entry, impl_lock, impl_trx);
@@ -476,7 +487,8 @@ int lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int kindex,
   append_lock(entry, new_lock, trx);
   point = conflict_lock;
   do {
-    if ((point->bitmap & bitmap) && (point->owner_trx_id != trx_id)) {
+    if (lock_overlaps(point, word, bitmap) &&
+        (point->owner_trx_id != trx_id)) {
       trx->wait_trx_id = point->owner_trx_id;
       if (deadlock_detect(trx_id)) {
         buffer_write_page(table_id, page_id, page_idx, 0);
@@ -0,0 +1,561 @@
+#include "varkey.h"
+#include <stddef.h>
+
+#define VAR_BODY 3968
+
+int64_t open_var_table(char* pathname) {
+  int64_t table_id;
+  tree_t* tree;
+  page_t* header;
+  int32_t header_idx;
+
+  table_id = file_open_via_buffer(pathname);
+  if (table_id < 0) return table_id;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  if (header->flags & TREE_VARKEY) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+  } else if (header->root_num || header->flags) {
+    buffer_write_page(table_id, 0, header_idx, 0);
+    table_id = -1;
+  } else {
+    header->flags |= TREE_VARKEY;
+    tree->flags = header->flags;
+    buffer_write_page(table_id, 0, header_idx, 1);
+  }
+  UNLOCK(tree->latch);
+
+  return table_id;
+}
+
+// Node format
+char* var_body(page_t* page) {
+  return (char*)page + offsetof(page_t, leafbody);
+}
+
+uint16_t var_prefix_len(page_t* page) { return *(uint16_t*)var_body(page); }
+
+varslot_t* var_slots(page_t* page) {
+  return (varslot_t*)(var_body(page) + sizeof(uint16_t) + var_prefix_len(page));
+}
+
+int var_compare(const char* a, uint32_t a_len, const char* b, uint32_t b_len) {
+  int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+  if (c) return c;
+  return (a_len > b_len) - (a_len < b_len);
+}
+
+// Entries are sorted, so the first and the last key share the prefix of
+// every key in between.
+uint32_t var_common_prefix(std::vector<var_entry_t>& entries, uint32_t begin,
+                           uint32_t end) {
+  std::string& first = entries[begin].key;
+  std::string& last = entries[end - 1].key;
+  uint32_t len = 0;
+
+  if (begin == end) return 0;
+  while (len < first.size() && len < last.size() && first[len] == last[len])
+    len++;
+  return len;
+}
+
+uint32_t var_encoded_size(std::vector<var_entry_t>& entries, uint32_t begin,
+                          uint32_t end) {
+  uint32_t prefix_len = begin < end ? var_common_prefix(entries, begin, end) : 0;
+  uint32_t size = sizeof(uint16_t) + prefix_len;
+
+  for (uint32_t i = begin; i < end; i++)
+    size += sizeof(varslot_t) + entries[i].key.size() - prefix_len +
+            entries[i].value.size();
+  return size;
+}
+
+// Rewrites the node with entries [begin, end), or returns 1 and leaves it
+// alone when they do not fit.
+int var_encode(page_t* page, std::vector<var_entry_t>& entries, uint32_t begin,
+               uint32_t end) {
+  char buf[VAR_BODY];
+  uint32_t size, offset = VAR_BODY, suffix_len;
+  uint16_t prefix_len;
+  varslot_t* slot;
+
+  size = var_encoded_size(entries, begin, end);
+  if (size > VAR_BODY) return 1;
+  prefix_len = begin < end ? var_common_prefix(entries, begin, end) : 0;
+
+  *(uint16_t*)buf = prefix_len;
+  if (prefix_len) memcpy(buf + sizeof(uint16_t), entries[begin].key.data(), prefix_len);
+  slot = (varslot_t*)(buf + sizeof(uint16_t) + prefix_len);
+  for (uint32_t i = begin; i < end; i++, slot++) {
+    suffix_len = entries[i].key.size() - prefix_len;
+    offset -= suffix_len + entries[i].value.size();
+    memcpy(buf + offset, entries[i].key.data() + prefix_len, suffix_len);
+    memcpy(buf + offset + suffix_len, entries[i].value.data(),
+           entries[i].value.size());
+    slot->offset = offset;
+    slot->key_len = suffix_len;
+    slot->val_size = entries[i].value.size();
+  }
+
+  memcpy(var_body(page), buf, VAR_BODY);
+  page->info.num_keys = end - begin;
+  page->freespace = VAR_BODY - size;
+  return 0;
+}
+
+void var_decode(page_t* page, std::vector<var_entry_t>& entries) {
+  char* body = var_body(page);
+  uint16_t prefix_len = var_prefix_len(page);
+  varslot_t* slots = var_slots(page);
+
+  entries.resize(page->info.num_keys);
+  for (uint32_t i = 0; i < page->info.num_keys; i++) {
+    entries[i].key.assign(body + sizeof(uint16_t), prefix_len);
+    entries[i].key.append(body + slots[i].offset, slots[i].key_len);
+    entries[i].value.assign(body + slots[i].offset + slots[i].key_len,
+                            slots[i].val_size);
+  }
+}
+
+// First slot whose key is not below key, or above it with upper. The
+// prefix is compared once, the search itself only looks at suffixes.
+uint32_t var_lower_bound(page_t* page, const char* key, uint16_t key_len,
+                         bool upper) {
+  char* body = var_body(page);
+  uint16_t prefix_len = var_prefix_len(page);
+  varslot_t* slots = var_slots(page);
+  uint32_t lo = 0, hi = page->info.num_keys, mid;
+  int c;
+
+  c = memcmp(body + sizeof(uint16_t), key,
+             prefix_len < key_len ? prefix_len : key_len);
+  if (c > 0 || (!c && key_len < prefix_len)) return 0;
+  if (c < 0) return page->info.num_keys;
+
+  key += prefix_len;
+  key_len -= prefix_len;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    c = var_compare(body + slots[mid].offset, slots[mid].key_len, key, key_len);
+    if (c < 0 || (upper && !c))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+pagenum_t var_child(page_t* page, int index) {
+  varslot_t* slot;
+  pagenum_t child;
+
+  if (index < 0) return page->leftmost;
+  slot = &var_slots(page)[index];
+  memcpy(&child, var_body(page) + slot->offset + slot->key_len, sizeof(child));
+  return child;
+}
+
+pagenum_t var_find_leaf(int64_t table_id, const char* key, uint16_t key_len,
+                        std::vector<var_step_t>* path) {
+  pagenum_t page_num = get_root_num(table_id), child;
+  page_t* page;
+  int32_t page_idx;
+  int index;
+
+  while (page_num) {
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    if (page->info.isLeaf) {
+      buffer_write_page(table_id, page_num, page_idx, 0);
+      break;
+    }
+    index = (int)var_lower_bound(page, key, key_len, true) - 1;
+    child = var_child(page, index);
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    if (path) path->push_back({page_num, index});
+    page_num = child;
+  }
+  return page_num;
+}
+
+void var_set_root(int64_t table_id, pagenum_t root_num) {
+  page_t* header;
+  int32_t header_idx;
+
+  header = buffer_read_page(table_id, 0, &header_idx, WRITE);
+  header->root_num = root_num;
+  buffer_write_page(table_id, 0, header_idx, 1);
+}
+
+bool var_check(int64_t table_id, uint16_t key_len) {
+  return isValid(table_id) && key_len && key_len <= VAR_MAX_KEY &&
+         (give_tree(table_id)->flags & TREE_VARKEY);
+}
+
+int var_find(int64_t table_id, const char* key, uint16_t key_len, char* ret_val,
+             uint16_t* val_size) {
+  tree_t* tree;
+  page_t* leaf;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  varslot_t* slot;
+  uint32_t index;
+  uint16_t prefix_len;
+  int ret = 1;
+
+  if (!var_check(table_id, key_len)) return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  leaf_num = var_find_leaf(table_id, key, key_len, nullptr);
+  if (leaf_num) {
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    index = var_lower_bound(leaf, key, key_len, false);
+    prefix_len = var_prefix_len(leaf);
+    slot = &var_slots(leaf)[index];
+    if (index < leaf->info.num_keys && prefix_len + slot->key_len == key_len &&
+        !memcmp(var_body(leaf) + slot->offset, key + prefix_len,
+                slot->key_len)) {
+      memcpy(ret_val, var_body(leaf) + slot->offset + slot->key_len,
+             slot->val_size);
+      *val_size = slot->val_size;
+      ret = 0;
+    }
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+int var_scan(int64_t table_id, const char* lo, uint16_t lo_len, const char* hi,
+             uint16_t hi_len, var_scan_callback_t callback, void* arg) {
+  tree_t* tree;
+  page_t* leaf;
+  pagenum_t leaf_num, next;
+  int32_t leaf_idx;
+  varslot_t* slot;
+  char key[VAR_MAX_KEY];
+  uint32_t index;
+  uint16_t prefix_len, key_len;
+  bool done = false;
+
+  if (!isValid(table_id) || !(give_tree(table_id)->flags & TREE_VARKEY))
+    return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  leaf_num = var_find_leaf(table_id, lo, lo_len, nullptr);
+  index = 0;
+  if (leaf_num) {
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    index = var_lower_bound(leaf, lo, lo_len, false);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+  }
+  while (leaf_num && !done) {
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    prefix_len = var_prefix_len(leaf);
+    memcpy(key, var_body(leaf) + sizeof(uint16_t), prefix_len);
+    for (; index < leaf->info.num_keys && !done; index++) {
+      slot = &var_slots(leaf)[index];
+      memcpy(key + prefix_len, var_body(leaf) + slot->offset, slot->key_len);
+      key_len = prefix_len + slot->key_len;
+      if (hi && var_compare(key, key_len, hi, hi_len) > 0) {
+        done = true;
+        break;
+      }
+      done = callback(key, key_len,
+                      var_body(leaf) + slot->offset + slot->key_len,
+                      slot->val_size, arg);
+    }
+    next = leaf->Rsibling;
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+    leaf_num = next;
+    index = 0;
+  }
+  UNLOCK(tree->latch);
+
+  return 0;
+}
+
+// Insert
+// Shortest prefix of right that still sorts above left.
+std::string var_separator(const std::string& left, const std::string& right) {
+  uint32_t len = 0;
+
+  while (len < left.size() && left[len] == right[len]) len++;
+  return right.substr(0, len + 1);
+}
+
+// Splits by encoded size, moving away from the middle until both halves
+// fit. A leaf keeps [0, m) and gives away [m, n); an internal node also
+// promotes entry m.
+uint32_t var_split_point(std::vector<var_entry_t>& entries, bool internal) {
+  uint32_t n = entries.size(), half, total = 0, middle, m;
+
+  for (uint32_t i = 0; i < n; i++)
+    total += entries[i].key.size() + entries[i].value.size();
+  half = 0;
+  for (middle = 0; middle + 1 < n && half < total / 2; middle++)
+    half += entries[middle].key.size() + entries[middle].value.size();
+  if (!internal && !middle) middle = 1;
+
+  for (uint32_t d = 0; d < n; d++) {
+    for (int side = -1; side <= 1; side += 2) {
+      if (side < 0 ? d > middle : middle + d >= n) continue;
+      m = side < 0 ? middle - d : middle + d;
+      if (!internal && !m) continue;
+      if (var_encoded_size(entries, 0, m) <= VAR_BODY &&
+          var_encoded_size(entries, m + internal, n) <= VAR_BODY)
+        return m;
+    }
+  }
+  return middle;
+}
+
+int var_insert_into_parent(int64_t table_id, std::vector<var_step_t>& path,
+                           int level, pagenum_t left_num,
+                           const std::string& key, pagenum_t right_num) {
+  std::vector<var_entry_t> entries;
+  var_entry_t entry;
+  page_t* page;
+  pagenum_t page_num, leftmost;
+  int32_t page_idx;
+
+  entry.key = key;
+  entry.value.assign((char*)&right_num, sizeof(right_num));
+  if (level < 0) {
+    page_num = buffer_alloc_page(table_id);
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    page->info.isLeaf = 0;
+    page->leftmost = left_num;
+    entries.push_back(entry);
+    var_encode(page, entries, 0, 1);
+    buffer_write_page(table_id, page_num, page_idx, 1);
+    var_set_root(table_id, page_num);
+    return 0;
+  }
+
+  page = buffer_read_page(table_id, path[level].page_num, &page_idx, WRITE);
+  var_decode(page, entries);
+  leftmost = page->leftmost;
+  buffer_write_page(table_id, path[level].page_num, page_idx, 0);
+
+  entries.insert(entries.begin() + path[level].index + 1, entry);
+  return var_store_internal(table_id, path, level, leftmost, entries);
+}
+
+int var_store_internal(int64_t table_id, std::vector<var_step_t>& path,
+                       int level, pagenum_t leftmost,
+                       std::vector<var_entry_t>& entries) {
+  page_t *page, *new_page;
+  pagenum_t page_num = path[level].page_num, new_num;
+  int32_t page_idx, new_idx;
+  uint32_t m;
+
+  page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+  page->leftmost = leftmost;
+  if (!var_encode(page, entries, 0, entries.size())) {
+    buffer_write_page(table_id, page_num, page_idx, 1);
+    return 0;
+  }
+
+  m = var_split_point(entries, true);
+  new_num = buffer_alloc_page(table_id);
+  new_page = buffer_read_page(table_id, new_num, &new_idx, WRITE);
+  new_page->info.isLeaf = 0;
+  memcpy(&new_page->leftmost, entries[m].value.data(), sizeof(pagenum_t));
+  var_encode(new_page, entries, m + 1, entries.size());
+  var_encode(page, entries, 0, m);
+  buffer_write_page(table_id, new_num, new_idx, 1);
+  buffer_write_page(table_id, page_num, page_idx, 1);
+
+  return var_insert_into_parent(table_id, path, level - 1, page_num,
+                                entries[m].key, new_num);
+}
+
+int var_store_leaf(int64_t table_id, std::vector<var_step_t>& path,
+                   pagenum_t leaf_num, std::vector<var_entry_t>& entries) {
+  page_t *leaf, *new_leaf;
+  pagenum_t new_num;
+  int32_t leaf_idx, new_idx;
+  uint32_t m;
+
+  leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+  if (!var_encode(leaf, entries, 0, entries.size())) {
+    buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+    return 0;
+  }
+
+  m = var_split_point(entries, false);
+  new_num = buffer_alloc_page(table_id);
+  new_leaf = buffer_read_page(table_id, new_num, &new_idx, WRITE);
+  new_leaf->info.isLeaf = 1;
+  new_leaf->Rsibling = leaf->Rsibling;
+  leaf->Rsibling = new_num;
+  var_encode(new_leaf, entries, m, entries.size());
+  var_encode(leaf, entries, 0, m);
+  buffer_write_page(table_id, new_num, new_idx, 1);
+  buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+
+  return var_insert_into_parent(table_id, path, path.size() - 1, leaf_num,
+                                var_separator(entries[m - 1].key,
+                                              entries[m].key),
+                                new_num);
+}
+
+int var_insert(int64_t table_id, const char* key, uint16_t key_len,
+               const char* value, uint16_t val_size) {
+  std::vector<var_step_t> path;
+  std::vector<var_entry_t> entries;
+  tree_t* tree;
+  page_t* leaf;
+  pagenum_t leaf_num;
+  int32_t leaf_idx;
+  uint32_t index;
+  int ret = 1;
+
+  if (!var_check(table_id, key_len) || val_size > VAR_MAX_VALUE) return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  leaf_num = var_find_leaf(table_id, key, key_len, &path);
+  if (!leaf_num) {
+    leaf_num = buffer_alloc_page(table_id);
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    leaf->info.isLeaf = 1;
+    leaf->Rsibling = 0;
+    entries.push_back({std::string(key, key_len), std::string(value, val_size)});
+    var_encode(leaf, entries, 0, 1);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+    var_set_root(table_id, leaf_num);
+    ret = 0;
+  } else {
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    index = var_lower_bound(leaf, key, key_len, false);
+    var_decode(leaf, entries);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+    if (index == entries.size() ||
+        entries[index].key.compare(0, std::string::npos, key, key_len)) {
+      entries.insert(entries.begin() + index,
+                     {std::string(key, key_len), std::string(value, val_size)});
+      ret = var_store_leaf(table_id, path, leaf_num, entries);
+    }
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
+
+// Delete
+// Leaf right before the one the path leads to, 0 when it is the first.
+pagenum_t var_prev_leaf(int64_t table_id, std::vector<var_step_t>& path) {
+  page_t* page;
+  pagenum_t page_num, child;
+  int32_t page_idx;
+  int level;
+
+  for (level = path.size() - 1; level >= 0; level--)
+    if (path[level].index >= 0) break;
+  if (level < 0) return 0;
+
+  page = buffer_read_page(table_id, path[level].page_num, &page_idx, WRITE);
+  page_num = var_child(page, path[level].index - 1);
+  buffer_write_page(table_id, path[level].page_num, page_idx, 0);
+  while (true) {
+    page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+    if (page->info.isLeaf) {
+      buffer_write_page(table_id, page_num, page_idx, 0);
+      return page_num;
+    }
+    child = var_child(page, (int)page->info.num_keys - 1);
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    page_num = child;
+  }
+}
+
+// Drops the child the path took at level, whose subtree has become empty.
+// Nodes are only removed once they have no child left, and a root with a
+// single child hands the tree to it.
+void var_remove_child(int64_t table_id, std::vector<var_step_t>& path,
+                      int level) {
+  std::vector<var_entry_t> entries;
+  page_t* page;
+  pagenum_t page_num = path[level].page_num;
+  int32_t page_idx;
+  int index = path[level].index;
+
+  page = buffer_read_page(table_id, page_num, &page_idx, WRITE);
+  var_decode(page, entries);
+  if (index < 0 && entries.empty()) {
+    if (!level) var_set_root(table_id, 0);
+    buffer_free_page(table_id, page_num, page_idx);
+    if (level) var_remove_child(table_id, path, level - 1);
+    return;
+  }
+  if (index < 0) {
+    memcpy(&page->leftmost, entries[0].value.data(), sizeof(pagenum_t));
+    index = 0;
+  }
+  entries.erase(entries.begin() + index);
+  var_encode(page, entries, 0, entries.size());
+
+  if (!level && entries.empty()) {
+    var_set_root(table_id, page->leftmost);
+    buffer_free_page(table_id, page_num, page_idx);
+  } else
+    buffer_write_page(table_id, page_num, page_idx, 1);
+}
+
+int var_delete(int64_t table_id, const char* key, uint16_t key_len) {
+  std::vector<var_step_t> path;
+  std::vector<var_entry_t> entries;
+  tree_t* tree;
+  page_t *leaf, *prev;
+  pagenum_t leaf_num, prev_num, next;
+  int32_t leaf_idx, prev_idx;
+  uint32_t index;
+  int ret = 1;
+
+  if (!var_check(table_id, key_len)) return 1;
+  tree = give_tree(table_id);
+
+  LOCK(tree->latch);
+  leaf_num = var_find_leaf(table_id, key, key_len, &path);
+  if (leaf_num) {
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    index = var_lower_bound(leaf, key, key_len, false);
+    var_decode(leaf, entries);
+    if (index == entries.size() ||
+        entries[index].key.compare(0, std::string::npos, key, key_len)) {
+      buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+    } else if (entries.size() > 1) {
+      entries.erase(entries.begin() + index);
+      var_encode(leaf, entries, 0, entries.size());
+      buffer_write_page(table_id, leaf_num, leaf_idx, 1);
+      ret = 0;
+    } else if (path.empty()) {
+      var_set_root(table_id, 0);
+      buffer_free_page(table_id, leaf_num, leaf_idx);
+      ret = 0;
+    } else {
+      // The leaf is left empty; unlink it from the leaf chain and drop it.
+      next = leaf->Rsibling;
+      buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+      if ((prev_num = var_prev_leaf(table_id, path))) {
+        prev = buffer_read_page(table_id, prev_num, &prev_idx, WRITE);
+        prev->Rsibling = next;
+        buffer_write_page(table_id, prev_num, prev_idx, 1);
+      }
+      leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+      buffer_free_page(table_id, leaf_num, leaf_idx);
+      var_remove_child(table_id, path, path.size() - 1);
+      ret = 0;
+    }
+  }
+  UNLOCK(tree->latch);
+
+  return ret;
+}
@@ -0,0 +1,84 @@
+// ingest tool: external-sort an unsorted (key, value) file into a table
+
+#include "ingest.h"
+
+void print_stage(const char* stage, uint64_t records, uint64_t bytes,
+                 double sec) {
+  if (sec <= 0) sec = 1e-9;
+  printf("%-8s %10.3f s %12.0f rec/s %10.2f MB/s\n", stage, sec,
+         records / sec, bytes / sec / (1 << 20));
+}
+
+int main(int argc, char** argv) {
+  ingest_opt_t opt;
+  ingest_stats_t stats;
+  char log_path[] = "ingest.log";
+  char logmsg_path[] = "ingest.msg";
+  int64_t table_id;
+  int buf_num = 1000;
+  int c;
+
+  opt.format = INGEST_BINARY;
+  opt.num_threads = 4;
+  opt.mem_limit = 256UL << 20;
+  opt.fill_percent = 100;
+  opt.tmp_dir = ".";
+
+  while ((c = getopt(argc, argv, "ct:m:f:b:d:")) != -1) {
+    switch (c) {
+      case 'c':
+        opt.format = INGEST_CSV;
+        break;
+      case 't':
+        opt.num_threads = atoi(optarg);
+        break;
+      case 'm':
+        opt.mem_limit = strtoull(optarg, NULL, 10) << 20;
+        break;
+      case 'f':
+        opt.fill_percent = atoi(optarg);
+        break;
+      case 'b':
+        buf_num = atoi(optarg);
+        break;
+      case 'd':
+        opt.tmp_dir = optarg;
+        break;
+      default:
+        argc = 0;
+        break;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr,
+            "usage: %s [-c] [-t threads] [-m mem_mb] [-f fill_percent] "
+            "[-b buffers] [-d tmp_dir] DATA<n> input\n",
+            argv[0]);
+    return 1;
+  }
+
+  init_db(buf_num, RECOVERY, NO_CRASH, log_path, logmsg_path);
+  if ((table_id = open_table(argv[optind])) < 0) {
+    fprintf(stderr, "cannot open table %s\n", argv[optind]);
+    shutdown_db();
+    return 1;
+  }
+  if (db_ingest(table_id, argv[optind + 1], &opt, &stats)) {
+    fprintf(stderr, "ingest failed\n");
+    shutdown_db();
+    return 1;
+  }
+  shutdown_db();
+
+  printf("%lu records, %lu duplicates, %lu runs\n", stats.records,
+         stats.duplicates, stats.runs);
+  print_stage("read", stats.records, stats.bytes, stats.read_sec);
+  print_stage("sort", stats.records, stats.bytes, stats.sort_sec);
+  print_stage("merge", stats.records, stats.bytes, stats.merge_sec);
+  print_stage("build", stats.records - stats.duplicates, stats.bytes,
+              stats.build_sec);
+  print_stage("total", stats.records, stats.bytes,
+              stats.read_sec + stats.sort_sec + stats.merge_sec +
+                  stats.build_sec);
+  return 0;
+}
@@ -0,0 +1,489 @@
+#include "bpt.h"
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_KEYS 100000
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int next_bench_record(void* arg, int64_t* key, char* value, uint16_t* val_size) {
+    int64_t* next_key = (int64_t*)arg;
+    if (*next_key >= BENCH_KEYS) return 1;
+    *key = (*next_key)++;
+    *val_size = sprintf(value, "value-%ld-abcdefghijklmnopqrstuvwxyz", *key) + 1;
+    return 0;
+}
+
+class BenchTest : public ::testing::Test {
+    protected:
+        BenchTest() {
+            remove(pathname);
+            remove(log_path);
+            init_db(5000, RECOVERY, NO_CRASH, log_path, logmsg_path);
+            table_id = open_table(pathname);
+        }
+
+        ~BenchTest() {
+            shutdown_db();
+            remove(pathname);
+            remove(log_path);
+            remove(logmsg_path);
+        }
+
+        void load() {
+            int64_t next_key = 0;
+            bulk_iterator_t iter = {next_bench_record, &next_key};
+            ASSERT_EQ(db_bulk_load(table_id, &iter, 100), 0);
+        }
+    int64_t table_id;
+    char pathname[8] = "DATA2";
+    char log_path[16] = "bench_test.log";
+    char logmsg_path[16] = "bench_test.msg";
+};
+
+TEST_F(BenchTest, FindBatchThroughput) {
+    const int batch = 128, rounds = 200;
+    std::vector<int64_t> keys(batch);
+    std::vector<std::vector<char>> buffers(batch, std::vector<char>(128));
+    std::vector<char*> ret_vals(batch);
+    std::vector<uint16_t> val_sizes(batch);
+    std::vector<int> results(batch);
+    double start, loop_sec, batch_sec;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    for (int i = 0; i < batch; i++) ret_vals[i] = buffers[i].data();
+
+    srand(1);
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        trx_id = trx_begin();
+        for (int i = 0; i < batch; i++)
+            ASSERT_EQ(db_find(table_id, rand() % BENCH_KEYS, ret_vals[i],
+                              &val_sizes[i], trx_id), 0);
+        trx_commit(trx_id);
+    }
+    loop_sec = now() - start;
+
+    srand(1);
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < batch; i++) keys[i] = rand() % BENCH_KEYS;
+        trx_id = trx_begin();
+        ASSERT_EQ(db_find_batch(table_id, keys.data(), batch, ret_vals.data(),
+                                val_sizes.data(), results.data(), trx_id), 0);
+        trx_commit(trx_id);
+        for (int i = 0; i < batch; i++) {
+            ASSERT_EQ(results[i], 0);
+            EXPECT_EQ(atoll(ret_vals[i] + 6), keys[i]);
+        }
+    }
+    batch_sec = now() - start;
+
+    printf("db_find loop  : %.0f keys/s\n", batch * rounds / loop_sec);
+    printf("db_find_batch : %.0f keys/s\n", batch * rounds / batch_sec);
+}
+
+typedef struct stress_arg_t {
+    int64_t table_id;
+    int64_t base;
+    int thread;
+    int num_threads;
+    int per_thread;
+    int failed;
+} stress_arg_t;
+
+// Keys of all threads interleave so they keep splitting and merging the
+// same leaves.
+static void* stress_insert(void* arg) {
+    stress_arg_t* a = (stress_arg_t*)arg;
+    char value[64];
+    int64_t key;
+
+    for (int i = 0; i < a->per_thread; i++) {
+        key = a->base + (int64_t)i * a->num_threads + a->thread;
+        sprintf(value, "value-%ld-abcdefghijklmnopqrstuvwxyz", key);
+        if (db_insert(a->table_id, key, value, strlen(value) + 1)) a->failed++;
+    }
+    return nullptr;
+}
+
+static void* stress_delete(void* arg) {
+    stress_arg_t* a = (stress_arg_t*)arg;
+
+    for (int i = 0; i < a->per_thread; i++) {
+        if (i % 3 == 0) continue;
+        if (db_delete(a->table_id, a->base + (int64_t)i * a->num_threads + a->thread))
+            a->failed++;
+    }
+    return nullptr;
+}
+
+static int count_keys(int64_t key, char*, uint16_t, void* arg) {
+    std::vector<int64_t>* keys = (std::vector<int64_t>*)arg;
+    keys->push_back(key);
+    return 0;
+}
+
+TEST_F(BenchTest, ConcurrentInsertDelete) {
+    const int per_thread = 20000;
+    int thread_counts[2] = {1, 4};
+    std::vector<pthread_t> threads;
+    std::vector<stress_arg_t> args;
+    std::vector<int64_t> keys;
+    double start, insert_sec, delete_sec;
+    int n, ops;
+
+    ASSERT_TRUE(table_id >= 0);
+    for (int t = 0; t < 2; t++) {
+        n = thread_counts[t];
+        threads.resize(n);
+        args.assign(n, {table_id, (int64_t)n * 10000000, 0, n, per_thread, 0});
+        for (int i = 0; i < n; i++) args[i].thread = i;
+
+        start = now();
+        for (int i = 0; i < n; i++)
+            pthread_create(&threads[i], nullptr, stress_insert, &args[i]);
+        for (int i = 0; i < n; i++) pthread_join(threads[i], nullptr);
+        insert_sec = now() - start;
+
+        start = now();
+        for (int i = 0; i < n; i++)
+            pthread_create(&threads[i], nullptr, stress_delete, &args[i]);
+        for (int i = 0; i < n; i++) pthread_join(threads[i], nullptr);
+        delete_sec = now() - start;
+
+        for (int i = 0; i < n; i++) EXPECT_EQ(args[i].failed, 0);
+
+        keys.clear();
+        ASSERT_EQ(db_scan(table_id, args[0].base, args[0].base + 10000000 - 1,
+                          count_keys, &keys, 0, 0), 0);
+        ASSERT_EQ(keys.size(), (size_t)n * ((per_thread + 2) / 3));
+        for (size_t i = 0; i < keys.size(); i++)
+            EXPECT_EQ(keys[i], args[0].base + (int64_t)(i / n) * 3 * n + i % n);
+
+        ops = n * per_thread;
+        printf("%d thread(s): insert %.0f ops/s, delete %.0f ops/s\n", n,
+               ops / insert_sec, (ops - n * ((per_thread + 2) / 3)) / delete_sec);
+    }
+}
+
+typedef struct mixed_arg_t {
+    int64_t table_id;
+    int seed;
+    volatile bool* stop;
+    int64_t reads;
+    int failed;
+} mixed_arg_t;
+
+static void* mixed_reader(void* arg) {
+    mixed_arg_t* a = (mixed_arg_t*)arg;
+    unsigned int seed = a->seed;
+    char value[128];
+    uint16_t val_size;
+    int trx_id;
+
+    while (!*a->stop) {
+        trx_id = trx_begin();
+        for (int i = 0; i < 100; i++) {
+            if (db_find(a->table_id, rand_r(&seed) % BENCH_KEYS, value, &val_size,
+                        trx_id))
+                a->failed++;
+        }
+        trx_commit(trx_id);
+        a->reads += 100;
+    }
+    return nullptr;
+}
+
+// Readers look up loaded keys while one writer appends past them, once with
+// latch coupling and once in B-link mode.
+TEST_F(BenchTest, MixedReadWrite) {
+    const int num_readers = 3;
+    const int64_t writes = 30000;
+    pthread_t threads[num_readers];
+    mixed_arg_t args[num_readers];
+    volatile bool stop;
+    char value[64];
+    double start, sec;
+    int64_t reads, base;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    for (int mode = 0; mode < 2; mode++) {
+        ASSERT_EQ(db_set_blink(table_id, mode), 0);
+        base = BENCH_KEYS + mode * writes;
+        stop = false;
+        for (int i = 0; i < num_readers; i++) {
+            args[i] = {table_id, i + 1, &stop, 0, 0};
+            pthread_create(&threads[i], nullptr, mixed_reader, &args[i]);
+        }
+
+        start = now();
+        for (int64_t key = base; key < base + writes; key++) {
+            sprintf(value, "value-%ld-abcdefghijklmnopqrstuvwxyz", key);
+            ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+        }
+        sec = now() - start;
+        stop = true;
+
+        reads = 0;
+        for (int i = 0; i < num_readers; i++) {
+            pthread_join(threads[i], nullptr);
+            EXPECT_EQ(args[i].failed, 0);
+            reads += args[i].reads;
+        }
+        printf("%s : %.0f reads/s, %.0f writes/s\n",
+               mode ? "b-link  " : "coupling", reads / sec, writes / sec);
+    }
+}
+
+// Searches internal nodes spread over more memory than the caches hold,
+// then whole lookups through the buffer pool, for each node layout.
+TEST_F(BenchTest, NodeLayoutLookup) {
+    const int num_nodes = 2048, probes = 1 << 20, lookups = 200000;
+    const uint16_t formats[3] = {PAGE_FORMAT_PAIRS, PAGE_FORMAT_SPLIT_KEYS,
+                                 PAGE_FORMAT_SPLIT_KEYS};
+    const uint16_t key_types[3] = {KEY_INT64, KEY_INT64, KEY_INT32};
+    const char* names[3] = {"pairs         ", "split keys    ",
+                            "split 32b keys"};
+    std::vector<page_t> nodes(num_nodes);
+    std::vector<int64_t> keys(probes);
+    std::vector<int> which(probes);
+    char value[128];
+    uint16_t val_size;
+    int64_t sum;
+    double start, node_sec, find_sec;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    srand(1);
+    for (int i = 0; i < probes; i++) {
+        keys[i] = rand() % (248 * 16);
+        which[i] = rand() % num_nodes;
+    }
+
+    for (int f = 0; f < 3; f++) {
+        for (int n = 0; n < num_nodes; n++) {
+            memset(&nodes[n], 0x00, sizeof(page_t));
+            nodes[n].flags = f ? NODE_SPLIT_KEYS : 0;
+            if (key_types[f] == KEY_INT32) nodes[n].flags |= NODE_KEY32;
+            nodes[n].info.num_keys = 248;
+            for (int i = 0; i < 248; i++) {
+                node_set_key(&nodes[n], i, i * 16);
+                node_child(&nodes[n], i) = i;
+            }
+        }
+        sum = 0;
+        start = now();
+        for (int i = 0; i < probes; i++)
+            sum += child_index(&nodes[which[i]], keys[i]);
+        node_sec = now() - start;
+        EXPECT_GT(sum, 0);
+
+        ASSERT_EQ(db_set_format(table_id, formats[f]), 0);
+        ASSERT_EQ(db_set_key_type(table_id, key_types[f]), 0);
+        load();
+        srand(2);
+        start = now();
+        for (int i = 0; i < lookups; i++) {
+            if (i % 128 == 0) trx_id = trx_begin();
+            ASSERT_EQ(db_find(table_id, rand() % BENCH_KEYS, value, &val_size,
+                              trx_id), 0);
+            if (i % 128 == 127 || i == lookups - 1) trx_commit(trx_id);
+        }
+        find_sec = now() - start;
+        for (int64_t key = 0; key < BENCH_KEYS; key++)
+            ASSERT_EQ(db_delete(table_id, key), 0);
+
+        printf("%s : child_index %.0f/s, db_find %.0f/s\n", names[f],
+               probes / node_sec, lookups / find_sec);
+    }
+}
+
+// Deletes two of every three keys in random order, then puts them back, so
+// leaves keep losing values from the middle of their value area.
+TEST_F(BenchTest, DeleteHeavy) {
+    std::vector<int64_t> keys;
+    char value[64];
+    double start, delete_sec, insert_sec;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    for (int64_t key = 0; key < BENCH_KEYS; key++)
+        if (key % 3) keys.push_back(key);
+    srand(3);
+    for (size_t i = keys.size() - 1; i > 0; i--)
+        std::swap(keys[i], keys[rand() % (i + 1)]);
+
+    start = now();
+    for (int64_t key : keys) ASSERT_EQ(db_delete(table_id, key), 0);
+    delete_sec = now() - start;
+
+    start = now();
+    for (int64_t key : keys) {
+        sprintf(value, "value-%ld-abcdefghijklmnopqrstuvwxyz", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    insert_sec = now() - start;
+
+    printf("delete : %.0f keys/s, reinsert : %.0f keys/s\n",
+           keys.size() / delete_sec, keys.size() / insert_sec);
+}
+
+TEST_F(BenchTest, BloomMissProbes) {
+    std::vector<int64_t> keys;
+    char value[64];
+    uint16_t val_size;
+    double start, plain_sec, bloom_sec;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    srand(5);
+    for (int i = 0; i < BENCH_KEYS; i++)
+        keys.push_back(BENCH_KEYS + rand() % (4 * BENCH_KEYS));
+
+    trx_id = trx_begin();
+    start = now();
+    for (int64_t key : keys)
+        ASSERT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+    plain_sec = now() - start;
+
+    ASSERT_EQ(db_set_bloom(table_id, BENCH_KEYS), 0);
+    start = now();
+    for (int64_t key : keys)
+        ASSERT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+    bloom_sec = now() - start;
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    EXPECT_EQ(db_set_bloom(table_id, 0), 0);
+
+    printf("missing keys : %.0f finds/s, with Bloom filter : %.0f finds/s\n",
+           keys.size() / plain_sec, keys.size() / bloom_sec);
+}
+
+TEST_F(BenchTest, HashPointLookups) {
+    const int lookups = 200000;
+    char hash_path[8] = "DATA3";
+    char value[64];
+    uint16_t val_size;
+    int64_t hash_id, next_key = 0, key;
+    double start, tree_sec, hash_sec;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    remove(hash_path);
+    hash_id = open_table(hash_path, 0, TABLE_HASH);
+    ASSERT_TRUE(hash_id >= 0);
+    while (!next_bench_record(&next_key, &key, value, &val_size))
+        ASSERT_EQ(db_insert(hash_id, key, value, val_size), 0);
+
+    for (int t = 0; t < 2; t++) {
+        srand(3);
+        start = now();
+        for (int i = 0; i < lookups; i++) {
+            if (i % 128 == 0) trx_id = trx_begin();
+            ASSERT_EQ(db_find(t ? hash_id : table_id, rand() % BENCH_KEYS,
+                              value, &val_size, trx_id), 0);
+            if (i % 128 == 127 || i == lookups - 1) trx_commit(trx_id);
+        }
+        (t ? hash_sec : tree_sec) = now() - start;
+    }
+
+    printf("B+ tree : %.0f finds/s, hash table : %.0f finds/s\n",
+           lookups / tree_sec, lookups / hash_sec);
+    shutdown_db();
+    remove(hash_path);
+    init_db(5000, RECOVERY, NO_CRASH, log_path, logmsg_path);
+}
+
+TEST_F(BenchTest, HotKeyLookups) {
+    const int lookups = 400000, hot = 1000;
+    char value[64];
+    uint16_t val_size;
+    double start, sec[2];
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    for (int on = 0; on < 2; on++) {
+        ASSERT_EQ(db_set_adaptive_hash(table_id, on), 0);
+        srand(4);
+        start = now();
+        for (int i = 0; i < lookups; i++) {
+            if (i % 128 == 0) trx_id = trx_begin();
+            ASSERT_EQ(db_find(table_id, rand() % hot * 97 % BENCH_KEYS, value,
+                              &val_size, trx_id), 0);
+            if (i % 128 == 127 || i == lookups - 1) trx_commit(trx_id);
+        }
+        sec[on] = now() - start;
+    }
+
+    printf("hot keys : %.0f finds/s, with adaptive hash index : %.0f finds/s\n",
+           lookups / sec[0], lookups / sec[1]);
+}
+
+TEST_F(BenchTest, RowCacheReads) {
+    const int lookups = 400000, hot = 5000;
+    char value[64];
+    uint16_t val_size;
+    double start, sec[2];
+    rowcache_stats_t stats;
+
+    ASSERT_TRUE(table_id >= 0);
+    load();
+    for (int on = 0; on < 2; on++) {
+        ASSERT_EQ(db_set_row_cache(on ? 4 << 20 : 0), 0);
+        srand(6);
+        start = now();
+        for (int i = 0; i < lookups; i++)
+            ASSERT_EQ(db_find(table_id, rand() % hot * 13 % BENCH_KEYS, value,
+                              &val_size, 0), 0);
+        sec[on] = now() - start;
+    }
+    db_row_cache_stats(&stats);
+
+    printf("unlocked finds : %.0f/s, with row cache : %.0f/s (%lu hits)\n",
+           lookups / sec[0], lookups / sec[1], stats.hits);
+}
+
+TEST_F(BenchTest, ValueViewReads) {
+    const int keys = 2000, lookups = 200000;
+    const uint16_t size = 3000;
+    char value[size];
+    uint16_t val_size;
+    uint64_t sum = 0;
+    double start, copy_sec, view_sec;
+
+    ASSERT_TRUE(table_id >= 0);
+    memset(value, 'v', size);
+    for (int64_t key = 0; key < keys; key++)
+        ASSERT_EQ(db_insert(table_id, key, value, size), 0);
+
+    srand(8);
+    start = now();
+    for (int i = 0; i < lookups; i++) {
+        ASSERT_EQ(db_find(table_id, rand() % keys, value, &val_size, 0), 0);
+        sum += value[val_size - 1];
+    }
+    copy_sec = now() - start;
+    srand(8);
+    start = now();
+    for (int i = 0; i < lookups; i++) {
+        value_view_t view = db_find_view(table_id, rand() % keys, 0);
+        ASSERT_TRUE(view.valid());
+        sum += view.data()[view.size() - 1];
+    }
+    view_sec = now() - start;
+    EXPECT_EQ(sum, 2ULL * lookups * 'v');
+
+    printf("%u byte values : db_find %.0f/s, db_find_view %.0f/s\n", size,
+           lookups / copy_sec, lookups / view_sec);
+}
@@ -0,0 +1,1578 @@
+#include "bpt.h"
+#include "hash.h"
+#include "ingest.h"
+#include "varkey.h"
+#include <gtest/gtest.h>
+#include <stdio.h>
+
+class BptTest : public ::testing::Test {
+    protected:
+        BptTest() {
+            remove(pathname);
+            remove(log_path);
+            init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+            table_id = open_table(pathname);
+        }
+
+        ~BptTest() {
+            shutdown_db();
+            remove(pathname);
+            remove(log_path);
+            remove(logmsg_path);
+        }
+
+        void insert_keys(int64_t from, int64_t to) {
+            char value[24];
+            for (int64_t key = from; key < to; key++) {
+                snprintf(value, sizeof(value), "%ld", key);
+                ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+            }
+        }
+    int64_t table_id;
+    char pathname[8] = "DATA1";
+    char log_path[16] = "bpt_test.log";
+    char logmsg_path[16] = "bpt_test.msg";
+};
+
+static int collect_keys(int64_t key, char*, uint16_t, void* arg) {
+    std::vector<int64_t>* keys = (std::vector<int64_t>*)arg;
+    keys->push_back(key);
+    return keys->size() == 50;
+}
+
+TEST_F(BptTest, ScanRange) {
+    std::vector<int64_t> keys;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 3000);
+
+    ASSERT_EQ(db_scan(table_id, 1000, 1019, collect_keys, &keys, 0, 0), 0);
+    ASSERT_EQ(keys.size(), 20);
+    for (int i = 0; i < 20; i++) EXPECT_EQ(keys[i], 1000 + i);
+
+    keys.clear();
+    ASSERT_EQ(db_scan(table_id, 2990, 5000, collect_keys, &keys, 0, 0), 0);
+    EXPECT_EQ(keys.size(), 10);
+
+    keys.clear();
+    ASSERT_EQ(db_scan(table_id, 0, 2999, collect_keys, &keys, 0, 0), 0);
+    EXPECT_EQ(keys.size(), 50);
+
+    keys.clear();
+    ASSERT_EQ(db_scan(table_id, 100, 2999, collect_keys, &keys, 0, 7), 0);
+    EXPECT_EQ(keys.size(), 7);
+}
+
+TEST_F(BptTest, CursorInTransaction) {
+    scan_cursor_t* cursor;
+    int64_t key, expected;
+    char value[16], expected_value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 3000);
+
+    trx_id = trx_begin();
+    cursor = db_cursor_open(table_id, 500, 2500, trx_id, 0);
+    ASSERT_TRUE(cursor != nullptr);
+    expected = 500;
+    while (!db_cursor_next(cursor, &key, value, &val_size)) {
+        sprintf(expected_value, "%ld", expected);
+        EXPECT_EQ(key, expected);
+        EXPECT_STREQ(value, expected_value);
+        expected++;
+    }
+    db_cursor_close(cursor);
+    EXPECT_EQ(expected, 2501);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+typedef struct sorted_input_t {
+    int64_t next_key;
+    int64_t end_key;
+} sorted_input_t;
+
+static int next_sorted(void* arg, int64_t* key, char* value, uint16_t* val_size) {
+    sorted_input_t* input = (sorted_input_t*)arg;
+    if (input->next_key >= input->end_key) return 1;
+    *key = input->next_key;
+    sprintf(value, "%ld", *key);
+    *val_size = strlen(value) + 1;
+    input->next_key += 2;
+    return 0;
+}
+
+TEST_F(BptTest, BulkLoad) {
+    sorted_input_t input = {0, 40000};
+    bulk_iterator_t iter = {next_sorted, &input};
+    std::vector<int64_t> keys;
+    char value[16], expected_value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    ASSERT_EQ(db_bulk_load(table_id, &iter, 90), 0);
+    EXPECT_NE(db_bulk_load(table_id, &iter, 90), 0);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 40000; key++) {
+        if (key % 2) {
+            EXPECT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        sprintf(expected_value, "%ld", key);
+        EXPECT_STREQ(value, expected_value);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    for (int64_t key = 1; key < 40000; key += 2) {
+        sprintf(value, "%ld", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    for (int64_t key = 0; key < 40000; key += 3)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+
+    ASSERT_EQ(db_scan(table_id, 29990, 30020, collect_keys, &keys, 0, 0), 0);
+    for (size_t i = 1; i < keys.size(); i++) {
+        EXPECT_LT(keys[i - 1], keys[i]);
+        EXPECT_NE(keys[i] % 3, 0);
+    }
+    EXPECT_EQ(keys.size(), 21);
+}
+
+TEST_F(BptTest, IngestUnsortedCsv) {
+    ingest_opt_t opt = {INGEST_CSV, 3, 64 * 1024, 100, "."};
+    ingest_stats_t stats;
+    char value[32], expected_value[32];
+    uint16_t val_size;
+    FILE* f;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    f = fopen("ingest_test.csv", "w");
+    ASSERT_TRUE(f != NULL);
+    for (int64_t i = 0; i < 20000; i++)
+        fprintf(f, "%ld,v%ld\n", (i * 7919) % 20000, (i * 7919) % 20000);
+    fprintf(f, "5,duplicate\n");
+    fclose(f);
+
+    ASSERT_EQ(db_ingest(table_id, "ingest_test.csv", &opt, &stats), 0);
+    remove("ingest_test.csv");
+    EXPECT_EQ(stats.records, 20001);
+    EXPECT_EQ(stats.duplicates, 1);
+    EXPECT_GT(stats.runs, 1);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 20000; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        value[val_size] = 0;
+        sprintf(expected_value, "v%ld", key);
+        EXPECT_STREQ(value, expected_value);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, IngestErrors) {
+    ingest_opt_t opt = {INGEST_CSV, 2, 64 * 1024, 100, "./no_such_dir"};
+    ingest_stats_t stats;
+    merge_source_t source;
+    ingest_run_t run;
+    char value[PGSIZE];
+    uint16_t val_size;
+    int64_t key = 42;
+    FILE* f;
+    int trx_id;
+
+    // Runs that cannot be spilled fail the ingest and load nothing.
+    ASSERT_TRUE(table_id >= 0);
+    f = fopen("ingest_test.csv", "w");
+    ASSERT_TRUE(f != NULL);
+    for (int64_t i = 0; i < 20000; i++) fprintf(f, "%ld,v%ld\n", 19999 - i, i);
+    fclose(f);
+    EXPECT_NE(db_ingest(table_id, "ingest_test.csv", &opt, &stats), 0);
+    remove("ingest_test.csv");
+    trx_id = trx_begin();
+    EXPECT_NE(db_find(table_id, 5, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // A run file cut inside a record is an error, not the end of the run.
+    f = fopen("ingest_test.run", "wb");
+    ASSERT_TRUE(f != NULL);
+    val_size = 100;
+    fwrite(&key, sizeof(key), 1, f);
+    fwrite(&val_size, sizeof(val_size), 1, f);
+    fwrite(value, 1, 10, f);
+    fclose(f);
+    source.run = &run;
+    source.fp = fopen("ingest_test.run", "rb");
+    source.value = value;
+    EXPECT_EQ(merge_advance(&source), -1);
+    fclose(source.fp);
+    remove("ingest_test.run");
+}
+
+TEST_F(BptTest, InsertBatch) {
+    std::vector<int64_t> keys;
+    std::vector<std::string> values;
+    std::vector<char*> value_ptrs;
+    std::vector<uint16_t> sizes;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 100);
+    for (int64_t i = 0; i < 5000; i++) keys.push_back((i * 7919) % 5000);
+    keys.push_back(42);
+    for (size_t i = 0; i < keys.size(); i++)
+        values.push_back(std::to_string(keys[i]));
+    for (size_t i = 0; i < keys.size(); i++) {
+        value_ptrs.push_back((char*)values[i].c_str());
+        sizes.push_back(values[i].size() + 1);
+    }
+
+    EXPECT_EQ(db_insert_batch(table_id, keys.data(), value_ptrs.data(),
+                              sizes.data(), keys.size()), 101);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 5000; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, FindBatch) {
+    int64_t keys[6] = {2999, 7, 5000, 7, -1, 1500};
+    char buffers[6][16];
+    char* ret_vals[6];
+    uint16_t val_sizes[6];
+    int results[6];
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 3000);
+    for (int i = 0; i < 6; i++) ret_vals[i] = buffers[i];
+
+    ASSERT_EQ(db_find_batch(table_id, keys, 6, ret_vals, val_sizes, results, 0), 0);
+    for (int i = 0; i < 6; i++) {
+        if (keys[i] < 0 || keys[i] >= 3000) {
+            EXPECT_EQ(results[i], 1);
+            continue;
+        }
+        ASSERT_EQ(results[i], 0);
+        EXPECT_EQ(atoll(ret_vals[i]), keys[i]);
+    }
+}
+
+// With a few frames the pages read ahead evict the parents of the groups
+// in the window, which then fall back to single descents.
+TEST_F(BptTest, FindBatchSmallPool) {
+    std::vector<int64_t> keys;
+    std::vector<char*> ret_vals;
+    std::vector<uint16_t> val_sizes;
+    std::vector<int> results;
+    std::vector<char> buffers;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 20000);
+    shutdown_db();
+    init_db(6, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+
+    for (int64_t key = 20005; key >= 0; key -= 7) keys.push_back(key);
+    buffers.resize(keys.size() * 16);
+    val_sizes.resize(keys.size());
+    results.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) ret_vals.push_back(&buffers[i * 16]);
+
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find_batch(table_id, keys.data(), keys.size(), ret_vals.data(),
+                            val_sizes.data(), results.data(), trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] >= 20000) {
+            EXPECT_EQ(results[i], 1);
+            continue;
+        }
+        ASSERT_EQ(results[i], 0);
+        EXPECT_EQ(atoll(ret_vals[i]), keys[i]);
+    }
+}
+
+TEST_F(BptTest, BlinkMode) {
+    std::vector<int64_t> keys;
+    page_t* header;
+    int32_t header_idx;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    ASSERT_EQ(db_set_blink(table_id, true), 0);
+    insert_keys(0, 5000);
+    for (int64_t key = 0; key < 5000; key++)
+        if (key % 50) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 5000; key++) {
+        if (key % 50) {
+            EXPECT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    ASSERT_EQ(db_scan(table_id, 0, 4999, collect_keys, &keys, 0, 0), 0);
+    ASSERT_EQ(keys.size(), 50);
+    for (int i = 0; i < 50; i++) EXPECT_EQ(keys[i], i * 50);
+
+    insert_keys(5000, 6000);
+    shutdown_db();
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    EXPECT_TRUE(header->flags & TREE_BLINK);
+    trx_id = trx_begin();
+    for (int64_t key = 5000; key < 6000; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, OptimisticRead) {
+    page_t* page;
+    int32_t page_idx, latched_idx;
+    uint64_t version;
+    pagenum_t root_num;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 3000);
+
+    page = buffer_optimistic_read(table_id, 0, &page_idx, &version);
+    ASSERT_TRUE(page != NULL);
+    root_num = page->root_num;
+    EXPECT_TRUE(buffer_validate(page_idx, version));
+    EXPECT_NE(root_num, 0);
+
+    buffer_read_page(table_id, 0, &latched_idx, WRITE);
+    EXPECT_EQ(latched_idx, page_idx);
+    EXPECT_FALSE(buffer_validate(page_idx, version));
+    EXPECT_TRUE(buffer_optimistic_read(table_id, 0, &page_idx, &version) == NULL);
+    buffer_write_page(table_id, 0, latched_idx, 0);
+
+    page = buffer_optimistic_read(table_id, 0, &page_idx, &version);
+    ASSERT_TRUE(page != NULL);
+    EXPECT_EQ(page->root_num, root_num);
+    EXPECT_TRUE(buffer_validate(page_idx, version));
+}
+
+TEST_F(BptTest, OptimisticReadKeepsPage) {
+    page_t* page;
+    int32_t page_idx;
+    uint64_t version;
+    pagenum_t num_pages;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 3000);
+    shutdown_db();
+    init_db(6, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+
+    page = buffer_read_page(table_id, 0, &page_idx, WRITE);
+    num_pages = page->num_pages;
+    buffer_write_page(table_id, 0, page_idx, 0);
+    ASSERT_GT(num_pages, 20);
+    for (pagenum_t pagenum = 1; pagenum < 20; pagenum++) {
+        ASSERT_TRUE(buffer_optimistic_read(table_id, 0, &page_idx, &version) != NULL);
+        buffer_read_page(table_id, pagenum, &page_idx, WRITE);
+        buffer_write_page(table_id, pagenum, page_idx, 0);
+    }
+    EXPECT_TRUE(buffer_optimistic_read(table_id, 0, &page_idx, &version) != NULL);
+}
+
+TEST_F(BptTest, DeleteAllAndReinsert) {
+    std::vector<int64_t> keys;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 20000);
+    for (int64_t key = 0; key < 20000; key++) {
+        int64_t k = (key * 7919) % 20000;
+        ASSERT_EQ(db_delete(table_id, k), 0);
+    }
+    ASSERT_EQ(db_scan(table_id, 0, 20000, collect_keys, &keys, 0, 0), 0);
+    EXPECT_EQ(keys.size(), 0);
+    EXPECT_NE(db_delete(table_id, 0), 0);
+
+    insert_keys(100, 200);
+    trx_id = trx_begin();
+    for (int64_t key = 100; key < 200; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, AppendFillsLeaves) {
+    page_t* leaf;
+    pagenum_t leaf_num;
+    int32_t leaf_idx;
+    int64_t leaves = 0, used = 0, records = 0;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 20000);
+
+    leaf_num = find_leaf_latched(table_id, 0, &leaf, &leaf_idx, nullptr, nullptr);
+    ASSERT_NE(leaf_num, 0);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+    while (leaf_num) {
+        leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, READ);
+        leaves++;
+        records += leaf->info.num_keys;
+        if (leaf->Rsibling) used += 3968 - leaf->freespace;
+        leaf_num = leaf->Rsibling;
+    }
+    EXPECT_EQ(records, 20000);
+    EXPECT_GT(used, (leaves - 1) * 3968 * 85 / 100);
+
+    insert_keys(30000, 30100);
+    insert_keys(20000, 20100);
+    trx_id = trx_begin();
+    for (int64_t key = 19900; key < 20100; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    for (int64_t key = 30000; key < 30100; key++)
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    EXPECT_NE(db_insert(table_id, 30099, value, 4), 0);
+}
+
+TEST_F(BptTest, CountedRank) {
+    const int64_t n = 40000;
+    sorted_input_t input = {0, n};
+    bulk_iterator_t iter = {next_sorted, &input};
+    std::vector<int64_t> present;
+    int64_t count, key, lo, hi, expected;
+    char value[16];
+
+    ASSERT_TRUE(table_id >= 0);
+    ASSERT_EQ(db_set_counted(table_id, true), 0);
+    EXPECT_NE(db_set_blink(table_id, true), 0);
+    for (int64_t i = 0; i < n; i++) {
+        key = (i * 7919) % n;
+        sprintf(value, "%ld", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    EXPECT_NE(db_insert(table_id, 5, value, 4), 0);
+    EXPECT_NE(db_set_counted(table_id, false), 0);
+    for (int64_t i = 0; i < n; i++) {
+        key = (i * 7919) % n;
+        if (key % 3) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    }
+    EXPECT_NE(db_delete(table_id, 1), 0);
+
+    for (int64_t key = 0; key < n; key += 3) present.push_back(key);
+    for (size_t i = 0; i < present.size(); i++) {
+        ASSERT_EQ(db_select_rank(table_id, i, &key), 0);
+        EXPECT_EQ(key, present[i]);
+    }
+    EXPECT_NE(db_select_rank(table_id, present.size(), &key), 0);
+
+    srand(3);
+    for (int i = 0; i < 200; i++) {
+        lo = rand() % (n + 100) - 50;
+        hi = lo + rand() % 5000;
+        expected = std::upper_bound(present.begin(), present.end(), hi) -
+                   std::lower_bound(present.begin(), present.end(), lo);
+        ASSERT_EQ(db_count_range(table_id, lo, hi, &count), 0);
+        EXPECT_EQ(count, expected);
+    }
+    ASSERT_EQ(db_count_range(table_id, INT64_MIN, INT64_MAX, &count), 0);
+    EXPECT_EQ(count, present.size());
+
+    for (int64_t key = 0; key < n; key += 3) ASSERT_EQ(db_delete(table_id, key), 0);
+    ASSERT_EQ(db_count_range(table_id, INT64_MIN, INT64_MAX, &count), 0);
+    EXPECT_EQ(count, 0);
+    ASSERT_EQ(db_bulk_load(table_id, &iter, 100), 0);
+    ASSERT_EQ(db_count_range(table_id, 100, 199, &count), 0);
+    EXPECT_EQ(count, 50);
+    ASSERT_EQ(db_select_rank(table_id, 12345, &key), 0);
+    EXPECT_EQ(key, 24690);
+}
+
+static int next_fixed(void* arg, int64_t* key, char* value, uint16_t* val_size) {
+    sorted_input_t* input = (sorted_input_t*)arg;
+    if (input->next_key >= input->end_key) return 1;
+    *key = input->next_key;
+    memcpy(value, key, 8);
+    *val_size = 8;
+    input->next_key += 2;
+    return 0;
+}
+
+TEST_F(BptTest, FixedWidthLeaves) {
+    const int64_t n = 20000;
+    sorted_input_t input = {0, n};
+    bulk_iterator_t iter = {next_fixed, &input};
+    std::vector<int64_t> keys;
+    int64_t key, value;
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_EQ(open_table(pathname, 8), table_id);
+    for (int64_t i = 0; i < n; i++) {
+        key = (i * 7919) % n;
+        ASSERT_EQ(db_insert(table_id, key, (char*)&key, 8), 0);
+    }
+    EXPECT_NE(db_insert(table_id, n, (char*)&key, 4), 0);
+    EXPECT_NE(db_insert(table_id, 5, (char*)&key, 8), 0);
+    EXPECT_EQ(open_table(pathname, 16), -1);
+    for (int64_t i = 0; i < n; i++) {
+        key = (i * 7919) % n;
+        if (key % 3) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    }
+
+    trx_id = trx_begin();
+    for (key = 0; key < n; key++) {
+        if (key % 3) {
+            EXPECT_NE(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+        EXPECT_EQ(val_size, 8);
+        EXPECT_EQ(value, key);
+    }
+    value = -1;
+    EXPECT_NE(db_update(table_id, 3, (char*)&value, 4, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 3, (char*)&value, 8, &val_size, trx_id), 0);
+    ASSERT_EQ(db_update(table_id, 6, (char*)&value, 8, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_abort(trx_id), trx_id);
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 9, (char*)&value, 8, &val_size, trx_id), 0);
+    ASSERT_EQ(db_find(table_id, 6, (char*)&value, &val_size, trx_id), 0);
+    EXPECT_EQ(value, 6);
+    ASSERT_EQ(db_find(table_id, 9, (char*)&value, &val_size, trx_id), 0);
+    EXPECT_EQ(value, -1);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    ASSERT_EQ(db_scan(table_id, 3000, 4000, collect_keys, &keys, 0, 0), 0);
+    EXPECT_EQ(keys.size(), 50);
+    EXPECT_EQ(keys[49], 3147);
+
+    for (key = 0; key < n; key += 3) ASSERT_EQ(db_delete(table_id, key), 0);
+    ASSERT_EQ(db_bulk_load(table_id, &iter, 100), 0);
+    trx_id = trx_begin();
+    for (key = 0; key < n; key += 2) {
+        ASSERT_EQ(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+        EXPECT_EQ(value, key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    for (key = 1; key < n; key += 2)
+        ASSERT_EQ(db_insert(table_id, key, (char*)&key, 8), 0);
+    for (key = 0; key < n; key += 2) ASSERT_EQ(db_delete(table_id, key), 0);
+    keys.clear();
+    ASSERT_EQ(db_scan(table_id, 0, n, collect_keys, &keys, 0, 0), 0);
+    EXPECT_EQ(keys.size(), 50);
+    EXPECT_EQ(keys[0], 1);
+    EXPECT_EQ(keys[49], 99);
+}
+
+typedef struct update_arg_t {
+    int64_t table_id;
+    int64_t key;
+    int done;
+} update_arg_t;
+
+static void* update_in_trx(void* arg) {
+    update_arg_t* a = (update_arg_t*)arg;
+    int64_t value = -1;
+    uint16_t val_size;
+    int trx_id = trx_begin();
+
+    db_update(a->table_id, a->key, (char*)&value, 8, &val_size, trx_id);
+    trx_commit(trx_id);
+    __atomic_store_n(&a->done, 1, __ATOMIC_RELEASE);
+    return nullptr;
+}
+
+// A fixed-width leaf holds more than 64 records; records 0 and 64 of one
+// leaf must not share a lock bit.
+TEST_F(BptTest, FixedLeafRecordLocks) {
+    update_arg_t arg = {0, 64, 0};
+    pthread_t thread;
+    int64_t value = -2;
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_EQ(open_table(pathname, 8), table_id);
+    for (int64_t key = 0; key < 150; key++) {
+        ASSERT_EQ(db_insert(table_id, key, (char*)&key, 8), 0);
+    }
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 0, (char*)&value, 8, &val_size, trx_id), 0);
+    arg.table_id = table_id;
+    pthread_create(&thread, nullptr, update_in_trx, &arg);
+    for (int i = 0; i < 200 && !__atomic_load_n(&arg.done, __ATOMIC_ACQUIRE); i++)
+        usleep(10000);
+    EXPECT_TRUE(__atomic_load_n(&arg.done, __ATOMIC_ACQUIRE));
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    pthread_join(thread, nullptr);
+
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 64, (char*)&value, &val_size, trx_id), 0);
+    EXPECT_EQ(value, -1);
+    ASSERT_EQ(db_find(table_id, 0, (char*)&value, &val_size, trx_id), 0);
+    EXPECT_EQ(value, -2);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, PairNodeFormat) {
+    page_t *header, *root;
+    int32_t header_idx, root_idx;
+    pagenum_t root_num;
+    int64_t count, key;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    EXPECT_EQ(header->format, PAGE_FORMAT_SPLIT_KEYS);
+    EXPECT_NE(db_set_format(table_id, 7), 0);
+    ASSERT_EQ(db_set_format(table_id, PAGE_FORMAT_PAIRS), 0);
+    ASSERT_EQ(db_set_counted(table_id, true), 0);
+    for (int64_t i = 0; i < 30000; i++) {
+        key = (i * 7919) % 30000;
+        sprintf(value, "%ld", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    EXPECT_NE(db_set_format(table_id, PAGE_FORMAT_SPLIT_KEYS), 0);
+    for (key = 0; key < 30000; key++)
+        if (key % 5) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    ASSERT_EQ(db_count_range(table_id, 1000, 1999, &count), 0);
+    EXPECT_EQ(count, 200);
+
+    shutdown_db();
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    EXPECT_EQ(header->format, PAGE_FORMAT_PAIRS);
+    root_num = header->root_num;
+    root = buffer_read_page(table_id, root_num, &root_idx, READ);
+    ASSERT_FALSE(root->info.isLeaf);
+    EXPECT_EQ(root->flags, NODE_COUNTED);
+
+    trx_id = trx_begin();
+    for (key = 0; key < 30000; key++) {
+        if (key % 5) {
+            EXPECT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    ASSERT_EQ(db_select_rank(table_id, 1234, &key), 0);
+    EXPECT_EQ(key, 6170);
+}
+
+TEST_F(BptTest, Int32Keys) {
+    std::vector<int64_t> keys;
+    page_t *header, *root, *leaf;
+    int32_t header_idx, root_idx, leaf_idx;
+    pagenum_t leaf_num;
+    int64_t key, value;
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_EQ(open_table(pathname, 8), table_id);
+    EXPECT_NE(db_set_key_type(table_id, 9), 0);
+    ASSERT_EQ(db_set_key_type(table_id, KEY_INT32), 0);
+    for (int64_t i = 0; i < 40000; i++) {
+        key = (i * 7919) % 40000 - 20000;
+        ASSERT_EQ(db_insert(table_id, key, (char*)&key, 8), 0);
+    }
+    key = INT32_MAX + 1LL;
+    EXPECT_NE(db_insert(table_id, key, (char*)&key, 8), 0);
+    key = INT32_MIN;
+    ASSERT_EQ(db_insert(table_id, key, (char*)&key, 8), 0);
+    EXPECT_NE(db_set_key_type(table_id, KEY_INT64), 0);
+
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    root = buffer_read_page(table_id, header->root_num, &root_idx, READ);
+    ASSERT_FALSE(root->info.isLeaf);
+    EXPECT_EQ(root->flags, NODE_SPLIT_KEYS | NODE_KEY32);
+    EXPECT_EQ(node_capacity(root), 330);
+    leaf_num = find_leaf_latched(table_id, 0, &leaf, &leaf_idx, nullptr, nullptr);
+    ASSERT_NE(leaf_num, 0);
+    EXPECT_EQ(leaf->flags, NODE_KEY32);
+    EXPECT_EQ(leaf_cost(leaf, 8), 16);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+
+    for (key = -20000; key < 20000; key++)
+        if (key % 4) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    trx_id = trx_begin();
+    for (key = -20000; key < 20000; key++) {
+        if (key % 4) {
+            EXPECT_NE(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+        EXPECT_EQ(value, key);
+    }
+    EXPECT_NE(db_find(table_id, INT32_MAX + 1LL, (char*)&value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    ASSERT_EQ(db_scan(table_id, INT64_MIN, -19000, collect_keys, &keys, 0, 0), 0);
+    ASSERT_EQ(keys.size(), 50);
+    EXPECT_EQ(keys[0], INT32_MIN);
+    EXPECT_EQ(keys[1], -20000);
+    EXPECT_EQ(keys[49], -20000 + 48 * 4);
+}
+
+TEST_F(BptTest, Int32SlottedLeaves) {
+    page_t* leaf;
+    int32_t leaf_idx;
+    pagenum_t leaf_num;
+    char value[24];
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_EQ(db_set_key_type(table_id, KEY_INT32), 0);
+    insert_keys(-20000, 20000);
+    EXPECT_NE(db_insert(table_id, INT32_MAX + 1LL, value, 1), 0);
+    leaf_num = find_leaf_latched(table_id, 0, &leaf, &leaf_idx, nullptr, nullptr);
+    ASSERT_NE(leaf_num, 0);
+    EXPECT_EQ(leaf->flags, NODE_KEY32);
+    EXPECT_EQ(leaf_cost(leaf, 8), 20);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+
+    for (int64_t key = -20000; key < 20000; key++) {
+        if (key % 4) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    }
+    trx_id = trx_begin();
+    for (int64_t key = -20000; key < 20000; key++) {
+        if (key % 4) {
+            EXPECT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atoll(value), key);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, ByteStringKeys) {
+    const char* words[6] = {"apple", "apples", "b", "banana", "zz", "\xff"};
+    std::vector<int64_t> keys;
+    char bytes[8];
+    int64_t key;
+
+    ASSERT_TRUE(table_id >= 0);
+    for (int i = 5; i >= 0; i--) {
+        ASSERT_EQ(key_from_bytes(words[i], strlen(words[i]), &key), 0);
+        ASSERT_EQ(db_insert(table_id, key, (char*)words[i], strlen(words[i]) + 1), 0);
+    }
+    ASSERT_EQ(db_scan(table_id, INT64_MIN, INT64_MAX, collect_keys, &keys, 0, 0), 0);
+    ASSERT_EQ(keys.size(), 6);
+    for (int i = 0; i < 6; i++) {
+        key_to_bytes(keys[i], bytes);
+        EXPECT_EQ(strncmp(bytes, words[i], 8), 0);
+    }
+
+    // Longer strings are refused rather than cut to KEY_BYTES_MAX bytes.
+    EXPECT_NE(key_from_bytes("abcdefgh-1", 10, &key), 0);
+    ASSERT_EQ(key_from_bytes("abcdefgh", 8, &key), 0);
+    key_to_bytes(key, bytes);
+    EXPECT_EQ(memcmp(bytes, "abcdefgh", 8), 0);
+}
+
+TEST_F(BptTest, FixedLengthByteKeys) {
+    const char symbols[28] = {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j',
+                              'k', 'l', 'm', 'n', 'o', 'p', 'q', 'r', 's', 't',
+                              'u', 'v', 'w', 'x', 'y', 'z', '\x80', '\xff'};
+    const int n = 28 * 28 * 28;
+    std::vector<std::string> words(n);
+    std::vector<int64_t> keys;
+    page_t *header, *root, *leaf;
+    int32_t header_idx, root_idx, leaf_idx;
+    pagenum_t leaf_num;
+    char bytes[8];
+    int64_t key, value;
+    uint16_t val_size;
+    size_t first;
+    int trx_id;
+
+    for (int i = 0; i < n; i++) {
+        words[i] = {symbols[i / (28 * 28)], symbols[i / 28 % 28], symbols[i % 28]};
+    }
+    std::sort(words.begin(), words.end());
+
+    ASSERT_EQ(open_table(pathname, 8), table_id);
+    EXPECT_NE(db_set_key_bytes(table_id, 0), 0);
+    EXPECT_NE(db_set_key_bytes(table_id, KEY_BYTES_MAX + 1), 0);
+    ASSERT_EQ(db_set_key_bytes(table_id, 3), 0);
+    for (int64_t i = 0; i < n; i++) {
+        value = i * 7919 % n;
+        ASSERT_EQ(key_from_bytes(words[value].data(), 3, &key), 0);
+        ASSERT_EQ(db_insert(table_id, key, (char*)&value, 8), 0);
+    }
+    ASSERT_EQ(key_from_bytes("abcd", 4, &key), 0);
+    EXPECT_NE(db_insert(table_id, key, (char*)&value, 8), 0);
+    EXPECT_NE(db_set_key_type(table_id, KEY_INT64), 0);
+
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    root = buffer_read_page(table_id, header->root_num, &root_idx, READ);
+    ASSERT_FALSE(root->info.isLeaf);
+    EXPECT_EQ(root->flags, NODE_SPLIT_KEYS | NODE_KEY_BYTES(3));
+    EXPECT_EQ(node_capacity(root), 360);
+    leaf_num = find_leaf_latched(table_id, 0, &leaf, &leaf_idx, nullptr, nullptr);
+    ASSERT_NE(leaf_num, 0);
+    EXPECT_EQ(leaf->flags, NODE_KEY_BYTES(3));
+    EXPECT_EQ(leaf_cost(leaf, 8), 15);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+
+    // Scans run in memcmp order, also from a bound that is not 3 bytes long.
+    ASSERT_EQ(key_from_bytes("mzz\x01", 4, &key), 0);
+    ASSERT_EQ(db_scan(table_id, key, INT64_MAX, collect_keys, &keys, 0, 0), 0);
+    ASSERT_EQ(keys.size(), 50);
+    first = std::lower_bound(words.begin(), words.end(), "mzz\x01") - words.begin();
+    for (size_t i = 0; i < keys.size(); i++) {
+        key_to_bytes(keys[i], bytes);
+        EXPECT_EQ(memcmp(bytes, words[first + i].data(), 3), 0);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (i % 3) {
+            ASSERT_EQ(key_from_bytes(words[i].data(), 3, &key), 0);
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    }
+    trx_id = trx_begin();
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(key_from_bytes(words[i].data(), 3, &key), 0);
+        if (i % 3) {
+            EXPECT_NE(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+            continue;
+        }
+        ASSERT_EQ(db_find(table_id, key, (char*)&value, &val_size, trx_id), 0);
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+static int collect_var_keys(const char* key, uint16_t key_len, char*, uint16_t,
+                            void* arg) {
+    ((std::vector<std::string>*)arg)->emplace_back(key, key_len);
+    return 0;
+}
+
+TEST_F(BptTest, VarKeys) {
+    const int n = 20000;
+    std::vector<int> order(n);
+    std::vector<std::string> urls(n), keys;
+    char key[64], value[16];
+    uint16_t val_size;
+    page_t *header, *root, *leaf;
+    int32_t header_idx, root_idx, leaf_idx;
+    pagenum_t root_num, leaf_num;
+
+    ASSERT_EQ(open_var_table(pathname), table_id);
+    for (int i = 0; i < n; i++) {
+        sprintf(key, "https://www.example.com/catalog/item/%06d/detail", i);
+        urls[i] = key;
+        order[i] = i;
+    }
+    srand(5);
+    for (int i = n - 1; i > 0; i--) std::swap(order[i], order[rand() % (i + 1)]);
+    for (int i : order) {
+        sprintf(value, "%d", i);
+        ASSERT_EQ(var_insert(table_id, urls[i].data(), urls[i].size(), value, strlen(value) + 1), 0);
+    }
+    EXPECT_EQ(var_insert(table_id, urls[7].data(), urls[7].size(), value, 1), 1);
+    EXPECT_EQ(db_insert(table_id, 7, value, 1), 1);
+
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(var_find(table_id, urls[i].data(), urls[i].size(), value, &val_size), 0);
+        EXPECT_EQ(atoi(value), i);
+    }
+    EXPECT_EQ(var_find(table_id, urls[7].data(), urls[7].size() - 1, value, &val_size), 1);
+
+    // Keys share a long prefix that nodes keep once, and the root only holds
+    // the bytes that tell its leaves apart.
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    root_num = header->root_num;
+    root = buffer_read_page(table_id, root_num, &root_idx, WRITE);
+    ASSERT_FALSE(root->info.isLeaf);
+    EXPECT_GT(var_prefix_len(root), 30);
+    for (uint32_t i = 0; i < root->info.num_keys; i++)
+        EXPECT_LE(var_slots(root)[i].key_len, 8);
+    leaf_num = root->leftmost;
+    buffer_write_page(table_id, root_num, root_idx, 0);
+    leaf = buffer_read_page(table_id, leaf_num, &leaf_idx, WRITE);
+    EXPECT_TRUE(leaf->info.isLeaf);
+    EXPECT_GT(var_prefix_len(leaf), 30);
+    buffer_write_page(table_id, leaf_num, leaf_idx, 0);
+
+    for (int i = 0; i < n; i += 2)
+        ASSERT_EQ(var_delete(table_id, urls[i].data(), urls[i].size()), 0);
+    EXPECT_EQ(var_delete(table_id, urls[0].data(), urls[0].size()), 1);
+    ASSERT_EQ(var_scan(table_id, "", 0, nullptr, 0, collect_var_keys, &keys), 0);
+    ASSERT_EQ(keys.size(), n / 2);
+    for (int i = 0; i < n / 2; i++) EXPECT_EQ(keys[i], urls[2 * i + 1]);
+    keys.clear();
+    ASSERT_EQ(var_scan(table_id, urls[100].data(), urls[100].size(), urls[110].data(), urls[110].size(), collect_var_keys, &keys), 0);
+    EXPECT_EQ(keys.size(), 5);
+
+    for (int i = 1; i < n; i += 2)
+        ASSERT_EQ(var_delete(table_id, urls[i].data(), urls[i].size()), 0);
+    EXPECT_EQ(get_root_num(table_id), 0);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(var_insert(table_id, urls[i].data(), urls[i].size(), value, 1), 0);
+    EXPECT_EQ(var_find(table_id, urls[99].data(), urls[99].size(), value, &val_size), 0);
+}
+
+static void fill_value(char* value, int64_t key, uint16_t size) {
+    for (uint16_t i = 0; i < size; i++) value[i] = (char)(key * 31 + i);
+}
+
+static int check_values(int64_t key, char* value, uint16_t val_size, void* arg) {
+    char expected[UINT16_MAX];
+    fill_value(expected, key, val_size);
+    *(int*)arg += memcmp(value, expected, val_size) != 0;
+    return 0;
+}
+
+TEST_F(BptTest, OverflowValues) {
+    static char value[UINT16_MAX], ret_val[UINT16_MAX];
+    uint16_t val_size, old_size;
+    page_t *header, *page;
+    int32_t header_idx, page_idx;
+    pagenum_t page_num, num_pages;
+    int trx_id, leaves = 0, bad = 0;
+
+    // Every tenth value is far larger than a page.
+    auto size_of = [](int64_t key) { return key % 10 ? 16 : 3000 + key * 50; };
+    for (int64_t key = 0; key < 300; key++) {
+        fill_value(value, key, size_of(key));
+        ASSERT_EQ(db_insert(table_id, key, value, size_of(key)), 0);
+    }
+    EXPECT_EQ(db_insert(table_id, 10, value, 20000), 1);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 300; key++) {
+        ASSERT_EQ(db_find(table_id, key, ret_val, &val_size, trx_id), 0);
+        ASSERT_EQ(val_size, size_of(key));
+        fill_value(value, key, val_size);
+        EXPECT_EQ(memcmp(ret_val, value, val_size), 0);
+    }
+    EXPECT_NE(db_update(table_id, 20, value, 16, &old_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    ASSERT_EQ(db_scan(table_id, 0, 299, check_values, &bad, 0, 0), 0);
+    EXPECT_EQ(bad, 0);
+
+    // Leaves only hold references, so the large values do not spread the
+    // records over more leaves.
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    page_num = header->root_num;
+    page = buffer_read_page(table_id, page_num, &page_idx, READ);
+    while (!page->info.isLeaf) {
+        page_num = page->leftmost;
+        page = buffer_read_page(table_id, page_num, &page_idx, READ);
+    }
+    for (; page_num; leaves++) {
+        page = buffer_read_page(table_id, page_num, &page_idx, READ);
+        page_num = page->Rsibling;
+    }
+    EXPECT_LE(leaves, 4);
+
+    // Deleting a record frees its whole chain.
+    auto free_pages = [&]() {
+        pagenum_t n = 0, num;
+        header = buffer_read_page(table_id, 0, &header_idx, READ);
+        for (num = header->nextfree_num; num; n++)
+            num = buffer_read_page(table_id, num, &page_idx, READ)->nextfree_num;
+        return n;
+    };
+    num_pages = free_pages();
+    for (int64_t key = 0; key < 300; key += 10) {
+        ASSERT_EQ(db_delete(table_id, key), 0);
+        num_pages += (size_of(key) + OVERFLOW_CHUNK - 1) / OVERFLOW_CHUNK;
+    }
+    EXPECT_GE(free_pages(), num_pages);
+    for (int64_t key = 0; key < 300; key += 10) {
+        fill_value(value, key, size_of(key));
+        ASSERT_EQ(db_insert(table_id, key, value, size_of(key)), 0);
+    }
+    ASSERT_EQ(db_scan(table_id, 0, 299, check_values, &bad, 0, 0), 0);
+    EXPECT_EQ(bad, 0);
+}
+
+typedef struct overflow_input_t {
+    int64_t next_key;
+    int64_t end_key;
+    int64_t back_at;
+} overflow_input_t;
+
+static uint16_t bulk_size_of(int64_t key) { return key % 10 ? 16 : 5000 + key * 50; }
+
+static int next_overflow(void* arg, int64_t* key, char* value, uint16_t* val_size) {
+    overflow_input_t* input = (overflow_input_t*)arg;
+    if (input->next_key >= input->end_key) return 1;
+    *key = input->next_key == input->back_at ? 0 : input->next_key;
+    *val_size = bulk_size_of(*key);
+    fill_value(value, *key, *val_size);
+    input->next_key++;
+    return 0;
+}
+
+TEST_F(BptTest, BulkLoadOverflow) {
+    static char value[UINT16_MAX];
+    overflow_input_t input = {0, 1000, 900};
+    bulk_iterator_t iter = {next_overflow, &input};
+    page_t* header;
+    int32_t header_idx;
+    uint16_t val_size;
+    int trx_id, bad = 0;
+
+    // A key out of order drops what was built so far, chains included.
+    ASSERT_TRUE(table_id >= 0);
+    EXPECT_NE(db_bulk_load(table_id, &iter, 100), 0);
+    header = buffer_read_page(table_id, 0, &header_idx, READ);
+    EXPECT_EQ(header->root_num, 0);
+    trx_id = trx_begin();
+    EXPECT_NE(db_find(table_id, 10, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    input = {0, 1000, -1};
+    ASSERT_EQ(db_bulk_load(table_id, &iter, 100), 0);
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < 1000; key += 10) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        ASSERT_EQ(val_size, bulk_size_of(key));
+        ASSERT_GT(val_size, PGSIZE);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    ASSERT_EQ(db_scan(table_id, 0, 999, check_values, &bad, 0, 0), 0);
+    EXPECT_EQ(bad, 0);
+}
+
+TEST_F(BptTest, MergePolicy) {
+    const int64_t n = 20000;
+    page_t* page;
+    pagenum_t page_num;
+    int32_t page_idx;
+    int64_t full;
+    char value[16];
+    uint16_t val_size;
+    int trx_id;
+
+    auto count_leaves = [&]() {
+        int64_t leaves = 0;
+        page_num = find_leaf_latched(table_id, 0, &page, &page_idx, nullptr, nullptr);
+        buffer_write_page(table_id, page_num, page_idx, 0);
+        for (; page_num; leaves++)
+            page_num = buffer_read_page(table_id, page_num, &page_idx, READ)->Rsibling;
+        return leaves;
+    };
+
+    ASSERT_TRUE(table_id >= 0);
+    EXPECT_NE(db_set_merge_policy(table_id, 3), 0);
+    insert_keys(0, n);
+    full = count_leaves();
+
+    // No leaf runs empty, so none is merged.
+    ASSERT_EQ(db_set_merge_policy(table_id, MERGE_AT_EMPTY), 0);
+    for (int64_t key = 0; key < n; key++)
+        if (key % 10) {
+            ASSERT_EQ(db_delete(table_id, key), 0);
+        }
+    EXPECT_EQ(count_leaves(), full);
+
+    ASSERT_EQ(db_set_merge_policy(table_id, MERGE_BACKGROUND), 0);
+    for (int64_t key = 10; key < n; key += 20)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    db_wait_merges();
+    EXPECT_LT(count_leaves(), full / 4);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < n; key++) {
+        if (key % 20) {
+            ASSERT_NE(db_find(table_id, key, value, &val_size, trx_id), 0);
+        } else {
+            ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+            EXPECT_EQ(atoll(value), key);
+        }
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // The policy is kept in the header page.
+    shutdown_db();
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    EXPECT_EQ(give_tree(table_id)->merge_policy, MERGE_BACKGROUND);
+}
+
+TEST_F(BptTest, TombstoneDeletes) {
+    const int64_t n = 5000;
+    std::vector<int64_t> keys;
+    int64_t batch_keys[2] = {4, 6}, key;
+    char value[16], batch_value[] = "b";
+    char* batch_values[2] = {batch_value, batch_value};
+    uint16_t batch_sizes[2] = {2, 2}, val_size, old_size;
+    page_t* page;
+    pagenum_t page_num;
+    int32_t page_idx;
+    int64_t records = 0;
+    scan_cursor_t* cursor;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, n);
+    ASSERT_EQ(db_set_tombstones(table_id, true), 0);
+    EXPECT_NE(db_set_counted(table_id, true), 0);
+    for (int64_t key = 0; key < n; key += 2)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    EXPECT_NE(db_delete(table_id, 0), 0);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < n; key++)
+        EXPECT_EQ(db_find(table_id, key, value, &val_size, trx_id) == 0, key % 2 == 1);
+    EXPECT_NE(db_update(table_id, 10, value, 3, &old_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    ASSERT_EQ(db_scan(table_id, 0, 99, collect_keys, &keys, 0, 10), 0);
+    ASSERT_EQ(keys.size(), 10);
+    for (int i = 0; i < 10; i++) EXPECT_EQ(keys[i], 2 * i + 1);
+    cursor = db_cursor_open(table_id, 100, n, 0, 0);
+    ASSERT_EQ(db_cursor_next(cursor, &key, value, &val_size), 0);
+    EXPECT_EQ(key, 101);
+    db_cursor_close(cursor);
+
+    // Inserts take the place of a tombstone.
+    insert_keys(0, 1);
+    EXPECT_EQ(db_insert_batch(table_id, batch_keys, batch_values, batch_sizes, 2), 0);
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 0, value, &val_size, trx_id), 0);
+    EXPECT_EQ(atoll(value), 0);
+    ASSERT_EQ(db_find(table_id, 6, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "b");
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // Once purged, the leaves only hold live records.
+    db_wait_merges();
+    page_num = find_leaf_latched(table_id, 0, &page, &page_idx, nullptr, nullptr);
+    buffer_write_page(table_id, page_num, page_idx, 0);
+    for (; page_num; page_num = page->Rsibling) {
+        page = buffer_read_page(table_id, page_num, &page_idx, READ);
+        records += page->info.num_keys;
+    }
+    EXPECT_EQ(records, n / 2 + 3);
+}
+
+TEST_F(BptTest, BloomFilter) {
+    const int64_t n = 20000;
+    int64_t keys[4] = {1, 2, 3, 2 * n};
+    char* ret_vals[4];
+    char values[4][16];
+    uint16_t val_sizes[4];
+    int results[4], trx_id, positives = 0;
+    char value[16], bloom_path[16];
+    uint16_t val_size;
+    tree_t* tree;
+
+    ASSERT_TRUE(table_id >= 0);
+    for (int64_t key = 0; key < 2 * n; key += 2) {
+        sprintf(value, "%ld", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    ASSERT_EQ(db_set_bloom(table_id, 2 * n), 0);
+    EXPECT_NE(db_set_bloom(table_id, n), 0);
+    tree = give_tree(table_id);
+    ASSERT_NE(tree->bloom, nullptr);
+
+    // Every key present passes, most missing ones are turned away.
+    for (int64_t key = 0; key < 2 * n; key++) {
+        if (key % 2 == 0)
+            ASSERT_TRUE(bloom_may_contain(tree->bloom, key));
+        else
+            positives += bloom_may_contain(tree->bloom, key);
+    }
+    EXPECT_LT(positives, n / 20);
+
+    insert_keys(2 * n, 2 * n + 1);
+    for (int i = 0; i < 4; i++) ret_vals[i] = values[i];
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find_batch(table_id, keys, 4, ret_vals, val_sizes, results, trx_id), 0);
+    EXPECT_EQ(results[0], 1);
+    EXPECT_EQ(results[1], 0);
+    EXPECT_EQ(results[2], 1);
+    EXPECT_EQ(results[3], 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // A clean shutdown leaves the side file, which the next open consumes.
+    sprintf(bloom_path, "%s.bloom", pathname);
+    shutdown_db();
+    EXPECT_EQ(access(bloom_path, F_OK), 0);
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    EXPECT_NE(access(bloom_path, F_OK), 0);
+    trx_id = trx_begin();
+    for (int64_t key = 0; key <= 2 * n; key += 2)
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+    EXPECT_NE(db_find(table_id, 7, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // Without it the filter is rebuilt from the leaves.
+    shutdown_db();
+    remove(bloom_path);
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    trx_id = trx_begin();
+    for (int64_t key = 0; key <= 2 * n; key += 2)
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    EXPECT_EQ(db_set_bloom(table_id, 0), 0);
+    shutdown_db();
+    EXPECT_NE(access(bloom_path, F_OK), 0);
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    EXPECT_EQ(give_tree(table_id)->bloom, nullptr);
+}
+
+TEST_F(BptTest, HashTable) {
+    const int64_t n = 20000;
+    int64_t keys[2] = {4, 5};
+    char* ret_vals[2];
+    char values[2][16];
+    uint16_t val_sizes[2];
+    int results[2], trx_id;
+    char value[16], big[6000], out[6000];
+    uint16_t val_size, old_size;
+    hash_t* hash;
+
+    ASSERT_EQ(open_table(pathname, 0, TABLE_HASH), table_id);
+    ASSERT_NE(give_tree(table_id)->hash, nullptr);
+    insert_keys(0, n);
+    EXPECT_NE(db_insert(table_id, 7, value, 4), 0);
+    hash = give_tree(table_id)->hash;
+    EXPECT_GT(hash->depth, 0);
+    EXPECT_EQ(hash->dir.size(), 1ULL << hash->depth);
+
+    trx_id = trx_begin();
+    for (int64_t key = 0; key < n; key++) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        ASSERT_EQ(atol(value), key);
+    }
+    EXPECT_NE(db_find(table_id, n, value, &val_size, trx_id), 0);
+    ASSERT_EQ(db_update(table_id, 42, (char*)"xx", 3, &old_size, trx_id), 0);
+    EXPECT_EQ(old_size, 3);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    for (int64_t key = 1; key < n; key += 2)
+        ASSERT_EQ(db_delete(table_id, key), 0);
+    EXPECT_NE(db_delete(table_id, 1), 0);
+    ASSERT_EQ(db_insert(table_id, 5, (char*)"5", 2), 0);
+    fill_value(big, 2 * n, sizeof(big));
+    ASSERT_EQ(db_insert(table_id, 2 * n, big, sizeof(big)), 0);
+
+    // Buckets have no order between them, so nothing that needs one runs.
+    EXPECT_EQ(db_cursor_open(table_id, 0, n, 0, 0), nullptr);
+    EXPECT_NE(db_set_blink(table_id, true), 0);
+    EXPECT_NE(db_set_counted(table_id, true), 0);
+    EXPECT_NE(db_set_tombstones(table_id, true), 0);
+    EXPECT_NE(db_set_bloom(table_id, n), 0);
+
+    // The directory is rebuilt from its pages on the next open.
+    shutdown_db();
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    ASSERT_NE(give_tree(table_id)->hash, nullptr);
+    for (int i = 0; i < 2; i++) ret_vals[i] = values[i];
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find_batch(table_id, keys, 2, ret_vals, val_sizes, results, trx_id), 0);
+    EXPECT_EQ(results[0], 0);
+    EXPECT_EQ(results[1], 0);
+    EXPECT_STREQ(values[1], "5");
+    ASSERT_EQ(db_find(table_id, 42, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "xx");
+    EXPECT_NE(db_find(table_id, 3, value, &val_size, trx_id), 0);
+    ASSERT_EQ(db_find(table_id, 2 * n, out, &val_size, trx_id), 0);
+    EXPECT_EQ(val_size, sizeof(big));
+    EXPECT_EQ(memcmp(out, big, sizeof(big)), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, AdaptiveHashIndex) {
+    const int64_t n = 50000;
+    char value[16];
+    uint16_t val_size;
+    uint64_t leaf_num;
+    uint32_t slot;
+    int trx_id;
+    ahi_t* ahi;
+
+    ASSERT_TRUE(table_id >= 0);
+    for (int64_t key = 0; key < n; key += 2) {
+        sprintf(value, "%ld", key);
+        ASSERT_EQ(db_insert(table_id, key, value, strlen(value) + 1), 0);
+    }
+    ahi = give_tree(table_id)->ahi;
+    ASSERT_NE(ahi, nullptr);
+
+    // A few hot keys are learned and keep hitting.
+    trx_id = trx_begin();
+    for (int i = 0; i < 2 * AHI_WINDOW; i++)
+        ASSERT_EQ(db_find(table_id, i % 64 * 700, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    EXPECT_TRUE(ahi->enabled);
+    ASSERT_TRUE(ahi_lookup(ahi, 700, &leaf_num, &slot));
+
+    // Splits and deletes leave entries stale, finds still see the tree.
+    for (int64_t key = 0; key < 64 * 700; key += 700)
+        for (int64_t odd = key - 199; odd < key + 200; odd += 2)
+            if (odd > 0) {
+                sprintf(value, "%ld", odd);
+                ASSERT_EQ(db_insert(table_id, odd, value, strlen(value) + 1), 0);
+            }
+    ASSERT_EQ(db_delete(table_id, 700), 0);
+    ASSERT_EQ(db_update(table_id, 1400, (char*)"xxxx", 5, &val_size, trx_id = trx_begin()), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    for (int64_t key = 700; key < 64 * 700; key += 700)
+        for (int64_t even = key - 100; even < key; even += 2)
+            ASSERT_EQ(db_delete(table_id, even), 0);
+    trx_id = trx_begin();
+    EXPECT_NE(db_find(table_id, 700, value, &val_size, trx_id), 0);
+    ASSERT_EQ(db_find(table_id, 1400, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "xxxx");
+    for (int64_t key = 2100; key < 64 * 700; key += 700) {
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atol(value), key);
+        ASSERT_EQ(db_find(table_id, key + 1, value, &val_size, trx_id), 0);
+        EXPECT_EQ(atol(value), key + 1);
+        EXPECT_NE(db_find(table_id, key - 2, value, &val_size, trx_id), 0);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // Spread out finds switch it off, hot ones bring it back.
+    trx_id = trx_begin();
+    srand(7);
+    for (int i = 0; i < 2 * AHI_WINDOW; i++)
+        db_find(table_id, rand() % n, value, &val_size, trx_id);
+    EXPECT_FALSE(ahi->enabled);
+    for (int i = 0; i < AHI_RETRY + 2 * AHI_WINDOW; i++)
+        db_find(table_id, i % 64 * 700 + 2, value, &val_size, trx_id);
+    EXPECT_TRUE(ahi->enabled);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    EXPECT_EQ(db_set_adaptive_hash(table_id, false), 0);
+    EXPECT_FALSE(ahi_active(ahi));
+}
+
+TEST_F(BptTest, RowCache) {
+    const int64_t n = 1000;
+    char value[512];
+    uint16_t val_size, old_size;
+    rowcache_stats_t stats;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, n);
+    ASSERT_EQ(db_set_row_cache(1 << 20), 0);
+
+    for (int pass = 0; pass < 2; pass++)
+        for (int64_t key = 0; key < n; key++) {
+            ASSERT_EQ(db_find(table_id, key, value, &val_size, 0), 0);
+            ASSERT_EQ(atol(value), key);
+        }
+    db_row_cache_stats(&stats);
+    EXPECT_EQ(stats.misses, n);
+    EXPECT_EQ(stats.hits, n);
+    EXPECT_EQ(stats.entries, n);
+
+    // Reads under a transaction go to the leaf and leave the cache alone.
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 3, value, &val_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+    db_row_cache_stats(&stats);
+    EXPECT_EQ(stats.hits + stats.misses, 2 * n);
+
+    // An unlocked read sees the open update, and the rollback once undone.
+    trx_id = trx_begin();
+    ASSERT_EQ(db_update(table_id, 5, (char*)"new", 4, &old_size, trx_id), 0);
+    ASSERT_EQ(db_find(table_id, 5, value, &val_size, 0), 0);
+    EXPECT_STREQ(value, "new");
+    EXPECT_EQ(trx_abort(trx_id), trx_id);
+    ASSERT_EQ(db_find(table_id, 5, value, &val_size, 0), 0);
+    EXPECT_STREQ(value, "5");
+
+    ASSERT_EQ(db_delete(table_id, 6), 0);
+    EXPECT_NE(db_find(table_id, 6, value, &val_size, 0), 0);
+    memset(value, 'v', 300);
+    ASSERT_EQ(db_insert(table_id, n, value, 300), 0);
+    ASSERT_EQ(db_find(table_id, n, value, &val_size, 0), 0);
+    EXPECT_EQ(val_size, 300);
+    db_row_cache_stats(&stats);
+    EXPECT_EQ(stats.entries, n - 1);
+    EXPECT_GE(stats.invalidations, 2);
+
+    // Shrinking evicts the least recently used entries.
+    ASSERT_EQ(db_set_row_cache(ROWCACHE_SHARDS * 1024), 0);
+    db_row_cache_stats(&stats);
+    EXPECT_LE(stats.bytes, ROWCACHE_SHARDS * 1024);
+    EXPECT_GT(stats.evictions, 0);
+    ASSERT_EQ(db_set_row_cache(0), 0);
+    db_row_cache_stats(&stats);
+    EXPECT_EQ(stats.entries, 0);
+    ASSERT_EQ(db_find(table_id, 7, value, &val_size, 0), 0);
+    EXPECT_STREQ(value, "7");
+}
+
+TEST_F(BptTest, FindView) {
+    char big[10000], small[16];
+    std::string joined;
+    uint16_t val_size;
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 1000);
+    fill_value(big, 5000, sizeof(big));
+    ASSERT_EQ(db_insert(table_id, 5000, big, sizeof(big)), 0);
+
+    trx_id = trx_begin();
+    {
+        value_view_t view = db_find_view(table_id, 42, trx_id);
+        ASSERT_TRUE(view.valid());
+        EXPECT_EQ(view.size(), 3);
+        EXPECT_EQ(view.total_size(), 3);
+        EXPECT_STREQ(view.data(), "42");
+        EXPECT_FALSE(db_find_view(table_id, 4242, trx_id).valid());
+
+        // Ownership moves, the latch is released once.
+        value_view_t moved = std::move(view);
+        EXPECT_FALSE(view.valid());
+        EXPECT_STREQ(moved.data(), "42");
+    }
+    {
+        value_view_t view = db_find_view(table_id, 5000, trx_id);
+        ASSERT_TRUE(view.valid());
+        EXPECT_EQ(view.total_size(), sizeof(big));
+        EXPECT_GT(view.num_parts, 1);
+        for (uint32_t i = 0; i < view.num_parts; i++)
+            joined.append(view.parts[i].data, view.parts[i].size);
+        EXPECT_EQ(joined.size(), sizeof(big));
+        EXPECT_EQ(memcmp(joined.data(), big, sizeof(big)), 0);
+        view.release();
+        EXPECT_FALSE(view.valid());
+    }
+    // The leaf is free again once the views are gone.
+    ASSERT_EQ(db_find(table_id, 42, small, &val_size, trx_id), 0);
+    ASSERT_EQ(db_update(table_id, 43, (char*)"zz", 3, &val_size, trx_id), 0);
+    EXPECT_STREQ(db_find_view(table_id, 43, trx_id).data(), "zz");
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}
+
+TEST_F(BptTest, ScatterGather) {
+    char big[6000], value[8000], expected[8000];
+    uint16_t val_size, old_size;
+    struct iovec iov[3];
+    int trx_id;
+
+    ASSERT_TRUE(table_id >= 0);
+    insert_keys(0, 1000);
+
+    iov[0] = {(void*)"ab", 2};
+    iov[1] = {(void*)"", 0};
+    iov[2] = {(void*)"cde", 4};
+    ASSERT_EQ(db_insert_v(table_id, 1000, iov, 3), 0);
+    EXPECT_NE(db_insert_v(table_id, 1000, iov, 3), 0);
+
+    // An overflow value is split across the chain pages, not at the pieces.
+    fill_value(big, 1001, sizeof(big));
+    iov[0] = {big, 1000};
+    iov[1] = {big + 1000, 4500};
+    iov[2] = {big + 5500, 500};
+    ASSERT_EQ(db_insert_v(table_id, 1001, iov, 3), 0);
+    iov[0] = {big, 40000};
+    iov[1] = {big, 40000};
+    EXPECT_NE(db_insert_v(table_id, 1002, iov, 2), 0);
+
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 1000, value, &val_size, trx_id), 0);
+    EXPECT_EQ(val_size, 6);
+    EXPECT_STREQ(value, "abcde");
+    ASSERT_EQ(db_find(table_id, 1001, value, &val_size, trx_id), 0);
+    EXPECT_EQ(val_size, sizeof(big));
+    EXPECT_EQ(memcmp(value, big, sizeof(big)), 0);
+
+    // Updates are logged and undone like db_update.
+    iov[0] = {(void*)"x", 1};
+    iov[1] = {(void*)"yz", 3};
+    ASSERT_EQ(db_update_v(table_id, 7, iov, 2, &old_size, trx_id), 0);
+    EXPECT_EQ(old_size, 2);
+    ASSERT_EQ(db_find(table_id, 7, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "xyz");
+    EXPECT_EQ(trx_abort(trx_id), trx_id);
+
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 7, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "7");
+    iov[0] = {(void*)"88", 2};
+    iov[1] = {(void*)"8", 2};
+    ASSERT_EQ(db_update_v(table_id, 888, iov, 2, &old_size, trx_id), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    shutdown_db();
+    init_db(100, RECOVERY, NO_CRASH, log_path, logmsg_path);
+    table_id = open_table(pathname);
+    trx_id = trx_begin();
+    ASSERT_EQ(db_find(table_id, 888, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "888");
+    ASSERT_EQ(db_find(table_id, 1000, value, &val_size, trx_id), 0);
+    EXPECT_STREQ(value, "abcde");
+    ASSERT_EQ(db_find(table_id, 1001, expected, &val_size, trx_id), 0);
+    EXPECT_EQ(memcmp(expected, big, sizeof(big)), 0);
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+
+    // Pieces are copied straight into the slot, also when the leaf splits.
+    for (int64_t key = 2000; key < 2400; key++) {
+        fill_value(big, key, 100);
+        iov[0] = {big, 30};
+        iov[1] = {big + 30, 0};
+        iov[2] = {big + 30, 70};
+        ASSERT_EQ(db_insert_v(table_id, key * 7 % 400 + 2000, iov, 3), 0);
+    }
+    trx_id = trx_begin();
+    for (int64_t key = 2000; key < 2400; key++) {
+        fill_value(big, (key - 2000) * 343 % 400 + 2000, 100);
+        ASSERT_EQ(db_find(table_id, key, value, &val_size, trx_id), 0);
+        EXPECT_EQ(val_size, 100);
+        EXPECT_EQ(memcmp(value, big, 100), 0);
+    }
+    EXPECT_EQ(trx_commit(trx_id), trx_id);
+}